@@ -4,641 +4,438 @@
 #include <list>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <csignal>
 using namespace std;
 
 #define FTYPE double
 #include "olcNoiseMaker.h"
-
-
-namespace synth
+#include "synthEngine.h"
+#include "synthBatch.h"
+#include "synthGolden.h"
+#include "synthFixed.h"
+#include "synthLatency.h"
+#include "synthConsole.h"
+#include "synthMeter.h"
+#include "synthOSC.h"
+
+// Ctrl+C or a kill ends the live session as cleanly as Escape does, on every
+// platform, so a recording is always closed
+static atomic<bool> bQuit(false);
+
+static void OnQuit(int)
 {
-	//////////////////////////////////////////////////////////////////////////////
-	// Utilities
+	bQuit.store(true);
+}
 
-	// Converts frequency (Hz) to angular velocity
-	FTYPE w(const FTYPE dHertz)
+// The live engine's sequencer or song, effects and samples. Replaying a
+// performance log needs an engine set up exactly the same.
+static bool SetUpEngine(synth::engine& engine, const string& sReverb, const string& sSamples, const string& sPatch, const string& sSong, unsigned int nBlockSamples)
+{
+	// Establish Sequencer, the song takes over the drums when there is one
+	engine.seq = synth::sequencer(90.0);
+	if (sSong.empty())
 	{
-		return dHertz * 2.0 * PI;
-	}
+		engine.seq.AddInstrument(&engine.instKick);
+		engine.seq.AddInstrument(&engine.instSnare);
+		engine.seq.AddInstrument(&engine.instHiHat);
 
-	struct instrument_base;
-
-	// A basic note
-	struct note
+		engine.seq.vecChannel.at(0).sBeat = L"X...X...X..X.X..";  //L"X...X...X..X.X..";
+		engine.seq.vecChannel.at(1).sBeat = L"..X...X...X...X.";  //L"..X...X...X...X."
+		engine.seq.vecChannel.at(2).sBeat = L"X.X.X.X.X.X.X.XX";  //L"X.X.X.X.X.X.X.XX"
+	}
+	else
 	{
-		int id;		// Position in scale
-		FTYPE on;	// Time note was activated
-		FTYPE off;	// Time note was deactivated
-		bool active;
-		instrument_base* channel;
-
-		note()
+		synth::song_score score;
+		string sError;
+		if (!synth::LoadSong(sSong, score, sError) || !engine.LoadSong(score, sError))
 		{
-			id = 0;
-			on = 0.0;
-			off = 0.0;
-			active = false;
-			channel = nullptr;
+			cerr << "Song: " << sError << endl;
+			return false;
 		}
+	}
 
-		//bool operator==(const note& n1, const note& n2) { return n1.id == n2.id; }
-	};
-
-	//////////////////////////////////////////////////////////////////////////////
-	// Multi-Function Oscillator
-	const int OSC_SINE = 0;
-	const int OSC_SQUARE = 1;
-	const int OSC_TRIANGLE = 2;
-	const int OSC_SAW_ANA = 3;
-	const int OSC_SAW_DIG = 4;
-	const int OSC_NOISE = 5;
+	// Effects: harmonica through the chorus and a touch of delay, rumble filtered off the master
+	engine.instHarm.dSend[synth::SEND_CHORUS] = 0.4;
+	engine.instHarm.dSend[synth::SEND_DELAY] = 0.25;
+	engine.fx.eq.SetStage(0, synth::biquad::HighPass(30.0, 0.707, 44100.0));
 
-	FTYPE osc(const FTYPE dTime, const FTYPE dHertz, const int nType = OSC_SINE,
-		const FTYPE dLFOHertz = 0.0, const FTYPE dLFOAmplitude = 0.0, FTYPE dCustom = 50.0)
+	// Room reverb from an impulse response, partitioned to the device block so it adds one block of latency
+	if (!sReverb.empty())
 	{
-
-		FTYPE dFreq = w(dHertz) * dTime + dLFOAmplitude * dHertz * (sin(w(dLFOHertz) * dTime));
-
-		switch (nType)
-		{
-		case OSC_SINE: // Sine wave bewteen -1 and +1
-			return sin(dFreq);
-
-		case OSC_SQUARE: // Square wave between -1 and +1
-			return sin(dFreq) > 0 ? 1.0 : -1.0;
-
-		case OSC_TRIANGLE: // Triangle wave between -1 and +1
-			return asin(sin(dFreq)) * (2.0 / PI);
-
-		case OSC_SAW_ANA: // Saw wave (analogue / warm / slow)
+		string sError;
+		if (!engine.fx.reverb.Load(sReverb, nBlockSamples, true, sError))
 		{
-			FTYPE dOutput = 0.0;
-			for (FTYPE n = 1.0; n < dCustom; n++)
-				dOutput += (sin(n * dFreq)) / n;
-			return dOutput * (2.0 / PI);
+			cerr << "Reverb: " << sError << endl;
+			return false;
 		}
+	}
 
-		case OSC_SAW_DIG:
-			return (2.0 / PI) * (dHertz * PI * fmod(dTime, 1.0 / dHertz) - (PI / 2.0));
-
-		case OSC_NOISE:
-			return 2.0 * ((FTYPE)rand() / (FTYPE)RAND_MAX) - 1.0;
-
-		default:
-			return 0.0;
+	// Sample library for the keyboard
+	if (!sSamples.empty())
+	{
+		string sError;
+		if (!engine.instSampler.Load(sSamples, sError))
+		{
+			cerr << "Sampler: " << sError << endl;
+			return false;
 		}
 	}
 
-	//////////////////////////////////////////////////////////////////////////////
-	// Scale to Frequency conversion
-
-	const int SCALE_DEFAULT = 0;
-
-	FTYPE scale(const int nNoteID, const int nScaleID = SCALE_DEFAULT)
+	// Instrument from a patch file, reloaded while it plays when it changes
+	if (!sPatch.empty())
 	{
-		switch (nScaleID)
+		string sError;
+		if (!engine.instPatch.Load(sPatch, sError))
 		{
-		case SCALE_DEFAULT: default:
-			return 8 * pow(1.0594630943592952645618252949463, nNoteID);
+			cerr << "Patch: " << sError << endl;
+			return false;
 		}
 	}
+	return true;
+}
 
-
-	//////////////////////////////////////////////////////////////////////////////
-	// Envelopes
-
-	struct envelope
+int main(int argc, char* argv[])
+{
+	// Offline batch rendering, no sound hardware involved
+	if (argc >= 3 && string(argv[1]) == "--batch")
 	{
-		virtual FTYPE amplitude(const FTYPE dTime, const FTYPE dTimeOn, const FTYPE dTimeOff) = 0;
-	};
+		unsigned int nThreads = 0;
+		if (argc >= 5 && string(argv[3]) == "--threads")
+			nThreads = (unsigned int)atoi(argv[4]);
+		return synth::batch::Run(argv[2], nThreads);
+	}
 
-	struct envelope_adsr : public envelope
+	// Renders held against references in a directory, golden/ unless one is
+	// given. --update writes the references. --perf also checks the speed
+	// against this machine's baseline, which --update-baseline writes.
+	if (argc >= 2 && string(argv[1]) == "--golden")
 	{
-		FTYPE dAttackTime;
-		FTYPE dDecayTime;
-		FTYPE dSustainAmplitude;
-		FTYPE dReleaseTime;
-		FTYPE dStartAmplitude;
-
-		envelope_adsr()
+		bool bUpdate = false, bUpdateBaseline = false, bTimed = false;
+		double dMargin = 20.0;
+		int nFirst = argc >= 3 && argv[2][0] != '-' ? 3 : 2;
+		string sDir = nFirst == 3 ? argv[2] : "golden";
+		for (int a = nFirst; a < argc; a++)
 		{
-			dAttackTime = 0.1;
-			dDecayTime = 0.1;
-			dSustainAmplitude = 1.0;
-			dReleaseTime = 0.2;
-			dStartAmplitude = 1.0;
-		}
-
-		virtual FTYPE amplitude(const FTYPE dTime, const FTYPE dTimeOn, const FTYPE dTimeOff)
-		{
-			FTYPE dAmplitude = 0.0;
-			FTYPE dReleaseAmplitude = 0.0;
-
-			if (dTimeOn > dTimeOff) // Note is on
+			if (string(argv[a]) == "--update")
+				bUpdate = true;
+			if (string(argv[a]) == "--update-baseline")
+				bUpdateBaseline = true;
+			if (string(argv[a]) == "--perf")
+				bTimed = true;
+			if (string(argv[a]) == "--perf-margin" && a + 1 < argc)
 			{
-				FTYPE dLifeTime = dTime - dTimeOn;
-
-				if (dLifeTime <= dAttackTime)
-					dAmplitude = (dLifeTime / dAttackTime) * dStartAmplitude;
-
-				if (dLifeTime > dAttackTime && dLifeTime <= (dAttackTime + dDecayTime))
-					dAmplitude = ((dLifeTime - dAttackTime) / dDecayTime) * (dSustainAmplitude - dStartAmplitude) + dStartAmplitude;
-
-				if (dLifeTime > (dAttackTime + dDecayTime))
-					dAmplitude = dSustainAmplitude;
-			}
-			else // Note is off
-			{
-				FTYPE dLifeTime = dTimeOff - dTimeOn;
-
-				if (dLifeTime <= dAttackTime)
-					dReleaseAmplitude = (dLifeTime / dAttackTime) * dStartAmplitude;
-
-				if (dLifeTime > dAttackTime && dLifeTime <= (dAttackTime + dDecayTime))
-					dReleaseAmplitude = ((dLifeTime - dAttackTime) / dDecayTime) * (dSustainAmplitude - dStartAmplitude) + dStartAmplitude;
-
-				if (dLifeTime > (dAttackTime + dDecayTime))
-					dReleaseAmplitude = dSustainAmplitude;
-
-				dAmplitude = ((dTime - dTimeOff) / dReleaseTime) * (0.0 - dReleaseAmplitude) + dReleaseAmplitude;
+				bTimed = true;
+				dMargin = atof(argv[++a]);
 			}
-
-			// Amplitude should not be negative
-			if (dAmplitude <= 0.01)
-				dAmplitude = 0.0;
-
-			return dAmplitude;
 		}
-	};
-
-	FTYPE env(const FTYPE dTime, envelope& env, const FTYPE dTimeOn, const FTYPE dTimeOff)
-	{
-		return env.amplitude(dTime, dTimeOn, dTimeOff);
+		return synth::golden::Run(sDir, bUpdate, bUpdateBaseline, bTimed, dMargin, [](synth::engine& e) { return SetUpEngine(e, "", "", "", "", 256); });
 	}
 
-
-	struct instrument_base
+	// Cost of the convolution reverb, no sound hardware involved
+	if (argc >= 2 && string(argv[1]) == "--bench-reverb")
+		return synth::BenchmarkReverb();
+
+	// Supersaw chords one voice at a time and through voice lanes
+	if (argc >= 2 && string(argv[1]) == "--bench-voices")
+		return synth::BenchmarkVoices();
+
+	// FM voices against the additive bell
+	if (argc >= 2 && string(argv[1]) == "--bench-fm")
+		return synth::BenchmarkFM();
+
+	// Filtered analog voices against the additive harmonica
+	if (argc >= 2 && string(argv[1]) == "--bench-filters")
+		return synth::BenchmarkFilters();
+
+	// Patch interpreter against the instruments it can describe
+	if (argc >= 2 && string(argv[1]) == "--bench-patch")
+		return synth::BenchmarkPatch();
+
+	// Compiled song events against the step sequencer
+	if (argc >= 2 && string(argv[1]) == "--bench-song")
+		return synth::BenchmarkSong();
+
+	// Integer engine against the floating point instruments, error and cost
+	if (argc >= 2 && string(argv[1]) == "--bench-fixed")
+		return synth::BenchmarkFixed();
+
+	// Start up cost and memory of a sample library
+	if (argc >= 3 && string(argv[1]) == "--bench-sampler")
+		return synth::BenchmarkSampler(argv[2]);
+
+	// Floods a local OSC endpoint with timestamped events and reports what made it
+	if (argc >= 2 && string(argv[1]) == "--osc-test")
+		return synth::RunOscLoopbackTest(argc >= 3 ? (unsigned short)atoi(argv[2]) : 9000);
+
+	// Adaptive latency against the device under load that comes and goes
+	if (argc >= 2 && string(argv[1]) == "--latency-test")
+		return synth::RunLatencyTest();
+
+	bool bRealtime = false;
+	bool bAdaptive = false;
+	string sReverb;
+	int nOscPort = 0;
+	string sSamples;
+	string sPatch;
+	string sSong;
+	string sRecord;
+	string sReplay, sReplayOutput;
+	for (int a = 1; a < argc; a++)
 	{
-		FTYPE dVolume;
-		synth::envelope_adsr env;
-		FTYPE fMaxLifeTime;
-		wstring name;
-		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished) = 0;
-	};
-
-	struct instrument_bell : public instrument_base
-	{
-		instrument_bell()
-		{
-			env.dAttackTime = 0.01;
-			env.dDecayTime = 1.0;
-			env.dSustainAmplitude = 0.0;
-			env.dReleaseTime = 1.0;
-			fMaxLifeTime = 3.0;
-			dVolume = 1.0;
-			name = L"Bell";
-		}
-
-		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		if (string(argv[a]) == "--realtime")
+			bRealtime = true;
+		if (string(argv[a]) == "--adaptive")
+			bAdaptive = true;
+		if (string(argv[a]) == "--reverb" && a + 1 < argc)
+			sReverb = argv[++a];
+		if (string(argv[a]) == "--osc" && a + 1 < argc)
+			nOscPort = atoi(argv[++a]);
+		if (string(argv[a]) == "--samples" && a + 1 < argc)
+			sSamples = argv[++a];
+		if (string(argv[a]) == "--patch" && a + 1 < argc)
+			sPatch = argv[++a];
+		if (string(argv[a]) == "--song" && a + 1 < argc)
+			sSong = argv[++a];
+		if (string(argv[a]) == "--record" && a + 1 < argc)
+			sRecord = argv[++a];
+		if (string(argv[a]) == "--replay" && a + 2 < argc)
 		{
-			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
-			if (dAmplitude <= 0.0) bNoteFinished = true;
-
-			FTYPE dSound =
-				+1.00 * synth::osc(dTime - n.on, synth::scale(n.id + 12), synth::OSC_SINE, 5.0, 0.001)
-				+ 0.50 * synth::osc(dTime - n.on, synth::scale(n.id + 24))
-				+ 0.25 * synth::osc(dTime - n.on, synth::scale(n.id + 36));
-
-			return dAmplitude * dSound * dVolume;
+			sReplay = argv[++a];
+			sReplayOutput = argv[++a];
 		}
+	}
 
-	};
+	const unsigned int nBlockSamples = 256;
 
-	struct instrument_bell8 : public instrument_base
+	// A recorded performance rendered offline, bit for bit what was played.
+	// Give it the --reverb, --samples and --song the recording was made with.
+	if (!sReplay.empty())
 	{
-		instrument_bell8()
+		synth::engine replay(44100);
+		if (!SetUpEngine(replay, sReverb, sSamples, sPatch, sSong, nBlockSamples))
+			return 1;
+
+		vector<short> vecOutput;
+		unsigned int nSampleRate = 0, nChannels = 0;
+		string sError;
+		if (!synth::batch::ReplayLog(replay, sReplay, vecOutput, nSampleRate, nChannels, sError))
 		{
-			env.dAttackTime = 0.01;
-			env.dDecayTime = 0.5;
-			env.dSustainAmplitude = 0.8;
-			env.dReleaseTime = 1.0;
-			fMaxLifeTime = 3.0;
-			dVolume = 1.0;
-			name = L"8-Bit Bell";
+			cerr << "Replay: " << sError << endl;
+			return 1;
 		}
-
-		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		if (!synth::wave::Write(sReplayOutput, vecOutput, nSampleRate, nChannels))
 		{
-			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
-			if (dAmplitude <= 0.0) bNoteFinished = true;
-
-			FTYPE dSound =
-				+1.00 * synth::osc(dTime - n.on, synth::scale(n.id), synth::OSC_SQUARE, 5.0, 0.001)
-				+ 0.50 * synth::osc(dTime - n.on, synth::scale(n.id + 12))
-				+ 0.25 * synth::osc(dTime - n.on, synth::scale(n.id + 24));
-
-			return dAmplitude * dSound * dVolume;
+			cerr << "Replay: cannot write " << sReplayOutput << endl;
+			return 1;
 		}
+		cout << sReplayOutput << ": " << fixed << setprecision(3) << (double)vecOutput.size() / nChannels / nSampleRate << "s" << endl;
+		return 0;
+	}
 
-	};
-
-	struct instrument_harmonica : public instrument_base
-	{
-		instrument_harmonica()
-		{
-			env.dAttackTime = 0.00;
-			env.dDecayTime = 1.0;
-			env.dSustainAmplitude = 0.95;
-			env.dReleaseTime = 0.1;
-			fMaxLifeTime = -1.0;
-			name = L"Harmonica";
-			dVolume = 0.3;
-		}
-
-		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
-		{
-			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
-			if (dAmplitude <= 0.0) bNoteFinished = true;
-
-			FTYPE dSound =
-				+1.0 * synth::osc(n.on - dTime, synth::scale(n.id - 12), synth::OSC_SAW_ANA, 5.0, 0.001, 100)
-				+ 1.00 * synth::osc(dTime - n.on, synth::scale(n.id), synth::OSC_SQUARE, 5.0, 0.001)
-				+ 0.50 * synth::osc(dTime - n.on, synth::scale(n.id + 12), synth::OSC_SQUARE)
-				+ 0.05 * synth::osc(dTime - n.on, synth::scale(n.id + 24), synth::OSC_NOISE);
-
-			return dAmplitude * dSound * dVolume;
-		}
+	// The engine driven by the sound card and the keyboard
+	synth::engine engine(44100);
 
-	};
+	if (!SetUpEngine(engine, sReverb, sSamples, sPatch, sSong, nBlockSamples))
+		return 1;
 
+	atomic<unsigned int> nPatchLoads{ engine.instPatch.Loads() };
+	atomic<bool> bPatchFailed{ false };
 
-	struct instrument_drumkick : public instrument_base
+	// Everything played from here on, for --replay
+	synth::performance_log log;
+	if (!sRecord.empty())
 	{
-		instrument_drumkick()
+		string sError;
+		if (!log.Start(sRecord, 44100, 1, sError))
 		{
-			env.dAttackTime = 0.01;
-			env.dDecayTime = 0.15;
-			env.dSustainAmplitude = 0.0;
-			env.dReleaseTime = 0.0;
-			fMaxLifeTime = 1.5;
-			name = L"Drum Kick";
-			dVolume = 1.0;
+			cerr << "Record: " << sError << endl;
+			return 1;
 		}
+		engine.SetLog(&log);
+	}
 
-		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
-		{
-			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
-			if (fMaxLifeTime > 0.0 && dTime - n.on >= fMaxLifeTime)	bNoteFinished = true;
-
-			FTYPE dSound =
-				+0.99 * synth::osc(dTime - n.on, synth::scale(n.id - 36), synth::OSC_SINE, 1.0, 1.0)
-				+ 0.01 * synth::osc(dTime - n.on, 0, synth::OSC_NOISE);
+	// Get all sound hardware
+	vector<wstring> devices = olcNoiseMaker<short>::Enumerate();
 
-			return dAmplitude * dSound * dVolume;
-		}
+	// Create sound machine!! With --adaptive the queue starts the same and is
+	// then sized to how the machine keeps up, up to 16 blocks of 2048
+	synth::latency_controller latency;
+	olcNoiseMaker<short> sound(devices[0], 44100, 1, 8, nBlockSamples, bAdaptive ? latency.nMaxBlocks : 0, bAdaptive ? latency.nMaxBlockSamples : 0);
+	if (bAdaptive)
+		sound.SetLatencyController(&latency);
+
+	// Link engine with sound machine, and tap what it plays for the meters.
+	// Real-time first, a recording's flags come from the engine's first block.
+	synth::output_tap tap;
+	if (bRealtime)
+		sound.EnableRealtime();
+	sound.SetUserSource(&engine);
+	sound.SetUserTap(&tap);
+
+	// Remote control from sequencing services, over OSC on localhost
+	synth::osc_endpoint remote(engine);
+	if (nOscPort > 0)
+	{
+		string sError;
+		if (!remote.Start((unsigned short)nOscPort, sError))
+			cerr << "OSC: " << sError << endl;
+	}
 
-	};
+	// Screen, redrawn by its own thread at 30Hz. It only sees the engine through
+	// lock-free snapshots, never the playing notes themselves.
+	synth::console screen(80, 30);
+	auto clock_start_time = chrono::steady_clock::now();
+	synth::meter levels;
+	levels.Create(44100.0);
 
-	struct instrument_drumsnare : public instrument_base
+	screen.Start([&](synth::console& draw)
 	{
-		instrument_drumsnare()
-		{
-			env.dAttackTime = 0.0;
-			env.dDecayTime = 0.2;
-			env.dSustainAmplitude = 0.0;
-			env.dReleaseTime = 0.0;
-			fMaxLifeTime = 1.0;
-			name = L"Drum Snare";
-			dVolume = 1.0;
-		}
+		const synth::engine::snapshot& state = engine.GetSnapshot();
+		double dWallTime = chrono::duration<double>(chrono::steady_clock::now() - clock_start_time).count();
 
-		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		// Draw Sequencer
+		draw.Draw(2, 2, L"SEQUENCER:");
+		for (int beats = 0; beats < engine.seq.nBeats; beats++)
 		{
-			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
-			if (fMaxLifeTime > 0.0 && dTime - n.on >= fMaxLifeTime)	bNoteFinished = true;
-
-			FTYPE dSound =
-				+0.5 * synth::osc(dTime - n.on, synth::scale(n.id - 24), synth::OSC_SINE, 0.5, 1.0)
-				+ 0.5 * synth::osc(dTime - n.on, 0, synth::OSC_NOISE);
-
-			return dAmplitude * dSound * dVolume;
+			draw.Draw(beats * engine.seq.nSubBeats + 20, 2, L"O");
+			for (int subbeats = 1; subbeats < engine.seq.nSubBeats; subbeats++)
+				draw.Draw(beats * engine.seq.nSubBeats + subbeats + 20, 2, L".");
 		}
 
-	};
-
-
-	struct instrument_drumhihat : public instrument_base
-	{
-		instrument_drumhihat()
+		// Draw Sequences
+		int n = 0;
+		for (auto& v : engine.seq.vecChannel)
 		{
-			env.dAttackTime = 0.01;
-			env.dDecayTime = 0.05;
-			env.dSustainAmplitude = 0.0;
-			env.dReleaseTime = 0.0;
-			fMaxLifeTime = 1.0;
-			name = L"Drum HiHat";
-			dVolume = 0.5;
+			draw.Draw(2, 3 + n, v.instrument->name);
+			draw.Draw(20, 3 + n, v.sBeat);
+			n++;
 		}
 
-		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
-		{
-			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
-			if (fMaxLifeTime > 0.0 && dTime - n.on >= fMaxLifeTime)	bNoteFinished = true;
-
-			FTYPE dSound =
-				+0.1 * synth::osc(dTime - n.on, synth::scale(n.id - 12), synth::OSC_SQUARE, 1.5, 1)
-				+ 0.9 * synth::osc(dTime - n.on, 0, synth::OSC_NOISE);
+		// Draw Beat Cursor
+		draw.Draw(20 + state.nCurrentBeat, 1, L"|");
 
-			return dAmplitude * dSound * dVolume;
+		// Draw Song Position
+		if (state.nSongEntry >= 0)
+		{
+			const string& sName = engine.song.Name(state.nSongEntry);
+			draw.Draw(2, 3, L"SONG: " + wstring(sName.begin(), sName.end()) + L"  (" + to_wstring(state.nSongEntry + 1) + L" of " + to_wstring(engine.song.Entries()) + L")");
 		}
 
-	};
-
+		// Draw Keyboard
+		draw.Draw(2, 8, L"|   |   |   |   |   | |   |   |   |   | |   | |   |   |   |  ");
+		draw.Draw(2, 9, L"|   | S |   |   | F | | G |   |   | J | | K | | L |   |   |  ");
+		draw.Draw(2, 10, L"|   |___|   |   |___| |___|   |   |___| |___| |___|   |   |__");
+		draw.Draw(2, 11, L"|     |     |     |     |     |     |     |     |     |     |");
+		draw.Draw(2, 12, L"|  Z  |  X  |  C  |  V  |  B  |  N  |  M  |  ,  |  .  |  /  |");
+		draw.Draw(2, 13, L"|_____|_____|_____|_____|_____|_____|_____|_____|_____|_____|");
 
-	struct sequencer
-	{
-	public:
-		struct channel
-		{
-			instrument_base* instrument;
-			wstring sBeat;
-		};
+		// Draw Stats
+		wstring stats = L"Notes: " + to_wstring(state.nNotes) + L" Wall Time: " + to_wstring(dWallTime) + L" CPU Time: " + to_wstring(state.dTime) + L" Latency: " + to_wstring(dWallTime - state.dTime);
+		draw.Draw(2, 15, stats);
 
-	public:
-		sequencer(float tempo = 120.0f, int beats = 4, int subbeats = 4)
+		if (bRealtime)
 		{
-			nBeats = beats;
-			nSubBeats = subbeats;
-			fTempo = tempo;
-			fBeatTime = (60.0f / fTempo) / (float)nSubBeats;
-			nCurrentBeat = 0;
-			nTotalBeats = nSubBeats * nBeats;
-			fAccumulate = 0;
+			int nGranted = sound.GetRealtime();
+			draw.Draw(2, 16, wstring(L"Realtime:") +
+				((nGranted & olcNoiseMaker<short>::REALTIME_PRIORITY) ? L" priority" : L" NO-priority") +
+				((nGranted & olcNoiseMaker<short>::REALTIME_MEMLOCK) ? L" mlock" : L" NO-mlock") +
+				((nGranted & olcNoiseMaker<short>::REALTIME_FTZ) ? L" ftz" : L" NO-ftz"));
 		}
 
+		if (!sPatch.empty())
+			draw.Draw(2, 14, L"Patch: loaded " + to_wstring(nPatchLoads) + (bPatchFailed ? L" times, the file has an error" : L" times"));
 
-		int Update(FTYPE fElapsedTime)
+		if (bAdaptive)
 		{
-			vecNotes.clear();
-
-			fAccumulate += fElapsedTime;
-			while (fAccumulate >= fBeatTime)
-			{
-				fAccumulate -= fBeatTime;
-				nCurrentBeat++;
-
-				if (nCurrentBeat >= nTotalBeats)
-					nCurrentBeat = 0;
-
-				int c = 0;
-				for (auto v : vecChannel)
-				{
-					if (v.sBeat[nCurrentBeat] == L'X')
-					{
-						note n;
-						n.channel = vecChannel[c].instrument;
-						n.active = true;
-						n.id = 64;
-						vecNotes.push_back(n);
-					}
-					c++;
-				}
-			}
-
-
-
-			return vecNotes.size();
+			wchar_t sLayout[80];
+			swprintf(sLayout, 80, L"Device: %u x %u samples, %.1fms  Load %3.0f%%  Underruns %u", sound.GetBlocks(), sound.GetBlockSamples(),
+				sound.GetLatency() * 1000.0, latency.Load() * 100.0, sound.GetUnderruns());
+			draw.Draw(2, 18, sLayout);
 		}
 
-		void AddInstrument(instrument_base* inst)
+		// Draw Output, measured here from the tap rather than on the audio thread
+		levels.Update(tap);
+		auto bar = [](FTYPE dDecibels, int nWidth)
+		{
+			int nFill = (int)((dDecibels + 60.0) / 60.0 * nWidth);
+			return wstring(min(max(nFill, 0), nWidth), L'#') + wstring(nWidth - min(max(nFill, 0), nWidth), L'.');
+		};
+		wchar_t sLevels[80];
+		swprintf(sLevels, 80, L"Peak %6.1fdB  RMS %6.1fdB  Clipped %llu", synth::meter::Decibels(levels.Peak()),
+			synth::meter::Decibels(levels.RMS()), (unsigned long long)levels.Clipped());
+		draw.Draw(2, 19, L"OUTPUT:");
+		draw.Draw(20, 19, sLevels);
+		draw.Draw(20, 20, bar(synth::meter::Decibels(levels.Peak()), 50));
+		draw.Draw(20, 21, bar(synth::meter::Decibels(levels.RMS()), 50));
+
+		// Draw Spectrum, 60 log spaced bands from 40Hz to 16kHz, 6 rows of 10dB
+		draw.Draw(2, 23, L"SPECTRUM:");
+		for (int b = 0; b < 60; b++)
 		{
-			channel c;
-			c.instrument = inst;
-			vecChannel.push_back(c);
+			FTYPE dLow = 40.0 * pow(400.0, b / 60.0), dHigh = 40.0 * pow(400.0, (b + 1) / 60.0);
+			FTYPE dBand = levels.Band(dLow, dHigh);
+			for (int r = 0; r < 6; r++)
+				if (dBand > -60.0 + (5 - r) * 10.0)
+					draw.Draw(12 + b, 23 + r, L"|");
 		}
 
-	public:
-		int nBeats;
-		int nSubBeats;
-		FTYPE fTempo;
-		FTYPE fBeatTime;
-		FTYPE fAccumulate;
-		int nCurrentBeat;
-		int nTotalBeats;
-
-	public:
-		vector<channel> vecChannel;
-		vector<note> vecNotes;
-
-
-	private:
-
-	};
-
-}
-
-vector<synth::note> vecNotes;
-mutex muxNotes;
-synth::instrument_bell instBell;
-synth::instrument_harmonica instHarm;
-synth::instrument_drumkick instKick;
-synth::instrument_drumsnare instSnare;
-synth::instrument_drumhihat instHiHat;
-
-typedef bool(*lambda)(synth::note const& item);
-template<class T>
-void safe_remove(T& v, lambda f)
-{
-	auto n = v.begin();
-	while (n != v.end())
-		if (!f(*n))
-			n = v.erase(n);
-		else
-			++n;
-}
-
-// Function used by olcNoiseMaker to generate sound waves
-// Returns amplitude (-1.0 to +1.0) as a function of time
-FTYPE MakeNoise(int nChannel, FTYPE dTime)
-{
-	unique_lock<mutex> lm(muxNotes);
-	FTYPE dMixedOutput = 0.0;
-
-	// Iterate through all active notes, and mix together
-	for (auto& n : vecNotes)
-	{
-		bool bNoteFinished = false;
-		FTYPE dSound = 0;
-
-		// Get sample for this note by using the correct instrument and envelope
-		if (n.channel != nullptr)
-			dSound = n.channel->sound(dTime, n, bNoteFinished);
-
-		// Mix into output
-		dMixedOutput += dSound;
-
-		if (bNoteFinished) // Flag note to be removed
-			n.active = false;
-	}
-	// Woah! Modern C++ Overload!!! Remove notes which are now inactive
-	safe_remove<vector<synth::note>>(vecNotes, [](synth::note const& item) { return item.active; });
-	return dMixedOutput * 0.2;
-}
-
-int main()
-{
-
-
-
-	// Get all sound hardware
-	vector<wstring> devices = olcNoiseMaker<short>::Enumerate();
-
-	// Create sound machine!!
-	olcNoiseMaker<short> sound(devices[0], 44100, 1, 8, 256);
-
-	// Link noise function with sound machine
-	sound.SetUserFunction(MakeNoise);
-
-	// Create Screen Buffer
-	wchar_t* screen = new wchar_t[80 * 30];
-	HANDLE hConsole = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
-	SetConsoleActiveScreenBuffer(hConsole);
-	DWORD dwBytesWritten = 0;
-
-	// Lambda function to draw into the character array conveniently
-	auto draw = [&screen](int x, int y, wstring s)
-	{
-		for (size_t i = 0; i < s.size(); i++)
-			screen[y * 80 + x + i] = s[i];
-	};
-
-	auto clock_old_time = chrono::high_resolution_clock::now();
-	auto clock_real_time = chrono::high_resolution_clock::now();
-	double dElapsedTime = 0.0;
-	double dWallTime = 0.0;
-
-	// Establish Sequencer
-	synth::sequencer seq(90.0);
-	seq.AddInstrument(&instKick);
-	seq.AddInstrument(&instSnare);
-	seq.AddInstrument(&instHiHat);
-
-	seq.vecChannel.at(0).sBeat = L"X...X...X..X.X..";  //L"X...X...X..X.X..";
-	seq.vecChannel.at(1).sBeat = L"..X...X...X...X.";  //L"..X...X...X...X."
-	seq.vecChannel.at(2).sBeat = L"X.X.X.X.X.X.X.XX";  //L"X.X.X.X.X.X.X.XX"
-
-	while (1)
+#ifdef SYNTH_RT_CHECKS
+		// Anything that allocated or locked while rendering
+		const char* sViolation = synth::rt::LastViolation();
+		draw.Draw(2, 17, L"RT violations: " + to_wstring(synth::rt::Violations()) + L" last: " + (sViolation ? wstring(sViolation, sViolation + strlen(sViolation)) : L"none"));
+#endif
+	}, 30);
+
+	auto tReloaded = chrono::steady_clock::now();
+#ifdef _WIN32
+	// Keyboard plays the sample library or the patch instead of the harmonica
+	synth::instrument_base* pKeyboard = &engine.instHarm;
+	if (!sPatch.empty())
+		pKeyboard = &engine.instPatch;
+	if (!sSamples.empty())
+		pKeyboard = &engine.instSampler;
+	bool bKeyDown[16] = {};
+#endif
+	signal(SIGINT, OnQuit);
+	signal(SIGTERM, OnQuit);
+	while (!bQuit.load())
 	{
-		// --- SOUND STUFF ---
-
-		// Update Timings =======================================================================================
-		clock_real_time = chrono::high_resolution_clock::now();
-		auto time_last_loop = clock_real_time - clock_old_time;
-		clock_old_time = clock_real_time;
-		dElapsedTime = chrono::duration<FTYPE>(time_last_loop).count();
-		dWallTime += dElapsedTime;
-		FTYPE dTimeNow = sound.GetTime();
-
-		// Sequencer (generates notes, note offs applied by note lifespan) ======================================
-		int newNotes = seq.Update(dElapsedTime);
-		muxNotes.lock();
-		for (int a = 0; a < newNotes; a++)
-		{
-			seq.vecNotes[a].on = dTimeNow;
-			vecNotes.emplace_back(seq.vecNotes[a]);
-		}
-		muxNotes.unlock();
+		// Keyboard (generates and removes notes as keys change state) ========================================
+#ifdef _WIN32
+		if (GetAsyncKeyState(VK_ESCAPE) & 0x8000)
+			break;	// Ends the session, closing any recording
 
-		// Keyboard (generates and removes notes depending on key state) ========================================
 		for (int k = 0; k < 16; k++)
 		{
-			short nKeyState = GetAsyncKeyState((unsigned char)("ZSXCFVGBNJMK\xbcL\xbe\xbf"[k]));
+			bool bDown = (GetAsyncKeyState((unsigned char)("ZSXCFVGBNJMK\xbcL\xbe\xbf"[k])) & 0x8000) != 0;
+			if (bDown == bKeyDown[k])
+				continue;	// Only changes are sent, so the log holds what was played
 
-			// Check if note already exists in currently playing notes
-			muxNotes.lock();
-			auto noteFound = find_if(vecNotes.begin(), vecNotes.end(), [&k](synth::note const& item) { return item.id == k + 64 && item.channel == &instHarm; });
-			if (noteFound == vecNotes.end())
-			{
-				// Note not found in vector
-				if (nKeyState & 0x8000)
-				{
-					// Key has been pressed so create a new note
-					synth::note n;
-					n.id = k + 64;
-					n.on = dTimeNow;
-					n.active = true;
-					n.channel = &instHarm;
-
-					// Add note to vector
-					vecNotes.emplace_back(n);
-				}
-			}
-			else
-			{
-				// Note exists in vector
-				if (nKeyState & 0x8000)
-				{
-					// Key is still held, so do nothing
-					if (noteFound->off > noteFound->on)
-					{
-						// Key has been pressed again during release phase
-						noteFound->on = dTimeNow;
-						noteFound->active = true;
-					}
-				}
-				else
-				{
-					// Key has been released, so switch off
-					if (noteFound->off < noteFound->on)
-						noteFound->off = dTimeNow;
-				}
-			}
-			muxNotes.unlock();
+			// Pressed (again during release phase starts it over), or released
+			if (bDown ? engine.NoteOn(k + 64, pKeyboard) : engine.NoteOff(k + 64, pKeyboard))
+				bKeyDown[k] = bDown;
 		}
+#endif
 
-		// --- VISUAL STUFF ---
-
-		// Clear Background
-		for (int i = 0; i < 80 * 30; i++) screen[i] = L' ';
-
-		// Draw Sequencer
-		draw(2, 2, L"SEQUENCER:");
-		for (int beats = 0; beats < seq.nBeats; beats++)
+		// Pick up edits to the patch file twice a second
+		if (!sPatch.empty() && chrono::steady_clock::now() - tReloaded > chrono::milliseconds(500))
 		{
-			draw(beats * seq.nSubBeats + 20, 2, L"O");
-			for (int subbeats = 1; subbeats < seq.nSubBeats; subbeats++)
-				draw(beats * seq.nSubBeats + subbeats + 20, 2, L".");
+			string sError;
+			bPatchFailed = !engine.instPatch.Reload(sError);
+			nPatchLoads = engine.instPatch.Loads();
+			tReloaded = chrono::steady_clock::now();
 		}
 
-		// Draw Sequences
-		int n = 0;
-		for (auto v : seq.vecChannel)
-		{
-			draw(2, 3 + n, v.instrument->name);
-			draw(20, 3 + n, v.sBeat);
-			n++;
-		}
-
-		// Draw Beat Cursor
-		draw(20 + seq.nCurrentBeat, 1, L"|");
-
-		// Draw Keyboard
-		draw(2, 8, L"|   |   |   |   |   | |   |   |   |   | |   | |   |   |   |  ");
-		draw(2, 9, L"|   | S |   |   | F | | G |   |   | J | | K | | L |   |   |  ");
-		draw(2, 10, L"|   |___|   |   |___| |___|   |   |___| |___| |___|   |   |__");
-		draw(2, 11, L"|     |     |     |     |     |     |     |     |     |     |");
-		draw(2, 12, L"|  Z  |  X  |  C  |  V  |  B  |  N  |  M  |  ,  |  .  |  /  |");
-		draw(2, 13, L"|_____|_____|_____|_____|_____|_____|_____|_____|_____|_____|");
-
-		// Draw Stats
-		wstring stats = L"Notes: " + to_wstring(vecNotes.size()) + L" Wall Time: " + to_wstring(dWallTime) + L" CPU Time: " + to_wstring(dTimeNow) + L" Latency: " + to_wstring(dWallTime - dTimeNow);
-		draw(2, 15, stats);
-
-		// Update Display
-		WriteConsoleOutputCharacter(hConsole, screen, 80 * 30, { 0,0 }, &dwBytesWritten);
+		// Poll often enough to stay well inside one block, without burning a core
+		this_thread::sleep_for(chrono::milliseconds(2));
 	}
 
-
+	// Nothing may be left rendering or receiving once the engine goes
+	screen.Stop();
+	remote.Stop();
+	sound.Stop();
+	log.Stop();
 	return 0;
 }
 
@@ -3,19 +3,37 @@
 
 #pragma once
 
+#ifdef _WIN32
 #pragma comment(lib, "winmm.lib")
+#endif
 
 #include <iostream>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <vector>
 #include <string>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <algorithm>
 #include <condition_variable>
 using namespace std;
 
+#ifdef _WIN32
+#include <WinSock2.h>	// Must come first, Windows.h would pull in the old winsock.h
 #include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
 
 #ifndef FTYPE
 #define FTYPE double
@@ -23,13 +41,69 @@ using namespace std;
 
 const double PI = 2.0 * acos(0.0);
 
+// Interface for anything that fills blocks of sound for olcNoiseMaker. Unlike
+// the plain user function, a source carries its own state, so any number of
+// independent sources can live in one process.
+class olcNoiseSource
+{
+public:
+	virtual ~olcNoiseSource() {}
+
+	// Fill nFrames frames of nChannels interleaved samples (-1.0 to +1.0)
+	virtual void ProcessBlock(FTYPE* pBuffer, unsigned int nFrames, unsigned int nChannels) = 0;
+
+	// Sources that render straight to 16 bit samples override this and return
+	// true. olcNoiseMaker<short> then hands them the device block itself.
+	virtual bool ProcessBlock16(int16_t* /*pBuffer*/, unsigned int /*nFrames*/, unsigned int /*nChannels*/) { return false; }
+};
+
+// Receives every block exactly as it goes to the device, after clipping. Called
+// on the audio thread, so it must copy and return, never wait.
+class olcNoiseTap
+{
+public:
+	virtual ~olcNoiseTap() {}
+
+	// nClipped counts the samples clip() actually limited
+	virtual void Capture(const FTYPE* pBuffer, unsigned int nFrames, unsigned int nChannels, unsigned int nClipped) = 0;
+};
+
+// Chooses the block layout while sound is playing. Called on the audio thread
+// after every block, so it must decide quickly and never wait.
+class olcNoiseLatency
+{
+public:
+	virtual ~olcNoiseLatency() {}
+
+	// dRender is how long the block took to fill, dBlock how long it plays for.
+	// nQueued is how many blocks the device still had to play when filling
+	// started; if they play for less than dRender it runs dry before this one. Change nBlocks and nBlockSamples
+	// for the blocks that follow.
+	virtual void Update(double dRender, double dBlock, unsigned int nQueued, unsigned int& nBlocks, unsigned int& nBlockSamples) = 0;
+};
+
+// On Windows blocks go to a waveOut device. Elsewhere there is only the "Null
+// Device", which consumes blocks at the real-time rate and discards them, so the
+// engine runs with true timing on headless boxes.
 template<class T>
 class olcNoiseMaker
 {
 public:
-	olcNoiseMaker(wstring sOutputDevice, unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512)
+	// What EnableRealtime() managed to apply, see GetRealtime()
+	enum
+	{
+		REALTIME_PRIORITY = 1,	// SCHED_FIFO / time critical thread priority
+		REALTIME_MEMLOCK = 2,	// Block memory locked into RAM
+		REALTIME_FTZ = 4,		// Denormals flushed to zero on the audio thread
+	};
+
+public:
+	// The layout can later change up to nMaxBlocks of nMaxBlockSamples, both
+	// default to the starting layout
+	olcNoiseMaker(wstring sOutputDevice, unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512,
+		unsigned int nMaxBlocks = 0, unsigned int nMaxBlockSamples = 0)
 	{
-		Create(sOutputDevice, nSampleRate, nChannels, nBlocks, nBlockSamples);
+		Create(sOutputDevice, nSampleRate, nChannels, nBlocks, nBlockSamples, nMaxBlocks, nMaxBlockSamples);
 	}
 
 	~olcNoiseMaker()
@@ -37,47 +111,70 @@ public:
 		Destroy();
 	}
 
-	bool Create(wstring sOutputDevice, unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512)
+	bool Create(wstring sOutputDevice, unsigned int nSampleRate = 44100, unsigned int nChannels = 1, unsigned int nBlocks = 8, unsigned int nBlockSamples = 512,
+		unsigned int nMaxBlocks = 0, unsigned int nMaxBlockSamples = 0)
 	{
 		m_bReady = false;
 		m_nSampleRate = nSampleRate;
 		m_nChannels = nChannels;
-		m_nBlockCount = nBlocks;
+		m_nBlockCount = max(nBlocks, nMaxBlocks);
+		m_nMaxBlockSamples = max(nBlockSamples, nMaxBlockSamples);
+		m_nBlocks = nBlocks;
 		m_nBlockSamples = nBlockSamples;
 		m_nBlockFree = m_nBlockCount;
 		m_nBlockCurrent = 0;
+		m_nBlockQueued = 0;
+		m_nUnderruns = 0;
 		m_pBlockMemory = nullptr;
-		m_pWaveHeaders = nullptr;
+		m_pBlockSizes = nullptr;
+		m_pMixBuffer = nullptr;
+		m_bRealtimeWanted = false;
+		m_nRealtime = 0;
 
 		m_userFunction = nullptr;
+		m_userSource = nullptr;
+		m_userTap = nullptr;
+		m_userLatency = nullptr;
 
 		// Validate device
 		vector<wstring> devices = Enumerate();
 		auto d = std::find(devices.begin(), devices.end(), sOutputDevice);
-		if (d != devices.end())
-		{
-			// Device is available
-			int nDeviceID = distance(devices.begin(), d);
-			WAVEFORMATEX waveFormat;
-			waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-			waveFormat.nSamplesPerSec = m_nSampleRate;
-			waveFormat.wBitsPerSample = sizeof(T) * 8;
-			waveFormat.nChannels = m_nChannels;
-			waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
-			waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
-			waveFormat.cbSize = 0;
-
-			// Open Device if valid
-			if (waveOutOpen(&m_hwDevice, nDeviceID, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
-				return Destroy();
-		}
+		if (d == devices.end())
+			return Destroy();
 
-		// Allocate Wave|Block Memory
-		m_pBlockMemory = new T[m_nBlockCount * m_nBlockSamples];
+#ifdef _WIN32
+		m_pWaveHeaders = nullptr;
+		m_hBlockFree = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+		// Device is available
+		int nDeviceID = distance(devices.begin(), d);
+		WAVEFORMATEX waveFormat;
+		waveFormat.wFormatTag = WAVE_FORMAT_PCM;
+		waveFormat.nSamplesPerSec = m_nSampleRate;
+		waveFormat.wBitsPerSample = sizeof(T) * 8;
+		waveFormat.nChannels = m_nChannels;
+		waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
+		waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+		waveFormat.cbSize = 0;
+
+		// Open Device if valid
+		if (waveOutOpen(&m_hwDevice, nDeviceID, &waveFormat, (DWORD_PTR)waveOutProcWrap, (DWORD_PTR)this, CALLBACK_FUNCTION) != S_OK)
+			return Destroy();
+#else
+		m_nDeviceBlock = 0;
+		sem_init(&m_semBlockFree, 0, 0);
+#endif
+
+		// Allocate Wave|Block Memory, room for the largest layout
+		m_pBlockMemory = new T[m_nBlockCount * m_nMaxBlockSamples];
 		if (m_pBlockMemory == nullptr)
 			return Destroy();
-		ZeroMemory(m_pBlockMemory, sizeof(T) * m_nBlockCount * m_nBlockSamples);
+		memset(m_pBlockMemory, 0, sizeof(T) * m_nBlockCount * m_nMaxBlockSamples);
+		m_pBlockSizes = new unsigned int[m_nBlockCount];
+		for (unsigned int n = 0; n < m_nBlockCount; n++)
+			m_pBlockSizes[n] = nBlockSamples;
 
+#ifdef _WIN32
 		m_pWaveHeaders = new WAVEHDR[m_nBlockCount];
 		if (m_pWaveHeaders == nullptr)
 			return Destroy();
@@ -86,17 +183,21 @@ public:
 		// Link headers to block memory
 		for (unsigned int n = 0; n < m_nBlockCount; n++)
 		{
-			m_pWaveHeaders[n].dwBufferLength = m_nBlockSamples * sizeof(T);
-			m_pWaveHeaders[n].lpData = (LPSTR)(m_pBlockMemory + (n * m_nBlockSamples));
+			m_pWaveHeaders[n].dwBufferLength = nBlockSamples * sizeof(T);
+			m_pWaveHeaders[n].lpData = (LPSTR)(m_pBlockMemory + (n * m_nMaxBlockSamples));
 		}
+#endif
+
+		m_pMixBuffer = new FTYPE[m_nMaxBlockSamples];
+		if (m_pMixBuffer == nullptr)
+			return Destroy();
 
 		m_bReady = true;
 
 		m_thread = thread(&olcNoiseMaker::MainThread, this);
-
-		// Start the ball rolling
-		unique_lock<mutex> lm(m_muxBlockNotZero);
-		m_cvBlockNotZero.notify_one();
+#ifndef _WIN32
+		m_threadDevice = thread(&olcNoiseMaker::NullDeviceThread, this);
+#endif
 
 		return true;
 	}
@@ -106,9 +207,19 @@ public:
 		return false;
 	}
 
+	// Safe to call again, or after Create() gave up before starting anything
 	void Stop()
 	{
+		if (!m_thread.joinable())
+			return;
 		m_bReady = false;
+#ifdef _WIN32
+		SetEvent(m_hBlockFree);
+#else
+		sem_post(&m_semBlockFree);
+		if (m_threadDevice.joinable())
+			m_threadDevice.join();
+#endif
 		m_thread.join();
 	}
 
@@ -123,17 +234,65 @@ public:
 		return m_dGlobalTime;
 	}
 
+	// Ask for real-time treatment of the audio thread: top scheduling priority,
+	// block memory locked into RAM and denormals flushed to zero. The audio
+	// thread applies this itself before its next block.
+	void EnableRealtime()
+	{
+		m_bRealtimeWanted = true;
+	}
+
+	// REALTIME_* flags for the parts that were actually granted
+	int GetRealtime()
+	{
+		return m_nRealtime;
+	}
+
+	// Block layout from the next block on, within what Create() allowed for.
+	// Fewer blocks take effect as the queue drains, so nothing is cut short.
+	void SetLayout(unsigned int nBlocks, unsigned int nBlockSamples)
+	{
+		m_nBlocks = min(max(nBlocks, 2u), m_nBlockCount);
+		m_nBlockSamples = min(max(nBlockSamples / m_nChannels * m_nChannels, m_nChannels), m_nMaxBlockSamples);
+	}
+
+	unsigned int GetBlocks()
+	{
+		return m_nBlocks;
+	}
+
+	unsigned int GetBlockSamples()
+	{
+		return m_nBlockSamples;
+	}
+
+	// Seconds from a block being filled to it being heard, with a full queue
+	FTYPE GetLatency()
+	{
+		return (FTYPE)(m_nBlocks * (m_nBlockSamples / m_nChannels)) / (FTYPE)m_nSampleRate;
+	}
+
+	// Times the device ran out of blocks
+	unsigned int GetUnderruns()
+	{
+		return m_nUnderruns;
+	}
+
 
 
 public:
 	static vector<wstring> Enumerate()
 	{
-		int nDeviceCount = waveOutGetNumDevs();
 		vector<wstring> sDevices;
+#ifdef _WIN32
+		int nDeviceCount = waveOutGetNumDevs();
 		WAVEOUTCAPS woc;
 		for (int n = 0; n < nDeviceCount; n++)
 			if (waveOutGetDevCaps(n, &woc, sizeof(WAVEOUTCAPS)) == S_OK)
 				sDevices.push_back(woc.szPname);
+#else
+		sDevices.push_back(L"Null Device");
+#endif
 		return sDevices;
 	}
 
@@ -142,6 +301,21 @@ public:
 		m_userFunction = func;
 	}
 
+	void SetUserSource(olcNoiseSource* source)
+	{
+		m_userSource = source;
+	}
+
+	void SetUserTap(olcNoiseTap* tap)
+	{
+		m_userTap = tap;
+	}
+
+	void SetLatencyController(olcNoiseLatency* latency)
+	{
+		m_userLatency = latency;
+	}
+
 	FTYPE clip(FTYPE dSample, FTYPE dMax)
 	{
 		if (dSample >= 0.0)
@@ -153,33 +327,75 @@ public:
 
 private:
 	FTYPE(*m_userFunction)(int, FTYPE);
+	olcNoiseSource* m_userSource;
+	olcNoiseTap* m_userTap;
+	olcNoiseLatency* m_userLatency;
 
 	unsigned int m_nSampleRate;
 	unsigned int m_nChannels;
-	unsigned int m_nBlockCount;
-	unsigned int m_nBlockSamples;
+	unsigned int m_nBlockCount;		// Blocks allocated
+	unsigned int m_nMaxBlockSamples;	// Room in each
+	atomic<unsigned int> m_nBlocks;			// Blocks queued at most, at present
+	atomic<unsigned int> m_nBlockSamples;	// Samples in the next block
 	unsigned int m_nBlockCurrent;
 
 	T* m_pBlockMemory;
+	unsigned int* m_pBlockSizes;	// Samples filled in each block
+	FTYPE* m_pMixBuffer;
+
+#ifdef _WIN32
 	WAVEHDR* m_pWaveHeaders;
 	HWAVEOUT m_hwDevice;
+	HANDLE m_hBlockFree;
+#else
+	thread m_threadDevice;
+	unsigned int m_nDeviceBlock;	// Device thread only
+	sem_t m_semBlockFree;
+#endif
 
 	thread m_thread;
 	atomic<bool> m_bReady;
 	atomic<unsigned int> m_nBlockFree;
-	condition_variable m_cvBlockNotZero;
-	mutex m_muxBlockNotZero;
+	atomic<unsigned int> m_nBlockQueued;	// With the device, not yet played
+	atomic<unsigned int> m_nUnderruns;
+
+	atomic<bool> m_bRealtimeWanted;
+	atomic<int> m_nRealtime;
 
 	atomic<FTYPE> m_dGlobalTime;
 
+	// A block has finished playing. Called from the driver's context, so it only
+	// touches an atomic and a wait object, never a mutex.
+	void BlockDone()
+	{
+		if (--m_nBlockQueued == 0 && m_bReady)
+			m_nUnderruns++; // Played everything it had, the device runs dry
+		m_nBlockFree++;
+#ifdef _WIN32
+		SetEvent(m_hBlockFree);
+#else
+		sem_post(&m_semBlockFree);
+#endif
+	}
+
+	void WaitForFreeBlock()
+	{
+		while (m_nBlockCount - m_nBlockFree >= m_nBlocks && m_bReady) // sometimes, Windows signals incorrectly
+		{
+#ifdef _WIN32
+			WaitForSingleObject(m_hBlockFree, INFINITE);
+#else
+			sem_wait(&m_semBlockFree);
+#endif
+		}
+	}
+
+#ifdef _WIN32
 	// Handler for soundcard request for more data
 	void waveOutProc(HWAVEOUT hWaveOut, UINT uMsg, DWORD dwParam1, DWORD dwParam2)
 	{
 		if (uMsg != WOM_DONE) return;
-
-		m_nBlockFree++;
-		unique_lock<mutex> lm(m_muxBlockNotZero);
-		m_cvBlockNotZero.notify_one();
+		BlockDone();
 	}
 
 	// Static wrapper for sound card handler
@@ -187,6 +403,68 @@ private:
 	{
 		((olcNoiseMaker*)dwInstance)->waveOutProc(hWaveOut, uMsg, dwParam1, dwParam2);
 	}
+#else
+	// Stands in for the sound card: "plays" each queued block for exactly its
+	// duration, then hands it back
+	void NullDeviceThread()
+	{
+		auto tNext = chrono::steady_clock::now();
+
+		while (m_bReady)
+		{
+			if (m_nBlockQueued == 0)
+			{
+				// Starved, so the device idles until something arrives
+				this_thread::sleep_for(chrono::microseconds(200));
+				tNext = chrono::steady_clock::now();
+				continue;
+			}
+
+			tNext += chrono::duration_cast<chrono::steady_clock::duration>(
+				chrono::duration<double>((double)(m_pBlockSizes[m_nDeviceBlock] / m_nChannels) / (double)m_nSampleRate));
+			this_thread::sleep_until(tNext);
+			m_nDeviceBlock = (m_nDeviceBlock + 1) % m_nBlockCount;
+			BlockDone();
+		}
+	}
+#endif
+
+	// Applies whatever EnableRealtime() asked for, from the audio thread itself
+	void ApplyRealtime()
+	{
+		int nGranted = 0;
+
+#ifdef _WIN32
+		if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+			nGranted |= REALTIME_PRIORITY;
+		if (VirtualLock(m_pBlockMemory, sizeof(T) * m_nBlockCount * m_nMaxBlockSamples) &&
+			VirtualLock(m_pMixBuffer, sizeof(FTYPE) * m_nMaxBlockSamples))
+			nGranted |= REALTIME_MEMLOCK;
+#else
+		sched_param param;
+		int nMin = sched_get_priority_min(SCHED_FIFO);
+		int nMax = sched_get_priority_max(SCHED_FIFO);
+		param.sched_priority = nMin + (nMax - nMin) * 7 / 10;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+			nGranted |= REALTIME_PRIORITY;
+		if (mlock(m_pBlockMemory, sizeof(T) * m_nBlockCount * m_nMaxBlockSamples) == 0 &&
+			mlock(m_pMixBuffer, sizeof(FTYPE) * m_nMaxBlockSamples) == 0)
+			nGranted |= REALTIME_MEMLOCK;
+#endif
+
+		// Envelope tails decay into denormals, which are very slow on most CPUs
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+		_mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+		nGranted |= REALTIME_FTZ;
+#elif defined(__aarch64__)
+		uint64_t fpcr;
+		__asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+		__asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+		nGranted |= REALTIME_FTZ;
+#endif
+
+		m_nRealtime = nGranted;
+	}
 
 	// Main thread. This loop responds to requests from the soundcard to fill 'blocks'
 	// with audio data. If no requests are available it goes dormant until the sound
@@ -200,50 +478,103 @@ private:
 		// Goofy hack to get maximum integer for a type at run-time
 		T nMaxSample = (T)pow(2, (sizeof(T) * 8) - 1) - 1;
 		FTYPE dMaxSample = (FTYPE)nMaxSample;
-		T nPreviousSample = 0;
+		bool bRealtimeApplied = false;
 
 		while (m_bReady)
 		{
 			// Wait for block to become available
-			if (m_nBlockFree == 0)
+			WaitForFreeBlock();
+			if (!m_bReady)
+				break;
+
+			// Checked as late as possible, so a source set up after asking
+			// for it never renders a block without
+			if (m_bRealtimeWanted && !bRealtimeApplied)
 			{
-				unique_lock<mutex> lm(m_muxBlockNotZero);
-				while (m_nBlockFree == 0) // sometimes, Windows signals incorrectly
-					m_cvBlockNotZero.wait(lm);
+				ApplyRealtime();
+				bRealtimeApplied = true;
 			}
 
-			// Block is here, so use it
+			// Block is here, so use it. Its size is fixed now, a new layout
+			// starts with the next one.
+			unsigned int nQueued = m_nBlockQueued;
+			unsigned int nBlockSamples = m_nBlockSamples;
+			m_pBlockSizes[m_nBlockCurrent] = nBlockSamples;
 			m_nBlockFree--;
+			auto tStart = chrono::steady_clock::now();
 
+#ifdef _WIN32
 			// Prepare block for processing
 			if (m_pWaveHeaders[m_nBlockCurrent].dwFlags & WHDR_PREPARED)
 				waveOutUnprepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+#endif
 
-			T nNewSample = 0;
-			int nCurrentBlock = m_nBlockCurrent * m_nBlockSamples;
+			int nCurrentBlock = m_nBlockCurrent * m_nMaxBlockSamples;
 
-			for (unsigned int n = 0; n < m_nBlockSamples; n += m_nChannels)
+			bool bDirect = false;
+			if (m_userSource != nullptr)
 			{
-				// User Process
-				for (unsigned int c = 0; c < m_nChannels; c++)
+				// Source renders the whole block in one go
+				if (sizeof(T) == sizeof(int16_t))
+					bDirect = m_userSource->ProcessBlock16((int16_t*)&m_pBlockMemory[nCurrentBlock], nBlockSamples / m_nChannels, m_nChannels);
+				if (!bDirect)
+					m_userSource->ProcessBlock(m_pMixBuffer, nBlockSamples / m_nChannels, m_nChannels);
+				m_dGlobalTime = m_dGlobalTime + dTimeStep * (nBlockSamples / m_nChannels);
+			}
+			else
+			{
+				for (unsigned int n = 0; n < nBlockSamples; n += m_nChannels)
 				{
-					if (m_userFunction == nullptr)
-						nNewSample = (T)(clip(UserProcess(c, m_dGlobalTime), 1.0) * dMaxSample);
-					else
-						nNewSample = (T)(clip(m_userFunction(c, m_dGlobalTime), 1.0) * dMaxSample);
-
-					m_pBlockMemory[nCurrentBlock + n + c] = nNewSample;
-					nPreviousSample = nNewSample;
+					// User Process
+					for (unsigned int c = 0; c < m_nChannels; c++)
+					{
+						if (m_userFunction == nullptr)
+							m_pMixBuffer[n + c] = UserProcess(c, m_dGlobalTime);
+						else
+							m_pMixBuffer[n + c] = m_userFunction(c, m_dGlobalTime);
+					}
+
+					m_dGlobalTime = m_dGlobalTime + dTimeStep;
 				}
+			}
 
-				m_dGlobalTime = m_dGlobalTime + dTimeStep;
+			// Limit and convert, keeping the limited signal for the tap. A block
+			// rendered to integers is already limited.
+			unsigned int nClipped = 0;
+			if (bDirect && m_userTap != nullptr)
+				for (unsigned int n = 0; n < nBlockSamples; n++)
+					m_pMixBuffer[n] = (FTYPE)m_pBlockMemory[nCurrentBlock + n] / dMaxSample;
+			for (unsigned int n = 0; n < nBlockSamples && !bDirect; n++)
+			{
+				FTYPE dSample = clip(m_pMixBuffer[n], 1.0);
+				nClipped += dSample != m_pMixBuffer[n];
+				m_pMixBuffer[n] = dSample;
+				m_pBlockMemory[nCurrentBlock + n] = (T)(dSample * dMaxSample);
+			}
+
+			if (m_userTap != nullptr)
+				m_userTap->Capture(m_pMixBuffer, nBlockSamples / m_nChannels, m_nChannels, nClipped);
+
+			if (m_userLatency != nullptr)
+			{
+				double dRender = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+				unsigned int nBlocks = m_nBlocks;
+				unsigned int nNextSamples = nBlockSamples;
+				m_userLatency->Update(dRender, (double)(nBlockSamples / m_nChannels) / (double)m_nSampleRate, nQueued, nBlocks, nNextSamples);
+				SetLayout(nBlocks, nNextSamples);
 			}
 
 			// Send block to sound device
+#ifdef _WIN32
+			m_nBlockQueued++;
+			m_pWaveHeaders[m_nBlockCurrent].dwBufferLength = nBlockSamples * sizeof(T);
 			waveOutPrepareHeader(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
 			waveOutWrite(m_hwDevice, &m_pWaveHeaders[m_nBlockCurrent], sizeof(WAVEHDR));
+#else
+			m_nBlockQueued++;
+#endif
 			m_nBlockCurrent++;
 			m_nBlockCurrent %= m_nBlockCount;
 		}
 	}
-};
\ No newline at end of file
+};
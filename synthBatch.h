@@ -0,0 +1,516 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#include "synthEngine.h"
+#include "synthWave.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Batch Rendering
+	//
+	// Renders a manifest of jobs offline, one independent engine per job, spread
+	// over all cores. Each manifest line is:
+	//
+	//     <source> <instrument map> <duration seconds> <output .wav>
+	//
+	// The source is a MIDI file (.mid/.midi) or a pattern file (anything else).
+	// The instrument map is a comma separated list of channel=instrument, where
+	// channel is the zero-based MIDI channel or pattern row, and instrument is one
+	// of the names known to engine::FindInstrument(). Relative paths are taken
+	// from the manifest's directory. Lines starting with '#' are ignored.
+	//
+	// A pattern file holds one sequencer row per line ("X...X...X..X.X..") plus
+	// optional "tempo <bpm>" and "subbeats <n>" lines, and loops for the duration.
+
+	namespace batch
+	{
+		struct event
+		{
+			FTYPE dTime;	// Seconds from start of render
+			int nType;
+			int nChannel;	// MIDI channel or pattern row
+			int nNoteID;
+		};
+
+		struct job
+		{
+			string sSource;
+			string sInstruments;
+			FTYPE dDuration = 0.0;
+			string sOutput;
+
+			// Results
+			bool bOk = false;
+			string sError;
+			double dRenderTime = 0.0;
+		};
+
+		inline string ResolvePath(const string& sBase, const string& sPath)
+		{
+			if (sPath.empty() || sPath[0] == '/' || sPath[0] == '\\' || (sPath.size() > 1 && sPath[1] == ':'))
+				return sPath;
+			return sBase + sPath;
+		}
+
+		inline bool EndsWith(const string& s, const string& sEnd)
+		{
+			return s.size() >= sEnd.size() && s.compare(s.size() - sEnd.size(), sEnd.size(), sEnd) == 0;
+		}
+
+		// Pattern file -> looping drum triggers, same timing as synth::sequencer
+		inline bool LoadPattern(const string& sFile, FTYPE dDuration, vector<event>& vecEvents, string& sError)
+		{
+			ifstream f(sFile);
+			if (!f.is_open())
+			{
+				sError = "cannot open pattern " + sFile;
+				return false;
+			}
+
+			FTYPE fTempo = 120.0;
+			int nSubBeats = 4;
+			vector<string> vecRows;
+			string sLine;
+			while (getline(f, sLine))
+			{
+				stringstream ss(sLine);
+				string sWord;
+				if (!(ss >> sWord) || sWord[0] == '#')
+					continue;
+
+				if (sWord == "tempo")
+					ss >> fTempo;
+				else if (sWord == "subbeats")
+					ss >> nSubBeats;
+				else
+					vecRows.push_back(sWord);
+			}
+
+			if (vecRows.empty() || fTempo <= 0.0 || nSubBeats <= 0)
+			{
+				sError = "bad pattern " + sFile;
+				return false;
+			}
+
+			FTYPE fBeatTime = (60.0 / fTempo) / (FTYPE)nSubBeats;
+			for (int nStep = 0; nStep * fBeatTime < dDuration; nStep++)
+			{
+				for (size_t r = 0; r < vecRows.size(); r++)
+				{
+					const string& sRow = vecRows[r];
+					if (sRow[nStep % sRow.size()] == 'X')
+						vecEvents.push_back({ nStep * fBeatTime, EVENT_TRIGGER, (int)r, 64 });
+				}
+			}
+			return true;
+		}
+
+		inline uint32_t ReadVarLen(const vector<uint8_t>& data, size_t& p, size_t nEnd)
+		{
+			uint32_t n = 0;
+			while (p < nEnd)
+			{
+				uint8_t b = data[p++];
+				n = (n << 7) | (b & 0x7F);
+				if (!(b & 0x80))
+					break;
+			}
+			return n;
+		}
+
+		inline uint32_t ReadBE(const vector<uint8_t>& data, size_t p, int nBytes)
+		{
+			uint32_t n = 0;
+			for (int i = 0; i < nBytes; i++)
+				n = (n << 8) | data[p + i];
+			return n;
+		}
+
+		// Standard MIDI file (format 0 or 1) -> note on/off events in seconds
+		inline bool LoadMidi(const string& sFile, vector<event>& vecEvents, string& sError)
+		{
+			ifstream f(sFile, ios::binary);
+			if (!f.is_open())
+			{
+				sError = "cannot open midi " + sFile;
+				return false;
+			}
+			vector<uint8_t> data((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+
+			if (data.size() < 14 || string(data.begin(), data.begin() + 4) != "MThd")
+			{
+				sError = "not a midi file " + sFile;
+				return false;
+			}
+
+			uint32_t nHeaderLen = ReadBE(data, 4, 4);
+			int nTracks = ReadBE(data, 10, 2);
+			int nDivision = ReadBE(data, 12, 2);
+			if (nDivision & 0x8000)
+			{
+				sError = "SMPTE time division not supported " + sFile;
+				return false;
+			}
+
+			struct tick_event { uint32_t nTick; int nType; int nChannel; int nNoteID; };
+			vector<tick_event> vecTicks;
+			map<uint32_t, uint32_t> mapTempo; // tick -> microseconds per quarter note
+			mapTempo[0] = 500000;
+
+			size_t p = 8 + nHeaderLen;
+			for (int t = 0; t < nTracks && p + 8 <= data.size(); t++)
+			{
+				if (string(data.begin() + p, data.begin() + p + 4) != "MTrk")
+				{
+					sError = "bad track chunk " + sFile;
+					return false;
+				}
+				size_t nEnd = min(data.size(), p + 8 + ReadBE(data, p + 4, 4));
+				p += 8;
+
+				uint32_t nTick = 0;
+				uint8_t nStatus = 0;
+				while (p < nEnd)
+				{
+					nTick += ReadVarLen(data, p, nEnd);
+					if (p >= nEnd) break;
+
+					if (data[p] & 0x80)
+						nStatus = data[p++];
+
+					if (nStatus == 0xFF)
+					{
+						if (p >= nEnd) break;
+						uint8_t nMeta = data[p++];
+						uint32_t nLen = ReadVarLen(data, p, nEnd);
+						if (nMeta == 0x51 && nLen == 3 && p + 3 <= nEnd)
+							mapTempo[nTick] = ReadBE(data, p, 3);
+						p += nLen;
+						nStatus = 0;
+					}
+					else if (nStatus == 0xF0 || nStatus == 0xF7)
+					{
+						p += ReadVarLen(data, p, nEnd);
+						nStatus = 0;
+					}
+					else
+					{
+						int nKind = nStatus & 0xF0;
+						int nChannel = nStatus & 0x0F;
+						int nDataBytes = (nKind == 0xC0 || nKind == 0xD0) ? 1 : 2;
+						if (nStatus < 0x80 || p + nDataBytes > nEnd)
+						{
+							sError = "corrupt track data " + sFile;
+							return false;
+						}
+
+						if (nKind == 0x90 && data[p + 1] > 0)
+							vecTicks.push_back({ nTick, EVENT_NOTE_ON, nChannel, data[p] });
+						else if (nKind == 0x80 || nKind == 0x90)
+							vecTicks.push_back({ nTick, EVENT_NOTE_OFF, nChannel, data[p] });
+						p += nDataBytes;
+					}
+				}
+				p = nEnd;
+			}
+
+			// Walk the tempo map to convert ticks to seconds
+			for (auto& te : vecTicks)
+			{
+				FTYPE dSeconds = 0.0;
+				uint32_t nLastTick = 0;
+				uint32_t nTempo = 500000;
+				for (auto& tempo : mapTempo)
+				{
+					if (tempo.first >= te.nTick)
+						break;
+					dSeconds += (FTYPE)(tempo.first - nLastTick) * nTempo / (1000000.0 * nDivision);
+					nLastTick = tempo.first;
+					nTempo = tempo.second;
+				}
+				dSeconds += (FTYPE)(te.nTick - nLastTick) * nTempo / (1000000.0 * nDivision);
+				vecEvents.push_back({ dSeconds, te.nType, te.nChannel, te.nNoteID });
+			}
+			return true;
+		}
+
+		// "0=kick,1=snare" -> channel to instrument of the given engine
+		inline bool ParseInstrumentMap(engine& e, const string& sMap, map<int, instrument_base*>& mapInstruments, string& sError)
+		{
+			stringstream ss(sMap);
+			string sEntry;
+			while (getline(ss, sEntry, ','))
+			{
+				size_t nEq = sEntry.find('=');
+				instrument_base* pInstrument = nEq == string::npos ? nullptr : e.FindInstrument(sEntry.substr(nEq + 1));
+				if (pInstrument == nullptr)
+				{
+					sError = "bad instrument map entry '" + sEntry + "'";
+					return false;
+				}
+				mapInstruments[atoi(sEntry.substr(0, nEq).c_str())] = pInstrument;
+			}
+			return true;
+		}
+
+		// Renders one job on the calling thread with its own engine
+		inline void RenderJob(job& j, unsigned int nSampleRate = 44100)
+		{
+			auto tStart = chrono::high_resolution_clock::now();
+
+			engine e(nSampleRate);
+			map<int, instrument_base*> mapInstruments;
+			vector<event> vecEvents;
+
+			bool bLoaded = ParseInstrumentMap(e, j.sInstruments, mapInstruments, j.sError);
+			if (bLoaded)
+			{
+				if (EndsWith(j.sSource, ".mid") || EndsWith(j.sSource, ".midi"))
+					bLoaded = LoadMidi(j.sSource, vecEvents, j.sError);
+				else
+					bLoaded = LoadPattern(j.sSource, j.dDuration, vecEvents, j.sError);
+			}
+			if (!bLoaded)
+				return;
+
+			stable_sort(vecEvents.begin(), vecEvents.end(), [](const event& a, const event& b) { return a.dTime < b.dTime; });
+
+			size_t nSamples = (size_t)(j.dDuration * nSampleRate);
+			vector<short> vecOutput(nSamples);
+			vector<FTYPE> vecBlock(256);
+			size_t nEvent = 0;
+			size_t n = 0;
+
+			while (n < nSamples)
+			{
+				// Apply every event due at this sample
+				size_t nNextEvent = nSamples;
+				while (nEvent < vecEvents.size())
+				{
+					const event& ev = vecEvents[nEvent];
+					nNextEvent = (size_t)(ev.dTime * nSampleRate);
+					if (nNextEvent > n)
+						break;
+
+					nEvent++;
+					auto i = mapInstruments.find(ev.nChannel);
+					if (i == mapInstruments.end())
+						continue;
+
+					bool bSent;
+					if (ev.nType == EVENT_NOTE_ON)
+						bSent = e.NoteOn(ev.nNoteID, i->second);
+					else if (ev.nType == EVENT_NOTE_OFF)
+						bSent = e.NoteOff(ev.nNoteID, i->second);
+					else
+						bSent = e.Trigger(ev.nNoteID, i->second);
+					if (!bSent)
+					{
+						// The engine's queue is full, the note would be lost
+						j.sError = "too many events on one sample";
+						return;
+					}
+				}
+				if (nEvent == vecEvents.size())
+					nNextEvent = nSamples;
+
+				// Render up to the next event, so every event lands on its own sample
+				unsigned int nFrames = (unsigned int)min(vecBlock.size(), min(nNextEvent, nSamples) - n);
+				e.ProcessBlock(vecBlock.data(), nFrames, 1);
+				for (unsigned int f = 0; f < nFrames; f++)
+				{
+					FTYPE dSample = vecBlock[f] >= 0.0 ? fmin(vecBlock[f], 1.0) : fmax(vecBlock[f], -1.0);
+					vecOutput[n + f] = (short)(dSample * 32767.0);
+				}
+				n += nFrames;
+			}
+
+			if (!wave::Write(j.sOutput, vecOutput, nSampleRate, 1))
+			{
+				j.sError = "cannot write " + j.sOutput;
+				return;
+			}
+
+			j.dRenderTime = chrono::duration<double>(chrono::high_resolution_clock::now() - tStart).count();
+			j.bOk = true;
+		}
+
+		// Renders a performance log again through e, which must be set up the way
+		// the recorded engine was: same sequencer, sends, effects and samples. The
+		// output is what the sound device was given, sample for sample.
+		inline bool ReplayLog(engine& e, const string& sLog, vector<short>& vecOutput, unsigned int& nSampleRate, unsigned int& nChannels, string& sError)
+		{
+			vector<log_record> vecRecords;
+			uint32_t nFlags = 0;
+			if (!performance_log::Read(sLog, vecRecords, nSampleRate, nChannels, nFlags, sError))
+				return false;
+			if (vecRecords.empty() || vecRecords[0].nType != LOG_BLOCK || vecRecords[0].nSample != 0)
+			{
+				sError = sLog + " does not start with the engine's first block";
+				return false;
+			}
+			if (nChannels == 0)
+			{
+				sError = sLog + " has no channels";
+				return false;
+			}
+
+			// A log cut short ends at its last record
+			uint64_t nEnd = vecRecords.back().nSample;
+
+			// Denormals are flushed, or not, as they were on the audio thread
+			bool bFlushed = rt::FlushesDenormals();
+			rt::FlushDenormals((nFlags & LOG_FLAG_FTZ) != 0);
+
+			vecOutput.clear();
+			vector<FTYPE> vecBlock;
+			unsigned int nFrames = 0;
+			size_t r = 0;
+			bool bOk = true;
+			for (uint64_t nClock = 0; nClock < nEnd; nClock += nFrames)
+			{
+				// Block size changes, then the events landing in this block
+				for (; r < vecRecords.size() && vecRecords[r].nSample <= nClock && vecRecords[r].nType == LOG_BLOCK; r++)
+					nFrames = vecRecords[r].nFrames;
+				if (nFrames == 0)
+				{
+					sError = sLog + " has an empty block";
+					bOk = false;
+					break;
+				}
+				for (; r < vecRecords.size() && vecRecords[r].nSample < nClock + nFrames && vecRecords[r].nType <= LOG_TRIGGER; r++)
+				{
+					const log_record& rec = vecRecords[r];
+					if (!e.PostEvent(rec.nType, rec.nNoteID, e.Instrument(rec.nInstrument), rec.nSample))
+					{
+						sError = "too many events in one block";
+						bOk = false;
+						break;
+					}
+				}
+				if (!bOk)
+					break;
+
+				vecBlock.resize(nFrames * nChannels);
+				e.ProcessBlock(vecBlock.data(), nFrames, nChannels);
+				for (FTYPE d : vecBlock)
+				{
+					FTYPE dSample = d >= 0.0 ? fmin(d, 1.0) : fmax(d, -1.0);
+					vecOutput.push_back((short)(dSample * 32767.0));
+				}
+			}
+
+			rt::FlushDenormals(bFlushed);
+			return bOk;
+		}
+
+		inline bool LoadManifest(const string& sManifest, vector<job>& vecJobs)
+		{
+			ifstream f(sManifest);
+			if (!f.is_open())
+				return false;
+
+			size_t nSlash = sManifest.find_last_of("/\\");
+			string sBase = nSlash == string::npos ? "" : sManifest.substr(0, nSlash + 1);
+
+			string sLine;
+			while (getline(f, sLine))
+			{
+				stringstream ss(sLine);
+				job j;
+				if (!(ss >> j.sSource) || j.sSource[0] == '#')
+					continue;
+				if (!(ss >> j.sInstruments >> j.dDuration >> j.sOutput))
+				{
+					cerr << "Skipping malformed manifest line: " << sLine << endl;
+					continue;
+				}
+				j.sSource = ResolvePath(sBase, j.sSource);
+				j.sOutput = ResolvePath(sBase, j.sOutput);
+				vecJobs.push_back(j);
+			}
+			return true;
+		}
+
+		// Renders every job in the manifest using nThreads workers (0 = all cores).
+		// Real-time factor is render time / audio time, so lower is faster.
+		inline int Run(const string& sManifest, unsigned int nThreads = 0)
+		{
+			vector<job> vecJobs;
+			if (!LoadManifest(sManifest, vecJobs))
+			{
+				cerr << "Cannot open manifest " << sManifest << endl;
+				return 1;
+			}
+
+			if (nThreads == 0)
+				nThreads = max(1u, thread::hardware_concurrency());
+			nThreads = min(nThreads, max(1u, (unsigned int)vecJobs.size()));
+
+			auto tStart = chrono::high_resolution_clock::now();
+
+			// Job queue: each worker takes the next unclaimed job until none remain
+			atomic<size_t> nNextJob(0);
+			rt::checked_mutex muxReport;
+			vector<thread> vecWorkers;
+			for (unsigned int t = 0; t < nThreads; t++)
+			{
+				vecWorkers.emplace_back([&]()
+				{
+					size_t i;
+					while ((i = nNextJob++) < vecJobs.size())
+					{
+						job& j = vecJobs[i];
+						RenderJob(j);
+
+						unique_lock<rt::checked_mutex> lm(muxReport);
+						if (j.bOk)
+							cout << "[" << i + 1 << "/" << vecJobs.size() << "] " << j.sOutput << " " << fixed << setprecision(3)
+								<< j.dRenderTime << "s RTF " << setprecision(4) << j.dRenderTime / j.dDuration << endl;
+						else
+							cout << "[" << i + 1 << "/" << vecJobs.size() << "] FAILED " << j.sSource << ": " << j.sError << endl;
+					}
+				});
+			}
+			for (auto& w : vecWorkers)
+				w.join();
+
+			double dWallTime = chrono::duration<double>(chrono::high_resolution_clock::now() - tStart).count();
+
+			int nFailed = 0;
+			double dAudioTime = 0.0;
+			double dCpuTime = 0.0;
+			for (auto& j : vecJobs)
+			{
+				if (!j.bOk) { nFailed++; continue; }
+				dAudioTime += j.dDuration;
+				dCpuTime += j.dRenderTime;
+			}
+
+			cout << fixed << setprecision(3)
+				<< "Jobs: " << vecJobs.size() - nFailed << " ok, " << nFailed << " failed, " << nThreads << " threads" << endl
+				<< "Audio: " << dAudioTime << "s Wall: " << dWallTime << "s CPU: " << dCpuTime << "s" << endl
+				<< setprecision(4)
+				<< "RTF per core: " << (dAudioTime > 0.0 ? dCpuTime / dAudioTime : 0.0)
+				<< " aggregate: " << (dAudioTime > 0.0 ? dWallTime / dAudioTime : 0.0) << endl;
+
+			return nFailed == 0 ? 0 : 1;
+		}
+	}
+}
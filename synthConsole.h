@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+using namespace std;
+
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Console
+	//
+	// A fixed size character screen redrawn by its own thread at a fixed rate.
+	// Each frame is compared against the one before and only the cells that
+	// changed are written out, through the console API on Windows and ANSI
+	// escape sequences everywhere else.
+
+	class console
+	{
+	public:
+		console(int nWidth = 80, int nHeight = 30)
+		{
+			m_nWidth = nWidth;
+			m_nHeight = nHeight;
+			m_screen.assign(nWidth * nHeight, L' ');
+			m_previous.assign(nWidth * nHeight, 0); // Nothing matches, so the first frame draws everything
+			m_bRunning = false;
+
+#ifdef _WIN32
+			m_hConsole = CreateConsoleScreenBuffer(GENERIC_READ | GENERIC_WRITE, 0, NULL, CONSOLE_TEXTMODE_BUFFER, NULL);
+			SetConsoleActiveScreenBuffer(m_hConsole);
+#else
+			fputs("\x1b[2J\x1b[?25l", stdout); // Clear, hide cursor
+			fflush(stdout);
+#endif
+		}
+
+		~console()
+		{
+			Stop();
+#ifndef _WIN32
+			printf("\x1b[%d;1H\x1b[?25h", m_nHeight + 1); // Park below the screen, show cursor
+			fflush(stdout);
+#endif
+		}
+
+		// Calls onDraw at nHertz from a new thread, then writes out what changed
+		void Start(function<void(console&)> onDraw, int nHertz = 30)
+		{
+			m_onDraw = onDraw;
+			m_bRunning = true;
+			m_thread = thread([this, nHertz]()
+			{
+				auto tFrame = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1.0 / nHertz));
+				auto tNext = chrono::steady_clock::now();
+				while (m_bRunning)
+				{
+					Clear();
+					m_onDraw(*this);
+					Present();
+
+					tNext += tFrame;
+					this_thread::sleep_until(tNext);
+				}
+			});
+		}
+
+		void Stop()
+		{
+			m_bRunning = false;
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+
+		void Clear()
+		{
+			fill(m_screen.begin(), m_screen.end(), L' ');
+		}
+
+		// Draw into the character array conveniently
+		void Draw(int x, int y, const wstring& s)
+		{
+			if (y < 0 || y >= m_nHeight)
+				return;
+			for (size_t i = 0; i < s.size() && x + (int)i < m_nWidth; i++)
+				m_screen[y * m_nWidth + x + i] = s[i];
+		}
+
+		// Writes every run of changed cells, then remembers this frame
+		void Present()
+		{
+#ifndef _WIN32
+			string sOut;
+#endif
+			for (int y = 0; y < m_nHeight; y++)
+			{
+				int x = 0;
+				while (x < m_nWidth)
+				{
+					if (m_screen[y * m_nWidth + x] == m_previous[y * m_nWidth + x])
+					{
+						x++;
+						continue;
+					}
+
+					int nStart = x;
+					while (x < m_nWidth && m_screen[y * m_nWidth + x] != m_previous[y * m_nWidth + x])
+						x++;
+
+					const wchar_t* pRun = &m_screen[y * m_nWidth + nStart];
+#ifdef _WIN32
+					DWORD dwBytesWritten = 0;
+					WriteConsoleOutputCharacter(m_hConsole, pRun, x - nStart, { (SHORT)nStart, (SHORT)y }, &dwBytesWritten);
+#else
+					sOut += "\x1b[" + to_string(y + 1) + ";" + to_string(nStart + 1) + "H";
+					for (int i = 0; i < x - nStart; i++)
+						sOut += (pRun[i] < 128) ? (char)pRun[i] : '?';
+#endif
+				}
+			}
+#ifndef _WIN32
+			if (!sOut.empty())
+			{
+				fwrite(sOut.data(), 1, sOut.size(), stdout);
+				fflush(stdout);
+			}
+#endif
+			m_previous = m_screen;
+		}
+
+	private:
+		int m_nWidth;
+		int m_nHeight;
+		vector<wchar_t> m_screen;
+		vector<wchar_t> m_previous;
+
+		function<void(console&)> m_onDraw;
+		thread m_thread;
+		atomic<bool> m_bRunning;
+
+#ifdef _WIN32
+		HANDLE m_hConsole;
+#endif
+	};
+}
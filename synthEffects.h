@@ -0,0 +1,339 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SYNTH_SSE2
+#endif
+
+#include "olcNoiseMaker.h"
+#include "synthReverb.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Effects
+	//
+	// Everything here works a block at a time on preallocated memory, so the cost
+	// of the effects depends only on block size, never on how many notes play.
+
+	// Send buses, see instrument_base::dSend
+	const int SEND_DELAY = 0;
+	const int SEND_CHORUS = 1;
+	const int SEND_COUNT = 2;
+
+	// One biquad section, coefficients normalised so a0 = 1 (RBJ cookbook)
+	struct biquad
+	{
+		FTYPE b0 = 1.0, b1 = 0.0, b2 = 0.0, a1 = 0.0, a2 = 0.0;
+
+		static biquad LowPass(FTYPE dHertz, FTYPE dQ, FTYPE dSampleRate)
+		{
+			FTYPE w0 = 2.0 * PI * dHertz / dSampleRate, c = cos(w0), alpha = sin(w0) / (2.0 * dQ);
+			return Normalise((1.0 - c) / 2.0, 1.0 - c, (1.0 - c) / 2.0, 1.0 + alpha, -2.0 * c, 1.0 - alpha);
+		}
+
+		static biquad HighPass(FTYPE dHertz, FTYPE dQ, FTYPE dSampleRate)
+		{
+			FTYPE w0 = 2.0 * PI * dHertz / dSampleRate, c = cos(w0), alpha = sin(w0) / (2.0 * dQ);
+			return Normalise((1.0 + c) / 2.0, -(1.0 + c), (1.0 + c) / 2.0, 1.0 + alpha, -2.0 * c, 1.0 - alpha);
+		}
+
+		static biquad Peak(FTYPE dHertz, FTYPE dQ, FTYPE dGainDB, FTYPE dSampleRate)
+		{
+			FTYPE A = pow(10.0, dGainDB / 40.0), w0 = 2.0 * PI * dHertz / dSampleRate, c = cos(w0), alpha = sin(w0) / (2.0 * dQ);
+			return Normalise(1.0 + alpha * A, -2.0 * c, 1.0 - alpha * A, 1.0 + alpha / A, -2.0 * c, 1.0 - alpha / A);
+		}
+
+		static biquad LowShelf(FTYPE dHertz, FTYPE dGainDB, FTYPE dSampleRate)
+		{
+			FTYPE A = pow(10.0, dGainDB / 40.0), w0 = 2.0 * PI * dHertz / dSampleRate, c = cos(w0), alpha = sin(w0) / 2.0 * sqrt(2.0);
+			FTYPE k = 2.0 * sqrt(A) * alpha;
+			return Normalise(A * ((A + 1) - (A - 1) * c + k), 2 * A * ((A - 1) - (A + 1) * c), A * ((A + 1) - (A - 1) * c - k),
+				(A + 1) + (A - 1) * c + k, -2 * ((A - 1) + (A + 1) * c), (A + 1) + (A - 1) * c - k);
+		}
+
+		static biquad HighShelf(FTYPE dHertz, FTYPE dGainDB, FTYPE dSampleRate)
+		{
+			FTYPE A = pow(10.0, dGainDB / 40.0), w0 = 2.0 * PI * dHertz / dSampleRate, c = cos(w0), alpha = sin(w0) / 2.0 * sqrt(2.0);
+			FTYPE k = 2.0 * sqrt(A) * alpha;
+			return Normalise(A * ((A + 1) + (A - 1) * c + k), -2 * A * ((A - 1) + (A + 1) * c), A * ((A + 1) + (A - 1) * c - k),
+				(A + 1) - (A - 1) * c + k, 2 * ((A - 1) - (A + 1) * c), (A + 1) - (A - 1) * c - k);
+		}
+
+		static biquad Normalise(FTYPE nb0, FTYPE nb1, FTYPE nb2, FTYPE na0, FTYPE na1, FTYPE na2)
+		{
+			biquad q;
+			q.b0 = nb0 / na0; q.b1 = nb1 / na0; q.b2 = nb2 / na0;
+			q.a1 = na1 / na0; q.a2 = na2 / na0;
+			return q;
+		}
+	};
+
+	// Up to MAX_STAGES biquads in series, run in place on interleaved audio.
+	// Channels are processed in pairs, one per SIMD lane.
+	class biquad_cascade
+	{
+	public:
+		static const int MAX_STAGES = 8;
+		static const int MAX_CHANNELS = 8;
+
+		biquad_cascade()
+		{
+			m_nStages = 0;
+			Reset();
+		}
+
+		void Reset()
+		{
+			for (int s = 0; s < MAX_STAGES; s++)
+				for (int c = 0; c < MAX_CHANNELS; c++)
+					m_z1[s][c] = m_z2[s][c] = 0.0;
+		}
+
+		// Replaces stage nStage, extending the cascade if needed
+		void SetStage(int nStage, const biquad& q)
+		{
+			if (nStage < 0 || nStage >= MAX_STAGES)
+				return;
+			m_stages[nStage] = q;
+			m_nStages = max(m_nStages, nStage + 1);
+		}
+
+		void Process(FTYPE* pBuffer, unsigned int nFrames, unsigned int nChannels)
+		{
+			nChannels = min(nChannels, (unsigned int)MAX_CHANNELS);
+			for (int s = 0; s < m_nStages; s++)
+			{
+				const biquad& q = m_stages[s];
+				unsigned int c = 0;
+#ifdef SYNTH_SSE2
+				if (sizeof(FTYPE) == sizeof(double))
+				{
+					double* p = (double*)pBuffer;
+					__m128d b0 = _mm_set1_pd(q.b0), b1 = _mm_set1_pd(q.b1), b2 = _mm_set1_pd(q.b2);
+					__m128d a1 = _mm_set1_pd(q.a1), a2 = _mm_set1_pd(q.a2);
+					for (; c + 2 <= nChannels; c += 2)
+					{
+						__m128d z1 = _mm_loadu_pd((double*)&m_z1[s][c]);
+						__m128d z2 = _mm_loadu_pd((double*)&m_z2[s][c]);
+						for (unsigned int n = 0; n < nFrames; n++)
+						{
+							// Transposed direct form II
+							__m128d x = _mm_loadu_pd(p + n * nChannels + c);
+							__m128d y = _mm_add_pd(_mm_mul_pd(b0, x), z1);
+							z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, x), _mm_mul_pd(a1, y)), z2);
+							z2 = _mm_sub_pd(_mm_mul_pd(b2, x), _mm_mul_pd(a2, y));
+							_mm_storeu_pd(p + n * nChannels + c, y);
+						}
+						_mm_storeu_pd((double*)&m_z1[s][c], z1);
+						_mm_storeu_pd((double*)&m_z2[s][c], z2);
+					}
+				}
+#endif
+				for (; c < nChannels; c++)
+				{
+					FTYPE z1 = m_z1[s][c], z2 = m_z2[s][c];
+					for (unsigned int n = 0; n < nFrames; n++)
+					{
+						FTYPE x = pBuffer[n * nChannels + c];
+						FTYPE y = q.b0 * x + z1;
+						z1 = q.b1 * x - q.a1 * y + z2;
+						z2 = q.b2 * x - q.a2 * y;
+						pBuffer[n * nChannels + c] = y;
+					}
+					m_z1[s][c] = z1;
+					m_z2[s][c] = z2;
+				}
+			}
+		}
+
+	private:
+		biquad m_stages[MAX_STAGES];
+		int m_nStages;
+		FTYPE m_z1[MAX_STAGES][MAX_CHANNELS];
+		FTYPE m_z2[MAX_STAGES][MAX_CHANNELS];
+	};
+
+	// Mono feedback delay, its length a fraction of a beat at the current tempo
+	struct effect_delay
+	{
+		FTYPE fBeats = 0.75;		// Dotted eighth
+		FTYPE dFeedback = 0.4;
+		FTYPE dLevel = 0.5;
+
+		void Create(FTYPE dSampleRate, FTYPE dMaxSeconds = 4.0)
+		{
+			m_dSampleRate = dSampleRate;
+			m_vecRing.assign((size_t)(dSampleRate * dMaxSeconds) + 1, 0.0);
+			m_nWrite = 0;
+			SetTempo(120.0);
+		}
+
+		void SetTempo(FTYPE fTempo)
+		{
+			size_t nDelay = (size_t)(fBeats * 60.0 / fTempo * m_dSampleRate);
+			m_nDelay = min(max(nDelay, (size_t)1), m_vecRing.size() - 1);
+		}
+
+		// Until the repeats have fallen below -120dB
+		size_t TailFrames() const
+		{
+			if (dLevel == 0.0)
+				return 0;
+			if (dFeedback >= 1.0)
+				return SIZE_MAX; // Never dies away
+			size_t nRepeats = dFeedback > 0.0 ? (size_t)ceil(log(1e-6) / log(dFeedback)) + 1 : 1;
+			return nRepeats * m_nDelay;
+		}
+
+		// Adds the delayed signal into pOut (mono)
+		void Process(const FTYPE* pIn, FTYPE* pOut, unsigned int nFrames)
+		{
+			size_t nSize = m_vecRing.size();
+			for (unsigned int n = 0; n < nFrames; n++)
+			{
+				size_t nRead = m_nWrite >= m_nDelay ? m_nWrite - m_nDelay : m_nWrite + nSize - m_nDelay;
+				FTYPE dDelayed = m_vecRing[nRead];
+				m_vecRing[m_nWrite] = pIn[n] + dDelayed * dFeedback;
+				pOut[n] += dDelayed * dLevel;
+				if (++m_nWrite == nSize) m_nWrite = 0;
+			}
+		}
+
+	private:
+		vector<FTYPE> m_vecRing;
+		size_t m_nWrite = 0;
+		size_t m_nDelay = 1;
+		FTYPE m_dSampleRate = 44100.0;
+	};
+
+	// Modulated short delay, each output channel reads with its own LFO phase
+	struct effect_chorus
+	{
+		FTYPE dDelaySeconds = 0.015;
+		FTYPE dDepthSeconds = 0.004;
+		FTYPE dRateHertz = 0.8;
+		FTYPE dLevel = 0.5;
+
+		void Create(FTYPE dSampleRate)
+		{
+			m_dSampleRate = dSampleRate;
+			m_vecRing.assign((size_t)(dSampleRate * 0.05) + 4, 0.0);
+			m_nWrite = 0;
+			m_dPhase = 0.0;
+		}
+
+		size_t TailFrames() const
+		{
+			return m_vecRing.size();
+		}
+
+		// Adds the chorused signal into interleaved pOut
+		void Process(const FTYPE* pIn, FTYPE* pOut, unsigned int nFrames, unsigned int nChannels)
+		{
+			size_t nSize = m_vecRing.size();
+			FTYPE dPhaseStep = 2.0 * PI * dRateHertz / m_dSampleRate;
+			FTYPE dCentre = dDelaySeconds * m_dSampleRate;
+			FTYPE dDepth = dDepthSeconds * m_dSampleRate;
+
+			for (unsigned int n = 0; n < nFrames; n++)
+			{
+				m_vecRing[m_nWrite] = pIn[n];
+				for (unsigned int c = 0; c < nChannels; c++)
+				{
+					// Kept behind the write head and inside the ring, whatever the settings
+					FTYPE dDelay = min(max(dCentre + dDepth * sin(m_dPhase + c * PI / 2.0), (FTYPE)1.0), (FTYPE)(nSize - 2));
+					FTYPE dRead = (FTYPE)m_nWrite - dDelay;
+					if (dRead < 0.0) dRead += (FTYPE)nSize;
+					size_t i0 = (size_t)dRead;
+					size_t i1 = i0 + 1 == nSize ? 0 : i0 + 1;
+					FTYPE dFrac = dRead - (FTYPE)i0;
+					pOut[n * nChannels + c] += (m_vecRing[i0] + (m_vecRing[i1] - m_vecRing[i0]) * dFrac) * dLevel;
+				}
+				m_dPhase += dPhaseStep;
+				if (m_dPhase > 2.0 * PI) m_dPhase -= 2.0 * PI;
+				if (++m_nWrite == nSize) m_nWrite = 0;
+			}
+		}
+
+	private:
+		vector<FTYPE> m_vecRing;
+		size_t m_nWrite = 0;
+		FTYPE m_dPhase = 0.0;
+		FTYPE m_dSampleRate = 44100.0;
+	};
+
+	// The dry mix plus the send returns, then the room reverb and the master EQ,
+	// into the output
+	class effects_bus
+	{
+	public:
+		effect_delay delay;
+		effect_chorus chorus;
+		effect_reverb reverb;	// Whole mono mix, off until an impulse response is loaded
+		biquad_cascade eq;		// Master EQ, empty (flat) by default
+		FTYPE dMasterGain = 0.2;
+
+		void Create(FTYPE dSampleRate, unsigned int nMaxFrames)
+		{
+			delay.Create(dSampleRate);
+			chorus.Create(dSampleRate);
+			reverb.Create(dSampleRate, nMaxFrames);
+			m_vecReturn.assign(nMaxFrames, 0.0);
+			m_nFilterFrames = (size_t)(dSampleRate * 0.1);
+		}
+
+		// pDry and pSend[] are mono and nFrames long, pOut is interleaved. Pass
+		// bSilent when all the inputs are zero; once every tail has died away the
+		// whole block is then written as silence without running the effects.
+		void Process(const FTYPE* pDry, FTYPE* const* pSend, FTYPE* pOut, unsigned int nFrames, unsigned int nChannels, bool bSilent = false)
+		{
+			if (!bSilent)
+				m_nQuietFrames = 0;
+			else if (m_nQuietFrames >= TailFrames())
+			{
+				memset(pOut, 0, nFrames * nChannels * sizeof(FTYPE));
+				return;
+			}
+			else
+				m_nQuietFrames += nFrames;
+
+			// Mono returns: dry and delay, then the room around them
+			FTYPE* pMono = m_vecReturn.data();
+			copy(pDry, pDry + nFrames, pMono);
+			delay.Process(pSend[SEND_DELAY], pMono, nFrames);
+			reverb.Process(pMono, pMono, nFrames);
+
+			for (unsigned int n = 0; n < nFrames; n++)
+				for (unsigned int c = 0; c < nChannels; c++)
+					pOut[n * nChannels + c] = pMono[n];
+
+			// Per channel return: chorus
+			chorus.Process(pSend[SEND_CHORUS], pOut, nFrames, nChannels);
+
+			for (unsigned int n = 0; n < nFrames * nChannels; n++)
+				pOut[n] *= dMasterGain;
+
+			eq.Process(pOut, nFrames, nChannels);
+		}
+
+		// How long after the input stops the output can still be heard
+		size_t TailFrames()
+		{
+			size_t nTail = max(max(delay.TailFrames(), chorus.TailFrames()), reverb.TailFrames());
+			return nTail > SIZE_MAX - m_nFilterFrames ? SIZE_MAX : nTail + m_nFilterFrames;
+		}
+
+	private:
+		vector<FTYPE> m_vecReturn;
+		size_t m_nQuietFrames = 0;
+		size_t m_nFilterFrames = 0;		// Allowance for the EQ to ring out
+	};
+}
@@ -0,0 +1,2645 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+#include "synthRealtime.h"
+#include "synthEffects.h"
+#include "synthLanes.h"
+#include "synthFilter.h"
+#include "synthSampler.h"
+#include "synthLog.h"
+#include "synthPatch.h"
+#include "synthSong.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Utilities
+
+	// Converts frequency (Hz) to angular velocity
+	FTYPE w(const FTYPE dHertz)
+	{
+		return dHertz * 2.0 * PI;
+	}
+
+	struct instrument_base;
+
+	// A basic note
+	struct note
+	{
+		int id;		// Position in scale
+		FTYPE on;	// Time note was activated
+		FTYPE off;	// Time note was deactivated
+		bool active;
+		instrument_base* channel;
+		FTYPE velocity;	// Loudness it was struck with, 0 to 1
+
+		note()
+		{
+			id = 0;
+			on = 0.0;
+			off = 0.0;
+			active = false;
+			channel = nullptr;
+			velocity = 1.0;
+		}
+
+		//bool operator==(const note& n1, const note& n2) { return n1.id == n2.id; }
+	};
+
+	// Generator state of noise(), one per thread
+	inline uint32_t& NoiseState()
+	{
+		static thread_local uint32_t nState = 2463534242u;
+		return nState;
+	}
+
+	// Restarts this thread's noise() sequence, for renders that must repeat exactly
+	inline void SeedNoise(uint32_t nSeed = 2463534242u)
+	{
+		NoiseState() = nSeed != 0 ? nSeed : 2463534242u;
+	}
+
+	// White noise between -1 and +1. Unlike rand() it never takes a lock.
+	inline FTYPE noise()
+	{
+		uint32_t& nState = NoiseState();
+		nState ^= nState << 13;
+		nState ^= nState >> 17;
+		nState ^= nState << 5;
+		return 2.0 * ((FTYPE)nState / (FTYPE)UINT32_MAX) - 1.0;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Multi-Function Oscillator
+	const int OSC_SINE = 0;
+	const int OSC_SQUARE = 1;
+	const int OSC_TRIANGLE = 2;
+	const int OSC_SAW_ANA = 3;
+	const int OSC_SAW_DIG = 4;
+	const int OSC_NOISE = 5;
+
+	FTYPE osc(const FTYPE dTime, const FTYPE dHertz, const int nType = OSC_SINE,
+		const FTYPE dLFOHertz = 0.0, const FTYPE dLFOAmplitude = 0.0, FTYPE dCustom = 50.0)
+	{
+
+		FTYPE dFreq = w(dHertz) * dTime + dLFOAmplitude * dHertz * (sin(w(dLFOHertz) * dTime));
+
+		switch (nType)
+		{
+		case OSC_SINE: // Sine wave bewteen -1 and +1
+			return sin(dFreq);
+
+		case OSC_SQUARE: // Square wave between -1 and +1
+			return sin(dFreq) > 0 ? 1.0 : -1.0;
+
+		case OSC_TRIANGLE: // Triangle wave between -1 and +1
+			return asin(sin(dFreq)) * (2.0 / PI);
+
+		case OSC_SAW_ANA: // Saw wave (analogue / warm / slow)
+		{
+			FTYPE dOutput = 0.0;
+			for (FTYPE n = 1.0; n < dCustom; n++)
+				dOutput += (sin(n * dFreq)) / n;
+			return dOutput * (2.0 / PI);
+		}
+
+		case OSC_SAW_DIG:
+			return (2.0 / PI) * (dHertz * PI * fmod(dTime, 1.0 / dHertz) - (PI / 2.0));
+
+		case OSC_NOISE:
+			return noise();
+
+		default:
+			return 0.0;
+		}
+	}
+
+	// Sine from a table, for phase accumulators. A phase is a 32 bit fraction
+	// of a cycle, so it wraps by itself and stepping it never drifts.
+	class sine_table
+	{
+	public:
+		static const int BITS = 12;
+
+		// Built on first use, which should not be on the audio thread
+		static const sine_table& Get()
+		{
+			static const sine_table table;
+			return table;
+		}
+
+		float operator()(uint32_t nPhase) const
+		{
+			uint32_t i = nPhase >> (32 - BITS);
+			float fFrac = (float)(nPhase & ((1u << (32 - BITS)) - 1)) * (1.0f / (float)(1u << (32 - BITS)));
+			return m_fTable[i] + (m_fTable[i + 1] - m_fTable[i]) * fFrac;
+		}
+
+		// Phase step per sample at a frequency
+		static uint32_t Increment(FTYPE dHertz, FTYPE dSampleRate)
+		{
+			return (uint32_t)(int64_t)(dHertz / dSampleRate * 4294967296.0);
+		}
+
+		// Phase per radian, to turn a modulation index into a phase offset
+		static FTYPE Radian()
+		{
+			return 4294967296.0 / (2.0 * PI);
+		}
+
+	private:
+		static const int SIZE = 1 << BITS;
+		float m_fTable[SIZE + 1];
+
+		sine_table()
+		{
+			for (int i = 0; i <= SIZE; i++)
+				m_fTable[i] = (float)sin(2.0 * PI * i / SIZE);
+		}
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Scale to Frequency conversion
+
+	const int SCALE_DEFAULT = 0;
+
+	FTYPE scale(const int nNoteID, const int nScaleID = SCALE_DEFAULT)
+	{
+		switch (nScaleID)
+		{
+		case SCALE_DEFAULT: default:
+			return 8 * pow(1.0594630943592952645618252949463, nNoteID);
+		}
+	}
+
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Envelopes
+
+	// Quieter than this an envelope is silent, and reports exactly 0.0
+	const FTYPE ENV_SILENCE = 0.01;
+
+	struct envelope
+	{
+		virtual FTYPE amplitude(const FTYPE dTime, const FTYPE dTimeOn, const FTYPE dTimeOff) = 0;
+	};
+
+	struct envelope_adsr : public envelope
+	{
+		FTYPE dAttackTime;
+		FTYPE dDecayTime;
+		FTYPE dSustainAmplitude;
+		FTYPE dReleaseTime;
+		FTYPE dStartAmplitude;
+
+		envelope_adsr()
+		{
+			dAttackTime = 0.1;
+			dDecayTime = 0.1;
+			dSustainAmplitude = 1.0;
+			dReleaseTime = 0.2;
+			dStartAmplitude = 1.0;
+		}
+
+		virtual FTYPE amplitude(const FTYPE dTime, const FTYPE dTimeOn, const FTYPE dTimeOff)
+		{
+			FTYPE dAmplitude = 0.0;
+			FTYPE dReleaseAmplitude = 0.0;
+
+			if (dTimeOn > dTimeOff) // Note is on
+			{
+				FTYPE dLifeTime = dTime - dTimeOn;
+
+				if (dLifeTime <= dAttackTime)
+					dAmplitude = (dAttackTime > 0.0 ? dLifeTime / dAttackTime : 1.0) * dStartAmplitude;
+
+				if (dLifeTime > dAttackTime && dLifeTime <= (dAttackTime + dDecayTime))
+					dAmplitude = ((dLifeTime - dAttackTime) / dDecayTime) * (dSustainAmplitude - dStartAmplitude) + dStartAmplitude;
+
+				if (dLifeTime > (dAttackTime + dDecayTime))
+					dAmplitude = dSustainAmplitude;
+			}
+			else // Note is off
+			{
+				FTYPE dLifeTime = dTimeOff - dTimeOn;
+
+				if (dLifeTime <= dAttackTime)
+					dReleaseAmplitude = (dAttackTime > 0.0 ? dLifeTime / dAttackTime : 1.0) * dStartAmplitude;
+
+				if (dLifeTime > dAttackTime && dLifeTime <= (dAttackTime + dDecayTime))
+					dReleaseAmplitude = ((dLifeTime - dAttackTime) / dDecayTime) * (dSustainAmplitude - dStartAmplitude) + dStartAmplitude;
+
+				if (dLifeTime > (dAttackTime + dDecayTime))
+					dReleaseAmplitude = dSustainAmplitude;
+
+				dAmplitude = (dReleaseTime > 0.0 ? (dTime - dTimeOff) / dReleaseTime : 1.0) * (0.0 - dReleaseAmplitude) + dReleaseAmplitude;
+			}
+
+			// Amplitude should not be negative
+			if (dAmplitude <= ENV_SILENCE)
+				dAmplitude = 0.0;
+
+			return dAmplitude;
+		}
+
+		// True once a silent envelope can never sound again: released and faded
+		// out, or past the attack and decaying to a silent sustain level
+		bool finished(const FTYPE dTime, const FTYPE dTimeOn, const FTYPE dTimeOff, const FTYPE dAmplitude)
+		{
+			if (dAmplitude > 0.0)
+				return false;
+			if (dTimeOn > dTimeOff)
+				return dTime - dTimeOn > dAttackTime && dSustainAmplitude <= ENV_SILENCE;
+			return dTime >= dTimeOff;
+		}
+	};
+
+	FTYPE env(const FTYPE dTime, envelope& env, const FTYPE dTimeOn, const FTYPE dTimeOff)
+	{
+		return env.amplitude(dTime, dTimeOn, dTimeOff);
+	}
+
+
+	struct instrument_base
+	{
+		instrument_base()
+		{
+			for (int s = 0; s < SEND_COUNT; s++)
+				dSend[s] = 0.0;
+		}
+
+		FTYPE dVolume;
+		FTYPE dSend[SEND_COUNT];	// Level into each effects send bus
+		synth::envelope_adsr env;
+		FTYPE fMaxLifeTime;
+		wstring name;
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished) = 0;
+
+		// Instruments that can render many notes side by side in voice lanes
+		// override both. sound_lanes() adds nFrames of every note into pOut,
+		// scaled by its velocity, and flags the notes that finished inactive.
+		// sound() leaves velocity to the caller.
+		virtual bool has_lanes() const { return false; }
+		virtual void sound_lanes(note* const* /*ppNotes*/, size_t /*nNotes*/, FTYPE /*dStartTime*/, FTYPE /*dTimeStep*/, unsigned int /*nFrames*/, FTYPE* /*pOut*/) {}
+	};
+
+	// Per-note state for instruments that carry some from one sample to the
+	// next, such as phase accumulators. Notes hold no state of their own, so
+	// voices are matched to them by id and start time. Each new dTime starts a
+	// pass and a voice is found at most once per pass, so two identical notes
+	// get a voice each. With every voice taken, the one left unplayed longest
+	// is stolen.
+	template <class T, int N>
+	class voice_pool
+	{
+	public:
+		static const int COUNT = N;
+
+		// The voice of a note at dTime. bNew is set when it was just taken for
+		// the note and has to be started. nullptr if all of them are already
+		// playing in this pass.
+		T* Find(const note& n, FTYPE dTime, bool& bNew)
+		{
+			if (dTime != m_dTime)
+			{
+				m_dTime = dTime;
+				m_nPass++;
+			}
+
+			slot* pTake = nullptr;
+			for (auto& s : m_slots)
+			{
+				if (s.bPlaying && s.nPass != m_nPass && s.nNoteID == n.id && s.dOn == n.on)
+				{
+					s.nPass = m_nPass;
+					bNew = false;
+					return &s.state;
+				}
+
+				// Otherwise a free one, or the one left behind longest, or the oldest note
+				if (s.nPass != m_nPass && (pTake == nullptr || (pTake->bPlaying && (!s.bPlaying || s.nPass < pTake->nPass || (s.nPass == pTake->nPass && s.dOn < pTake->dOn)))))
+					pTake = &s;
+			}
+			if (pTake == nullptr)
+				return nullptr;
+
+			pTake->bPlaying = true;
+			pTake->nNoteID = n.id;
+			pTake->dOn = n.on;
+			pTake->nPass = m_nPass;
+			bNew = true;
+			return &pTake->state;
+		}
+
+		// Frees the voice of a note that has finished
+		void Free(T* pVoice)
+		{
+			for (auto& s : m_slots)
+				if (&s.state == pVoice)
+					s.bPlaying = false;
+		}
+
+		// Frees every voice no note was found for in the current pass, handing
+		// each to fnFree first
+		template <class F>
+		void Sweep(F fnFree)
+		{
+			for (auto& s : m_slots)
+			{
+				if (s.bPlaying && s.nPass != m_nPass)
+				{
+					fnFree(s.state);
+					s.bPlaying = false;
+				}
+			}
+		}
+
+		T& operator[](int i) { return m_slots[i].state; }
+
+	private:
+		struct slot
+		{
+			T state;
+			int nNoteID = 0;
+			FTYPE dOn = 0.0;
+			uint64_t nPass = 0;
+			bool bPlaying = false;
+		};
+
+		slot m_slots[N];
+		uint64_t m_nPass = 0;
+		FTYPE m_dTime = -1.0;
+	};
+
+	struct instrument_bell : public instrument_base
+	{
+		instrument_bell()
+		{
+			env.dAttackTime = 0.01;
+			env.dDecayTime = 1.0;
+			env.dSustainAmplitude = 0.0;
+			env.dReleaseTime = 1.0;
+			fMaxLifeTime = 3.0;
+			dVolume = 1.0;
+			name = L"Bell";
+		}
+
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			if (env.finished(dTime, n.on, n.off, dAmplitude)) bNoteFinished = true;
+			if (dAmplitude <= 0.0) return 0.0; // Silent, skip the oscillators
+
+			FTYPE dSound =
+				+1.00 * synth::osc(dTime - n.on, synth::scale(n.id + 12), synth::OSC_SINE, 5.0, 0.001)
+				+ 0.50 * synth::osc(dTime - n.on, synth::scale(n.id + 24))
+				+ 0.25 * synth::osc(dTime - n.on, synth::scale(n.id + 36));
+
+			return dAmplitude * dSound * dVolume;
+		}
+
+	};
+
+	struct instrument_bell8 : public instrument_base
+	{
+		instrument_bell8()
+		{
+			env.dAttackTime = 0.01;
+			env.dDecayTime = 0.5;
+			env.dSustainAmplitude = 0.8;
+			env.dReleaseTime = 1.0;
+			fMaxLifeTime = 3.0;
+			dVolume = 1.0;
+			name = L"8-Bit Bell";
+		}
+
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			if (env.finished(dTime, n.on, n.off, dAmplitude)) bNoteFinished = true;
+			if (dAmplitude <= 0.0) return 0.0; // Silent, skip the oscillators
+
+			FTYPE dSound =
+				+1.00 * synth::osc(dTime - n.on, synth::scale(n.id), synth::OSC_SQUARE, 5.0, 0.001)
+				+ 0.50 * synth::osc(dTime - n.on, synth::scale(n.id + 12))
+				+ 0.25 * synth::osc(dTime - n.on, synth::scale(n.id + 24));
+
+			return dAmplitude * dSound * dVolume;
+		}
+
+	};
+
+	struct instrument_harmonica : public instrument_base
+	{
+		instrument_harmonica()
+		{
+			env.dAttackTime = 0.00;
+			env.dDecayTime = 1.0;
+			env.dSustainAmplitude = 0.95;
+			env.dReleaseTime = 0.1;
+			fMaxLifeTime = -1.0;
+			name = L"Harmonica";
+			dVolume = 0.3;
+		}
+
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			if (env.finished(dTime, n.on, n.off, dAmplitude)) bNoteFinished = true;
+			if (dAmplitude <= 0.0) return 0.0; // Silent, skip the oscillators
+
+			FTYPE dSound =
+				+1.0 * synth::osc(n.on - dTime, synth::scale(n.id - 12), synth::OSC_SAW_ANA, 5.0, 0.001, 100)
+				+ 1.00 * synth::osc(dTime - n.on, synth::scale(n.id), synth::OSC_SQUARE, 5.0, 0.001)
+				+ 0.50 * synth::osc(dTime - n.on, synth::scale(n.id + 12), synth::OSC_SQUARE)
+				+ 0.05 * synth::osc(dTime - n.on, synth::scale(n.id + 24), synth::OSC_NOISE);
+
+			return dAmplitude * dSound * dVolume;
+		}
+
+	};
+
+
+	struct instrument_drumkick : public instrument_base
+	{
+		instrument_drumkick()
+		{
+			env.dAttackTime = 0.01;
+			env.dDecayTime = 0.15;
+			env.dSustainAmplitude = 0.0;
+			env.dReleaseTime = 0.0;
+			fMaxLifeTime = 1.5;
+			name = L"Drum Kick";
+			dVolume = 1.0;
+		}
+
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			if (env.finished(dTime, n.on, n.off, dAmplitude)) bNoteFinished = true;
+			if (fMaxLifeTime > 0.0 && dTime - n.on >= fMaxLifeTime)	bNoteFinished = true;
+			if (dAmplitude <= 0.0) return 0.0; // Silent, skip the oscillators
+
+			FTYPE dSound =
+				+0.99 * synth::osc(dTime - n.on, synth::scale(n.id - 36), synth::OSC_SINE, 1.0, 1.0)
+				+ 0.01 * synth::osc(dTime - n.on, 0, synth::OSC_NOISE);
+
+			return dAmplitude * dSound * dVolume;
+		}
+
+	};
+
+	struct instrument_drumsnare : public instrument_base
+	{
+		instrument_drumsnare()
+		{
+			env.dAttackTime = 0.0;
+			env.dDecayTime = 0.2;
+			env.dSustainAmplitude = 0.0;
+			env.dReleaseTime = 0.0;
+			fMaxLifeTime = 1.0;
+			name = L"Drum Snare";
+			dVolume = 1.0;
+		}
+
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			if (env.finished(dTime, n.on, n.off, dAmplitude)) bNoteFinished = true;
+			if (fMaxLifeTime > 0.0 && dTime - n.on >= fMaxLifeTime)	bNoteFinished = true;
+			if (dAmplitude <= 0.0) return 0.0; // Silent, skip the oscillators
+
+			FTYPE dSound =
+				+0.5 * synth::osc(dTime - n.on, synth::scale(n.id - 24), synth::OSC_SINE, 0.5, 1.0)
+				+ 0.5 * synth::osc(dTime - n.on, 0, synth::OSC_NOISE);
+
+			return dAmplitude * dSound * dVolume;
+		}
+
+	};
+
+
+	struct instrument_drumhihat : public instrument_base
+	{
+		instrument_drumhihat()
+		{
+			env.dAttackTime = 0.01;
+			env.dDecayTime = 0.05;
+			env.dSustainAmplitude = 0.0;
+			env.dReleaseTime = 0.0;
+			fMaxLifeTime = 1.0;
+			name = L"Drum HiHat";
+			dVolume = 0.5;
+		}
+
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			if (env.finished(dTime, n.on, n.off, dAmplitude)) bNoteFinished = true;
+			if (fMaxLifeTime > 0.0 && dTime - n.on >= fMaxLifeTime)	bNoteFinished = true;
+			if (dAmplitude <= 0.0) return 0.0; // Silent, skip the oscillators
+
+			FTYPE dSound =
+				+0.1 * synth::osc(dTime - n.on, synth::scale(n.id - 12), synth::OSC_SQUARE, 1.5, 1)
+				+ 0.9 * synth::osc(dTime - n.on, 0, synth::OSC_NOISE);
+
+			return dAmplitude * dSound * dVolume;
+		}
+
+	};
+
+
+	// Seven detuned band limited saws per note. Each saw of each note takes a
+	// voice lane, so a chord of eight notes is 56 lanes rendered together.
+	struct instrument_supersaw : public instrument_base
+	{
+		static const int UNISON = 7;
+		static const int MAX_OSCILLATORS = 1024;		// Saws rendered per pass, later notes are dropped
+		static constexpr unsigned int CONTROL_FRAMES = 32;	// Envelopes ramp linearly over this many samples
+
+		FTYPE dDetune = 0.5;		// 0 to 1, spread of the outer saws
+		FTYPE dSideLevel = 0.6;		// Outer saws against the centre one
+		FTYPE dSampleRate = 44100.0;
+
+		instrument_supersaw()
+		{
+			env.dAttackTime = 0.02;
+			env.dDecayTime = 0.3;
+			env.dSustainAmplitude = 0.7;
+			env.dReleaseTime = 0.4;
+			fMaxLifeTime = -1.0;
+			name = L"Supersaw";
+			dVolume = 0.15;
+		}
+
+		// Frequency ratio, level and starting phase of saw k
+		FTYPE Ratio(int k) const
+		{
+			static const FTYPE dSpread[UNISON] = { -0.11002313, -0.06288439, -0.01952356, 0.0, 0.01991221, 0.06216538, 0.10745242 };
+			return 1.0 + dSpread[k] * dDetune;
+		}
+
+		FTYPE Level(int k) const
+		{
+			return k == UNISON / 2 ? 1.0 : dSideLevel;
+		}
+
+		static FTYPE Phase(int k)
+		{
+			static const FTYPE dPhase[UNISON] = { 0.00, 0.37, 0.71, 0.13, 0.52, 0.89, 0.26 };
+			return dPhase[k];
+		}
+
+		// One note, one sample at a time
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			if (env.finished(dTime, n.on, n.off, dAmplitude)) bNoteFinished = true;
+			if (dAmplitude <= 0.0) return 0.0; // Silent, skip the oscillators
+
+			FTYPE dSound = 0.0;
+			for (int k = 0; k < UNISON; k++)
+			{
+				FTYPE dHertz = synth::scale(n.id) * Ratio(k);
+				FTYPE dPhase = dHertz * (dTime - n.on) + Phase(k);
+				dSound += Level(k) * SawBLEP(dPhase - floor(dPhase), dHertz / dSampleRate);
+			}
+
+			return dAmplitude * dSound * dVolume;
+		}
+
+		virtual bool has_lanes() const { return true; }
+
+		// Every note at once. Phases restart from the note's time at each control
+		// step, so they never drift from the per-sample path.
+		virtual void sound_lanes(note* const* ppNotes, size_t nNotes, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			for (unsigned int nDone = 0; nDone < nFrames; nDone += CONTROL_FRAMES)
+			{
+				unsigned int nStep = min(CONTROL_FRAMES, nFrames - nDone);
+				FTYPE dTime0 = dStartTime + nDone * dTimeStep;
+				FTYPE dTime1 = dTime0 + nStep * dTimeStep;
+
+				// Lay out the saws of every audible note
+				int nSlots = 0;
+				for (size_t i = 0; i < nNotes; i++)
+				{
+					note& n = *ppNotes[i];
+					FTYPE dAmp0 = synth::env(dTime0, env, n.on, n.off);
+					FTYPE dAmp1 = synth::env(dTime1, env, n.on, n.off);
+					if (env.finished(dTime1, n.on, n.off, dAmp1))
+						n.active = false;
+					if ((dAmp0 <= 0.0 && dAmp1 <= 0.0) || nSlots + UNISON > MAX_OSCILLATORS)
+						continue;
+
+					for (int k = 0; k < UNISON; k++, nSlots++)
+					{
+						FTYPE dHertz = synth::scale(n.id) * Ratio(k);
+						FTYPE dPhase = dHertz * (dTime0 - n.on) + Phase(k);
+						FTYPE dGain = Level(k) * dVolume * n.velocity;
+						m_fPhase[nSlots] = (float)(dPhase - floor(dPhase));
+						m_fStep[nSlots] = (float)(dHertz * dTimeStep);
+						m_fLevel[nSlots] = (float)(dAmp0 * dGain);
+						m_fRamp[nSlots] = (float)((dAmp1 - dAmp0) * dGain / nStep);
+					}
+				}
+				if (nSlots == 0)
+					continue;
+
+				// Fill the last vector with silent saws
+				for (; nSlots % lanes::COUNT != 0; nSlots++)
+				{
+					m_fPhase[nSlots] = 0.5f;
+					m_fStep[nSlots] = 0.01f;
+					m_fLevel[nSlots] = m_fRamp[nSlots] = 0.0f;
+				}
+
+				lanes mix[CONTROL_FRAMES];
+				for (unsigned int f = 0; f < nStep; f++)
+					mix[f] = lanes(0.0f);
+
+				lanes one(1.0f), zero(0.0f);
+				for (int g = 0; g < nSlots; g += lanes::COUNT)
+				{
+					lanes phase = lanes::Load(&m_fPhase[g]);
+					lanes step = lanes::Load(&m_fStep[g]);
+					lanes level = lanes::Load(&m_fLevel[g]);
+					lanes ramp = lanes::Load(&m_fRamp[g]);
+					for (unsigned int f = 0; f < nStep; f++)
+					{
+						mix[f] = mix[f] + level * SawBLEP(phase, step);
+						phase = phase + step;
+						phase = phase - lanes::Select(phase >= one, one, zero);
+						level = level + ramp;
+					}
+				}
+
+				for (unsigned int f = 0; f < nStep; f++)
+					pOut[nDone + f] += mix[f].Sum();
+			}
+		}
+
+	private:
+		float m_fPhase[MAX_OSCILLATORS + SYNTH_LANES];
+		float m_fStep[MAX_OSCILLATORS + SYNTH_LANES];
+		float m_fLevel[MAX_OSCILLATORS + SYNTH_LANES];
+		float m_fRamp[MAX_OSCILLATORS + SYNTH_LANES];
+	};
+
+
+	// One FM operator: a sine at a ratio of the note's frequency with its own
+	// envelope. Its level is the output of a carrier, or the modulation index
+	// in radians of a modulator.
+	struct fm_operator
+	{
+		FTYPE dRatio = 1.0;
+		FTYPE dDetune = 0.0;	// Hertz added after the ratio
+		FTYPE dLevel = 1.0;
+		envelope_adsr env;
+
+		void Set(FTYPE ratio, FTYPE level, FTYPE attack, FTYPE decay, FTYPE sustain, FTYPE release)
+		{
+			dRatio = ratio;
+			dLevel = level;
+			env.dAttackTime = attack;
+			env.dDecayTime = decay;
+			env.dSustainAmplitude = sustain;
+			env.dReleaseTime = release;
+		}
+	};
+
+	// How FM operators connect. An operator can only be modulated by ones with
+	// a higher index, so they are computed from the last down to 0.
+	struct fm_algorithm
+	{
+		static const int MAX_OPERATORS = 6;
+
+		int nOperators = 1;
+		uint8_t nModulators[MAX_OPERATORS] = {};	// Bit m set: operator m modulates this one
+		uint8_t nCarriers = 1;						// Bit k set: operator k is heard
+		int nFeedback = -1;							// Operator modulating itself, -1 for none
+
+		// One chain, n-1 -> ... -> 1 -> 0
+		static fm_algorithm Stack(int n)
+		{
+			fm_algorithm a;
+			a.nOperators = n;
+			for (int k = 0; k + 1 < n; k++)
+				a.nModulators[k] = (uint8_t)(1 << (k + 1));
+			a.nFeedback = n - 1;
+			return a;
+		}
+
+		// Modulator and carrier pairs, 1 -> 0, 3 -> 2, 5 -> 4
+		static fm_algorithm Pairs(int n)
+		{
+			fm_algorithm a;
+			a.nOperators = n;
+			a.nCarriers = 0;
+			for (int k = 0; k < n; k += 2)
+			{
+				a.nCarriers |= (uint8_t)(1 << k);
+				if (k + 1 < n)
+					a.nModulators[k] = (uint8_t)(1 << (k + 1));
+			}
+			a.nFeedback = n - 1;
+			return a;
+		}
+
+		// Every operator heard, none modulated: plain additive
+		static fm_algorithm Parallel(int n)
+		{
+			fm_algorithm a;
+			a.nOperators = n;
+			a.nCarriers = (uint8_t)((1 << n) - 1);
+			return a;
+		}
+	};
+
+	// Up to six operator FM on table sine phase accumulators. Operator envelopes
+	// run at control rate. The default patch is a bell in instrument_bell's
+	// register.
+	struct instrument_fm : public instrument_base
+	{
+		static const int MAX_OPERATORS = fm_algorithm::MAX_OPERATORS;
+		static const int MAX_VOICES = 64;				// Notes sounding at once, the oldest is stolen
+		static constexpr unsigned int CONTROL_FRAMES = 32;	// Envelopes ramp linearly over this many samples
+
+		fm_operator op[MAX_OPERATORS];
+		fm_algorithm algorithm;
+		FTYPE dFeedback = 0.0;		// Modulation index the feedback operator applies to itself
+		int nTranspose = 12;		// Semitones above the note id
+		FTYPE dSampleRate = 44100.0;
+
+		instrument_fm()
+		{
+			sine_table::Get();
+			algorithm = fm_algorithm::Pairs(4);
+			dFeedback = 0.4;
+			op[0].Set(1.0, 1.0, 0.01, 1.0, 0.0, 1.0);
+			op[1].Set(3.5, 1.5, 0.002, 0.8, 0.0, 0.8);
+			op[2].Set(2.0, 0.5, 0.01, 1.0, 0.0, 1.0);
+			op[3].Set(5.19, 1.0, 0.002, 0.5, 0.0, 0.5);
+			fMaxLifeTime = -1.0;
+			name = L"FM Bell";
+			dVolume = 0.6;
+		}
+
+		// One note, one sample at a time
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dSound = 0.0;
+			n.velocity = 1.0;	// Left to the caller here, Render() would apply it too
+			voice* pVoice = Voice(n, dTime);
+			if (pVoice == nullptr || !Render(*pVoice, n, dTime, 1.0 / dSampleRate, 1, &dSound))
+			{
+				bNoteFinished = true;
+				if (pVoice != nullptr)
+					m_voices.Free(pVoice);
+			}
+			return dSound;
+		}
+
+		// Not lanes as such, but a block per voice keeps the operators in registers
+		virtual bool has_lanes() const { return true; }
+
+		virtual void sound_lanes(note* const* ppNotes, size_t nNotes, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			for (size_t i = 0; i < nNotes; i++)
+			{
+				note& n = *ppNotes[i];
+				voice* pVoice = Voice(n, dStartTime);
+				if (pVoice == nullptr || !Render(*pVoice, n, dStartTime, dTimeStep, nFrames, pOut))
+				{
+					n.active = false;
+					if (pVoice != nullptr)
+						m_voices.Free(pVoice);
+				}
+			}
+			m_voices.Sweep([](voice&) {});
+		}
+
+	private:
+		struct voice
+		{
+			uint32_t nPhase[MAX_OPERATORS];
+			float fHistory[2];	// Last two outputs of the feedback operator
+		};
+
+		voice_pool<voice, MAX_VOICES> m_voices;
+
+		voice* Voice(const note& n, FTYPE dTime)
+		{
+			bool bNew = false;
+			voice* pVoice = m_voices.Find(n, dTime, bNew);
+			if (pVoice != nullptr && bNew)
+			{
+				for (int k = 0; k < MAX_OPERATORS; k++)
+					pVoice->nPhase[k] = 0;
+				pVoice->fHistory[0] = pVoice->fHistory[1] = 0.0f;
+			}
+			return pVoice;
+		}
+
+		// Adds nFrames of a voice into pOut. False once every carrier is silent for good.
+		bool Render(voice& v, const note& n, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			const sine_table& sine = sine_table::Get();
+			int nOperators = min(max(algorithm.nOperators, 1), (int)MAX_OPERATORS);
+			FTYPE dHertz = synth::scale(n.id + nTranspose);
+
+			// Who modulates whom, as lists
+			int nSource[MAX_OPERATORS][MAX_OPERATORS];
+			int nSources[MAX_OPERATORS];
+			bool bCarrier[MAX_OPERATORS];
+			for (int k = 0; k < nOperators; k++)
+			{
+				nSources[k] = 0;
+				for (int m = k + 1; m < nOperators; m++)
+					if (algorithm.nModulators[k] & (1 << m))
+						nSource[k][nSources[k]++] = m;
+				bCarrier[k] = (algorithm.nCarriers & (1 << k)) != 0;
+			}
+			float fFeedback = (float)(dFeedback * sine_table::Radian() * 0.5);
+
+			bool bSounding = true;
+			for (unsigned int nDone = 0; nDone < nFrames && bSounding; nDone += CONTROL_FRAMES)
+			{
+				unsigned int nStep = min(CONTROL_FRAMES, nFrames - nDone);
+				FTYPE dTime0 = dStartTime + nDone * dTimeStep;
+				FTYPE dTime1 = dTime0 + nStep * dTimeStep;
+
+				// Levels ramp across the step: output for carriers, phase offset for modulators
+				float fLevel[MAX_OPERATORS], fRamp[MAX_OPERATORS];
+				uint32_t nStepPhase[MAX_OPERATORS];
+				bSounding = false;
+				for (int k = 0; k < nOperators; k++)
+				{
+					FTYPE dAmp0 = op[k].env.amplitude(dTime0, n.on, n.off);
+					FTYPE dAmp1 = op[k].env.amplitude(dTime1, n.on, n.off);
+					if (bCarrier[k] && op[k].dLevel > 0.0 && !op[k].env.finished(dTime1, n.on, n.off, dAmp1))
+						bSounding = true;
+
+					FTYPE dScale = op[k].dLevel * (bCarrier[k] ? dVolume * n.velocity : sine_table::Radian());
+					fLevel[k] = (float)(dAmp0 * dScale);
+					fRamp[k] = (float)((dAmp1 - dAmp0) * dScale / nStep);
+					nStepPhase[k] = sine_table::Increment(dHertz * op[k].dRatio + op[k].dDetune, dSampleRate);
+				}
+
+				for (unsigned int f = 0; f < nStep; f++)
+				{
+					float fOut[MAX_OPERATORS];
+					float fMix = 0.0f;
+					for (int k = nOperators - 1; k >= 0; k--)
+					{
+						float fModulation = 0.0f;
+						for (int s = 0; s < nSources[k]; s++)
+							fModulation += fOut[nSource[k][s]];
+						if (k == algorithm.nFeedback)
+							fModulation += fFeedback * (v.fHistory[0] + v.fHistory[1]);
+
+						float fSine = sine(v.nPhase[k] + (uint32_t)(int64_t)fModulation);
+						if (k == algorithm.nFeedback)
+						{
+							v.fHistory[1] = v.fHistory[0];
+							v.fHistory[0] = fSine;
+						}
+
+						fOut[k] = fSine * fLevel[k];
+						if (bCarrier[k])
+							fMix += fOut[k];
+						v.nPhase[k] += nStepPhase[k];
+						fLevel[k] += fRamp[k];
+					}
+					pOut[nDone + f] += fMix;
+				}
+			}
+			return bSounding;
+		}
+	};
+
+
+	// Subtractive voice: one band limited saw or square through its own
+	// resonant filter, the cutoff swept by a second envelope. Filter
+	// coefficients follow the envelope at control rate.
+	struct instrument_analog : public instrument_base
+	{
+		static const int MAX_VOICES = 64;				// Notes sounding at once, the oldest is stolen
+		static constexpr unsigned int CONTROL_FRAMES = 32;	// Envelopes and cutoff are updated this often
+
+		int nWave = OSC_SAW_DIG;		// OSC_SAW_DIG or OSC_SQUARE
+		int nFilter = FILTER_LADDER;	// FILTER_LADDER, or an SVF mode such as FILTER_LOW_PASS
+		FTYPE dCutoff = 250.0;			// Hertz with the filter envelope at zero
+		FTYPE dEnvAmount = 4.0;			// Octaves the filter envelope opens the cutoff by
+		FTYPE dKeyTrack = 0.5;			// How far the cutoff follows the note, 1 for fully
+		FTYPE dResonance = 0.6;
+		envelope_adsr envFilter;
+		FTYPE dSampleRate = 44100.0;
+
+		instrument_analog()
+		{
+			env.dAttackTime = 0.005;
+			env.dDecayTime = 0.2;
+			env.dSustainAmplitude = 0.8;
+			env.dReleaseTime = 0.25;
+			envFilter.dAttackTime = 0.01;
+			envFilter.dDecayTime = 0.4;
+			envFilter.dSustainAmplitude = 0.3;
+			envFilter.dReleaseTime = 0.3;
+			fMaxLifeTime = -1.0;
+			name = L"Analog";
+			dVolume = 0.4;
+		}
+
+		// One note, one sample at a time
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dSound = 0.0;
+			n.velocity = 1.0;	// Left to the caller here, Render() would apply it too
+			voice* pVoice = Voice(n, dTime);
+			if (pVoice == nullptr || !Render(*pVoice, n, dTime, 1.0 / dSampleRate, 1, &dSound))
+			{
+				bNoteFinished = true;
+				if (pVoice != nullptr)
+					m_voices.Free(pVoice);
+			}
+			return dSound;
+		}
+
+		// Not lanes as such, but the filter runs a block at a time
+		virtual bool has_lanes() const { return true; }
+
+		virtual void sound_lanes(note* const* ppNotes, size_t nNotes, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			for (size_t i = 0; i < nNotes; i++)
+			{
+				note& n = *ppNotes[i];
+				voice* pVoice = Voice(n, dStartTime);
+				if (pVoice == nullptr || !Render(*pVoice, n, dStartTime, dTimeStep, nFrames, pOut))
+				{
+					n.active = false;
+					if (pVoice != nullptr)
+						m_voices.Free(pVoice);
+				}
+			}
+			m_voices.Sweep([](voice&) {});
+		}
+
+	private:
+		struct voice
+		{
+			FTYPE dPhase;
+			filter_svf svf;
+			filter_ladder ladder;
+		};
+
+		voice_pool<voice, MAX_VOICES> m_voices;
+
+		voice* Voice(const note& n, FTYPE dTime)
+		{
+			bool bNew = false;
+			voice* pVoice = m_voices.Find(n, dTime, bNew);
+			if (pVoice != nullptr && bNew)
+			{
+				pVoice->dPhase = 0.0;
+				pVoice->svf.Reset();
+				pVoice->ladder.Reset();
+			}
+			return pVoice;
+		}
+
+		// Adds nFrames of a voice into pOut. False once it is silent for good.
+		bool Render(voice& v, const note& n, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			FTYPE dHertz = synth::scale(n.id);
+			FTYPE dStep = dHertz * dTimeStep;
+			FTYPE dKeyCutoff = dCutoff * pow(dHertz / 261.63, dKeyTrack);
+
+			for (unsigned int nDone = 0; nDone < nFrames; nDone += CONTROL_FRAMES)
+			{
+				unsigned int nCount = min(CONTROL_FRAMES, nFrames - nDone);
+				FTYPE dTime0 = dStartTime + nDone * dTimeStep;
+				FTYPE dTime1 = dTime0 + nCount * dTimeStep;
+				FTYPE dAmp0 = synth::env(dTime0, env, n.on, n.off);
+				FTYPE dAmp1 = synth::env(dTime1, env, n.on, n.off);
+				if (env.finished(dTime1, n.on, n.off, dAmp1))
+					return false;
+
+				FTYPE dCutoffNow = dKeyCutoff * pow(2.0, dEnvAmount * envFilter.amplitude(dTime0, n.on, n.off));
+				if (nFilter == FILTER_LADDER)
+					v.ladder.Set(dCutoffNow, dResonance, dSampleRate);
+				else
+					v.svf.Set(dCutoffNow, dResonance, dSampleRate);
+
+				FTYPE dBlock[CONTROL_FRAMES];
+				for (unsigned int f = 0; f < nCount; f++)
+				{
+					FTYPE dWave = SawBLEP(v.dPhase, dStep);
+					if (nWave == OSC_SQUARE)
+					{
+						FTYPE dHalf = v.dPhase + 0.5;
+						dWave -= SawBLEP(dHalf - floor(dHalf), dStep);
+					}
+					dBlock[f] = dWave;
+					v.dPhase += dStep;
+					v.dPhase -= floor(v.dPhase);
+				}
+
+				if (nFilter == FILTER_LADDER)
+					v.ladder.Process(dBlock, nCount);
+				else
+					v.svf.Process(dBlock, nCount, nFilter);
+
+				FTYPE dRamp = (dAmp1 - dAmp0) / nCount;
+				for (unsigned int f = 0; f < nCount; f++)
+					pOut[nDone + f] += dBlock[f] * (dAmp0 + dRamp * f) * dVolume * n.velocity;
+			}
+			return true;
+		}
+	};
+
+
+	// Multi-sampled instrument streamed from wave files. A note plays the sample
+	// whose key range holds it, or the one with the nearest root, repitched.
+	// Samples are added before the engine starts playing.
+	struct instrument_sampler : public instrument_base
+	{
+		static const int MAX_VOICES = 64;	// Notes sounding at once, the oldest is stolen
+
+		FTYPE dSampleRate = 44100.0;
+		size_t nHeadFrames = 8192;		// Decoded at load, plays while the prefetcher catches up
+
+		instrument_sampler()
+		{
+			env.dAttackTime = 0.002;
+			env.dDecayTime = 0.0;
+			env.dSustainAmplitude = 1.0;
+			env.dReleaseTime = 0.3;
+			fMaxLifeTime = -1.0;
+			name = L"Sampler";
+			dVolume = 1.0;
+		}
+
+		~instrument_sampler()
+		{
+			m_prefetch.Stop();
+		}
+
+		// Adds one sample, played for note ids nLow to nHigh
+		bool AddSample(const string& sFile, int nRoot, int nLow, int nHigh, string& sError)
+		{
+			unique_ptr<sample> pSample(new sample());
+			if (!pSample->Load(sFile, nHeadFrames, sError))
+				return false;
+			pSample->nRoot = nRoot;
+			pSample->nLow = nLow;
+			pSample->nHigh = nHigh;
+			m_vecSamples.push_back(move(pSample));
+
+			// Voices and the prefetcher only once there is something to play
+			if (!m_prefetch.IsRunning())
+			{
+				m_pStreams.reset(new sample_stream[MAX_VOICES]);
+				for (int v = 0; v < MAX_VOICES; v++)
+				{
+					m_pStreams[v].Create();
+					m_voices[v].pStream = &m_pStreams[v];
+				}
+				m_prefetch.Start(m_pStreams.get(), MAX_VOICES);
+			}
+			return true;
+		}
+
+		// Reads a sample list, one "<file.wav> <root> [<low> <high>]" per line.
+		// Paths are relative to the list, lines starting with '#' are ignored.
+		bool Load(const string& sFile, string& sError)
+		{
+			ifstream f(sFile);
+			if (!f.is_open())
+			{
+				sError = "cannot open " + sFile;
+				return false;
+			}
+
+			size_t nSlash = sFile.find_last_of("/\\");
+			string sBase = nSlash == string::npos ? "" : sFile.substr(0, nSlash + 1);
+
+			string sLine;
+			int nLine = 0;
+			while (getline(f, sLine))
+			{
+				nLine++;
+				istringstream line(sLine);
+				string sSample;
+				int nRoot = 0, nLow = 0, nHigh = 127;
+				if (!(line >> sSample) || sSample[0] == '#')
+					continue;
+				if (!(line >> nRoot))
+				{
+					sError = sFile + ":" + to_string(nLine) + ": expected <file.wav> <root> [<low> <high>]";
+					return false;
+				}
+				if (!(line >> nLow >> nHigh))
+					nLow = nHigh = nRoot;
+
+				bool bAbsolute = sSample[0] == '/' || sSample[0] == '\\' || (sSample.size() > 1 && sSample[1] == ':');
+				if (!AddSample(bAbsolute ? sSample : sBase + sSample, nRoot, nLow, nHigh, sError))
+					return false;
+			}
+			return true;
+		}
+
+		size_t Samples() const { return m_vecSamples.size(); }
+
+		// Size of the sample files on disk
+		uint64_t LibraryBytes() const
+		{
+			uint64_t nBytes = 0;
+			for (auto& s : m_vecSamples)
+				nBytes += s->file.Size();
+			return nBytes;
+		}
+
+		// Frames the audio thread needed before the prefetcher had them, played as silence
+		uint64_t Underruns() const { return m_nUnderruns.load(memory_order_relaxed); }
+
+		// One note, one sample at a time
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+			voice* pVoice = Voice(n, dTime);
+			FTYPE dSound = 0.0;
+			if (pVoice == nullptr || env.finished(dTime, n.on, n.off, dAmplitude) || !Play(*pVoice, dSound))
+			{
+				bNoteFinished = true;
+				if (pVoice != nullptr)
+					Stop(*pVoice);
+				return 0.0;
+			}
+			pVoice->pStream->Played((size_t)pVoice->dPosition);
+			return dAmplitude * dSound * dVolume;
+		}
+
+		// Not lanes as such, but every note in one call saves finding its voice
+		// for each sample
+		virtual bool has_lanes() const { return true; }
+
+		virtual void sound_lanes(note* const* ppNotes, size_t nNotes, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			for (size_t i = 0; i < nNotes; i++)
+			{
+				note& n = *ppNotes[i];
+				voice* pVoice = Voice(n, dStartTime);
+				if (pVoice == nullptr)
+				{
+					n.active = false;
+					continue;
+				}
+
+				for (unsigned int f = 0; f < nFrames; f++)
+				{
+					FTYPE dTime = dStartTime + f * dTimeStep;
+					FTYPE dAmplitude = synth::env(dTime, env, n.on, n.off);
+					FTYPE dSound = 0.0;
+					if (env.finished(dTime, n.on, n.off, dAmplitude) || !Play(*pVoice, dSound))
+					{
+						n.active = false;
+						break;
+					}
+					pOut[f] += dAmplitude * dSound * dVolume * n.velocity;
+				}
+
+				pVoice->pStream->Played((size_t)pVoice->dPosition);
+				if (!n.active)
+					Stop(*pVoice);
+			}
+
+			// Voices whose notes have gone
+			m_voices.Sweep([](voice& v) { v.pStream->Start(nullptr); });
+		}
+
+	private:
+		struct voice
+		{
+			sample_stream* pStream = nullptr;
+			const sample* pSample = nullptr;
+			FTYPE dPosition = 0.0;		// In frames of the sample
+			FTYPE dIncrement = 0.0;
+		};
+
+		vector<unique_ptr<sample>> m_vecSamples;
+		unique_ptr<sample_stream[]> m_pStreams;
+		voice_pool<voice, MAX_VOICES> m_voices;
+		sample_prefetcher m_prefetch;
+		atomic<uint64_t> m_nUnderruns{ 0 };
+
+		// The voice playing a note, started on the right sample if it is new
+		voice* Voice(const note& n, FTYPE dTime)
+		{
+			if (m_vecSamples.empty())
+				return nullptr;
+
+			bool bNew = false;
+			voice* pVoice = m_voices.Find(n, dTime, bNew);
+			if (pVoice == nullptr || !bNew)
+				return pVoice;
+
+			const sample* pBest = nullptr;
+			for (auto& s : m_vecSamples)
+			{
+				bool bInRange = n.id >= s->nLow && n.id <= s->nHigh;
+				bool bBestInRange = pBest != nullptr && n.id >= pBest->nLow && n.id <= pBest->nHigh;
+				if (pBest == nullptr || (bInRange && !bBestInRange) || (bInRange == bBestInRange && abs(n.id - s->nRoot) < abs(n.id - pBest->nRoot)))
+					pBest = s.get();
+			}
+
+			pVoice->pSample = pBest;
+			pVoice->dPosition = 0.0;
+			pVoice->dIncrement = pow(2.0, (n.id - pBest->nRoot) / 12.0) * pBest->fmt.nSampleRate / dSampleRate;
+			pVoice->pStream->Start(pBest);
+			return pVoice;
+		}
+
+		// Next sample of a voice, false once it has played to the end
+		bool Play(voice& v, FTYPE& dSound)
+		{
+			size_t n = (size_t)v.dPosition;
+			if (n + 1 >= v.pSample->fmt.nFrames)
+				return false;
+
+			float f0, f1;
+			if (v.pStream->Frame(*v.pSample, n, f0) && v.pStream->Frame(*v.pSample, n + 1, f1))
+				dSound = f0 + (f1 - f0) * (v.dPosition - n);
+			else
+				m_nUnderruns.fetch_add(1, memory_order_relaxed);
+			v.dPosition += v.dIncrement;
+			return true;
+		}
+
+		void Stop(voice& v)
+		{
+			v.pStream->Start(nullptr);
+			m_voices.Free(&v);
+		}
+	};
+
+
+	// Instrument compiled from a patch, see synthPatch.h. Another patch can be
+	// swapped in while it plays: notes keep their voices and go on with the new
+	// sound from the next block. Compile(), Load() and Reload() belong to one
+	// control thread, the audio thread only reads the program they publish.
+	// Programs replaced are deleted by the control thread once the engine has
+	// finished a block since.
+	struct instrument_patch : public instrument_base
+	{
+		static const int MAX_VOICES = 64;				// Notes sounding at once, the oldest is stolen
+		static const int MAX_OPS = patch_program::MAX_OPS;
+		static constexpr unsigned int CONTROL_FRAMES = 32;	// Envelope ramps linearly over this many samples
+
+		FTYPE dSampleRate = 44100.0;
+
+		instrument_patch()
+		{
+			sine_table::Get();
+			fMaxLifeTime = -1.0;
+			name = L"Patch";
+			dVolume = 1.0;
+			string sError;
+			Compile(PATCH_BELL, "bell", sError);
+		}
+
+		~instrument_patch()
+		{
+			delete m_pProgram.load();
+			for (auto& r : m_vecRetired)
+				delete r.first;
+		}
+
+		// Plays patch text from the next block. sSource names it in errors.
+		bool Compile(const string& sText, const string& sSource, string& sError)
+		{
+			unique_ptr<patch_program> pProgram(new patch_program());
+			if (!CompilePatch(sText, sSource, *pProgram, sError))
+				return false;
+
+			m_sText = sText;
+			// Sequentially consistent with the audio side, or the count read
+			// here could miss a block that already loaded the old program
+			const patch_program* pOld = m_pProgram.exchange(pProgram.release(), memory_order_seq_cst);
+			if (pOld != nullptr)
+				m_vecRetired.push_back({ pOld, m_nPasses.load(memory_order_seq_cst) });
+			Collect();
+			m_nLoads++;
+			return true;
+		}
+
+		// Reads a patch file, which Reload() then watches
+		bool Load(const string& sFile, string& sError)
+		{
+			string sText;
+			if (!ReadText(sFile, sText, sError) || !Compile(sText, sFile, sError))
+				return false;
+			m_sFile = sFile;
+			return true;
+		}
+
+		// Compiles the file again if its text has changed. If it no longer
+		// compiles the old patch plays on and this returns false.
+		bool Reload(string& sError)
+		{
+			Collect();
+			if (m_sFile.empty())
+				return true;
+			string sText;
+			if (!ReadText(m_sFile, sText, sError))
+				return false;
+			return sText == m_sText || Compile(sText, m_sFile, sError);
+		}
+
+		// Control thread: the patch playing, and how many have been compiled
+		const patch_program& Program() const { return *m_pProgram.load(memory_order_relaxed); }
+		unsigned int Loads() const { return m_nLoads; }
+		size_t Retired() const { return m_vecRetired.size(); }
+
+		// Audio thread: the engine has finished a block, nothing it loaded
+		// before is still in use
+		void BlockDone() { m_nPasses.fetch_add(1, memory_order_seq_cst); }
+
+		// One note, one sample at a time
+		virtual FTYPE sound(const FTYPE dTime, synth::note n, bool& bNoteFinished)
+		{
+			const patch_program& program = *m_pProgram.load(memory_order_seq_cst);
+			FTYPE dSound = 0.0;
+			n.velocity = 1.0;	// Left to the caller here, Render() would apply it too
+			voice* pVoice = Voice(n, dTime);
+			if (pVoice == nullptr || !Render(program, *pVoice, n, dTime, 1.0 / dSampleRate, 1, &dSound))
+			{
+				bNoteFinished = true;
+				if (pVoice != nullptr)
+					m_voices.Free(pVoice);
+			}
+			return dSound;
+		}
+
+		// Not lanes as such, the ops run a control step of a voice at a time
+		virtual bool has_lanes() const { return true; }
+
+		virtual void sound_lanes(note* const* ppNotes, size_t nNotes, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			const patch_program& program = *m_pProgram.load(memory_order_seq_cst);
+			for (size_t i = 0; i < nNotes; i++)
+			{
+				note& n = *ppNotes[i];
+				voice* pVoice = Voice(n, dStartTime);
+				if (pVoice == nullptr || !Render(program, *pVoice, n, dStartTime, dTimeStep, nFrames, pOut))
+				{
+					n.active = false;
+					if (pVoice != nullptr)
+						m_voices.Free(pVoice);
+				}
+			}
+			m_voices.Sweep([](voice&) {});
+		}
+
+	private:
+		struct voice
+		{
+			uint32_t nPhase[MAX_OPS];
+			uint32_t nLFO[MAX_OPS];
+		};
+
+		voice_pool<voice, MAX_VOICES> m_voices;
+		atomic<const patch_program*> m_pProgram{ nullptr };
+		atomic<uint64_t> m_nPasses{ 0 };	// Engine blocks completed
+
+		// Control thread only
+		vector<pair<const patch_program*, uint64_t>> m_vecRetired;	// With the pass count when replaced
+		string m_sFile;
+		string m_sText;
+		unsigned int m_nLoads = 0;
+
+		// Deletes the programs no pass can still be using
+		void Collect()
+		{
+			uint64_t nPasses = m_nPasses.load(memory_order_seq_cst);
+			auto it = remove_if(m_vecRetired.begin(), m_vecRetired.end(), [&](const pair<const patch_program*, uint64_t>& r)
+			{
+				if (r.second >= nPasses)
+					return false;
+				delete r.first;
+				return true;
+			});
+			m_vecRetired.erase(it, m_vecRetired.end());
+		}
+
+		voice* Voice(const note& n, FTYPE dTime)
+		{
+			bool bNew = false;
+			voice* pVoice = m_voices.Find(n, dTime, bNew);
+			if (pVoice != nullptr && bNew)
+			{
+				for (int k = 0; k < MAX_OPS; k++)
+					pVoice->nPhase[k] = pVoice->nLFO[k] = 0;
+			}
+			return pVoice;
+		}
+
+		// Adds nFrames of a voice into pOut. False once it is silent for good.
+		bool Render(const patch_program& program, voice& v, const note& n, FTYPE dStartTime, FTYPE dTimeStep, unsigned int nFrames, FTYPE* pOut)
+		{
+			const sine_table& sine = sine_table::Get();
+			envelope_adsr adsr;
+			adsr.dAttackTime = program.dAttack;
+			adsr.dDecayTime = program.dDecay;
+			adsr.dSustainAmplitude = program.dSustain;
+			adsr.dReleaseTime = program.dRelease;
+			adsr.dStartAmplitude = program.dStart;
+
+			// Steps for the note, LFO depth as a phase offset
+			const patch_op* pOps = program.vecOps.data();
+			size_t nOps = program.vecOps.size();
+			FTYPE dHertz = synth::scale(n.id);
+			uint32_t nStep[MAX_OPS], nLFOStep[MAX_OPS];
+			float fDepth[MAX_OPS];
+			for (size_t k = 0; k < nOps; k++)
+			{
+				nStep[k] = sine_table::Increment(dHertz * pOps[k].fRatio, dSampleRate);
+				nLFOStep[k] = sine_table::Increment(pOps[k].fLFOHertz, dSampleRate);
+				fDepth[k] = (float)(pOps[k].fLFODepth * dHertz * pOps[k].fRatio * sine_table::Radian());
+			}
+			float fVolume = (float)(program.dVolume * dVolume * n.velocity);
+
+			for (unsigned int nDone = 0; nDone < nFrames; nDone += CONTROL_FRAMES)
+			{
+				unsigned int nCount = min(CONTROL_FRAMES, nFrames - nDone);
+				FTYPE dTime0 = dStartTime + nDone * dTimeStep;
+				FTYPE dTime1 = dTime0 + nCount * dTimeStep;
+				FTYPE dAmp0 = adsr.amplitude(dTime0, n.on, n.off);
+				FTYPE dAmp1 = adsr.amplitude(dTime1, n.on, n.off);
+				if (adsr.finished(dTime1, n.on, n.off, dAmp1) || (program.dLifeTime > 0.0 && dTime0 - n.on >= program.dLifeTime))
+					return false;
+
+				float fMix[CONTROL_FRAMES];
+				uint32_t nMod[CONTROL_FRAMES];
+				fill(fMix, fMix + nCount, 0.0f);
+				for (size_t k = 0; k < nOps; k++)
+				{
+					float fWeight = pOps[k].fWeight;
+					if (pOps[k].nWave == PATCH_NOISE)
+					{
+						for (unsigned int f = 0; f < nCount; f++)
+							fMix[f] += fWeight * (float)noise();
+						continue;
+					}
+
+					// Phase offsets from the LFO, if there is one
+					if (fDepth[k] != 0.0f)
+					{
+						for (unsigned int f = 0; f < nCount; f++)
+						{
+							nMod[f] = (uint32_t)(int64_t)(fDepth[k] * sine(v.nLFO[k]));
+							v.nLFO[k] += nLFOStep[k];
+						}
+					}
+					else
+						fill(nMod, nMod + nCount, 0u);
+
+					uint32_t nPhase = v.nPhase[k];
+					uint32_t nInc = nStep[k];
+					switch (pOps[k].nWave)
+					{
+					case PATCH_SINE:
+						for (unsigned int f = 0; f < nCount; f++, nPhase += nInc)
+							fMix[f] += fWeight * sine(nPhase + nMod[f]);
+						break;
+
+					case PATCH_SQUARE: // Positive for the first half cycle, as sin() is
+						for (unsigned int f = 0; f < nCount; f++, nPhase += nInc)
+							fMix[f] += (int32_t)(nPhase + nMod[f]) > 0 ? fWeight : -fWeight;
+						break;
+
+					case PATCH_TRIANGLE: // Zero at the start of a cycle, rising, as asin(sin())
+						for (unsigned int f = 0; f < nCount; f++, nPhase += nInc)
+							fMix[f] += fWeight * (1.0f - fabsf((float)(int32_t)(nPhase + nMod[f] + 0xC0000000u)) * (1.0f / 1073741824.0f));
+						break;
+
+					case PATCH_SAW:
+					{
+						FTYPE dStep = nInc * (1.0 / 4294967296.0);
+						for (unsigned int f = 0; f < nCount; f++, nPhase += nInc)
+							fMix[f] += fWeight * (float)SawBLEP((nPhase + nMod[f]) * (1.0 / 4294967296.0), dStep);
+						break;
+					}
+					}
+					v.nPhase[k] = nPhase;
+				}
+
+				float fLevel = (float)dAmp0 * fVolume;
+				float fRamp = (float)(dAmp1 - dAmp0) * fVolume / nCount;
+				for (unsigned int f = 0; f < nCount; f++)
+					pOut[nDone + f] += fMix[f] * (fLevel + fRamp * f);
+			}
+			return true;
+		}
+	};
+
+
+	struct sequencer
+	{
+	public:
+		struct channel
+		{
+			instrument_base* instrument;
+			wstring sBeat;
+		};
+
+	public:
+		sequencer(float tempo = 120.0f, int beats = 4, int subbeats = 4)
+		{
+			nBeats = beats;
+			nSubBeats = subbeats;
+			fTempo = tempo;
+			fBeatTime = (60.0f / fTempo) / (float)nSubBeats;
+			nCurrentBeat = 0;
+			nTotalBeats = nSubBeats * nBeats;
+			fAccumulate = 0;
+			vecNotes.reserve(64);
+		}
+
+
+		int Update(FTYPE fElapsedTime)
+		{
+			vecNotes.clear();
+
+			fAccumulate += fElapsedTime;
+			while (fAccumulate >= fBeatTime)
+			{
+				fAccumulate -= fBeatTime;
+				nCurrentBeat++;
+
+				if (nCurrentBeat >= nTotalBeats)
+					nCurrentBeat = 0;
+
+				int c = 0;
+				for (auto& v : vecChannel)
+				{
+					if (v.sBeat[nCurrentBeat] == L'X')
+					{
+						note n;
+						n.channel = vecChannel[c].instrument;
+						n.active = true;
+						n.id = 64;
+						vecNotes.push_back(n);
+					}
+					c++;
+				}
+			}
+
+
+
+			return vecNotes.size();
+		}
+
+		void AddInstrument(instrument_base* inst)
+		{
+			channel c;
+			c.instrument = inst;
+			vecChannel.push_back(c);
+		}
+
+	public:
+		int nBeats;
+		int nSubBeats;
+		FTYPE fTempo;
+		FTYPE fBeatTime;
+		FTYPE fAccumulate;
+		int nCurrentBeat;
+		int nTotalBeats;
+
+	public:
+		vector<channel> vecChannel;
+		vector<note> vecNotes;
+
+
+	private:
+
+	};
+
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Engine
+
+	typedef bool(*lambda)(synth::note const& item);
+	template<class T>
+	void safe_remove(T& v, lambda f)
+	{
+		auto n = v.begin();
+		while (n != v.end())
+			if (!f(*n))
+				n = v.erase(n);
+			else
+				++n;
+	}
+
+	const int EVENT_NOTE_ON = 0;
+	const int EVENT_NOTE_OFF = 1;
+	const int EVENT_TRIGGER = 2;
+
+	// A song_score made ready to play. Each pattern, at the tempo each play of
+	// it asks for, becomes a clip: its events as sample offsets from the start,
+	// sorted once here. Playing only walks a cursor through the clips of the
+	// chain, so a block costs the events in it and never allocates. The song
+	// starts at clock sample 0 and loops.
+	class arrangement
+	{
+	public:
+		struct event
+		{
+			uint32_t nOffset;	// Samples from the start of the clip
+			int nType;			// EVENT_NOTE_ON...
+			int nNoteID;
+			float fVelocity;
+			instrument_base* pInstrument;
+		};
+
+		// FindInstrument maps a row's instrument name to the instrument, or nullptr
+		template <class F>
+		bool Compile(const song_score& score, F FindInstrument, FTYPE dSampleRate, string& sError)
+		{
+			*this = arrangement();
+			for (const song_play& play : score.vecChain)
+			{
+				// Plays of the same pattern at the same tempo share a clip
+				size_t c = 0;
+				while (c < m_vecClips.size() && !(m_vecClips[c].nPattern == play.nPattern && m_vecClips[c].dTempo == play.dTempo && m_vecClips[c].nSubBeats == play.nSubBeats))
+					c++;
+				if (c == m_vecClips.size())
+				{
+					const song_pattern& p = score.vecPatterns[play.nPattern];
+					clip k;
+					k.nPattern = play.nPattern;
+					k.dTempo = play.dTempo;
+					k.nSubBeats = play.nSubBeats;
+					k.nFirst = m_vecEvents.size();
+					if (!CompilePattern(p, FindInstrument, dSampleRate * 60.0 / (play.dTempo * play.nSubBeats), k.nLength, sError))
+					{
+						*this = arrangement();
+						return false;
+					}
+					k.nCount = m_vecEvents.size() - k.nFirst;
+					m_vecClips.push_back(k);
+					m_vecNames.push_back(p.sName);
+				}
+				m_vecChain.push_back({ c, play.nTimes });
+			}
+			return true;
+		}
+
+		bool Empty() const { return m_vecChain.empty(); }
+
+		// Audio thread: calls Apply(event, clock sample) for every event from
+		// nFrom for nFrames, in time order. Blocks must follow on from each other.
+		template <class F>
+		void Events(uint64_t nFrom, unsigned int nFrames, F Apply)
+		{
+			if (m_vecChain.empty())
+				return;
+			uint64_t nEnd = nFrom + nFrames;
+			while (true)
+			{
+				const clip& k = m_vecClips[m_vecChain[m_nEntry].nClip];
+				const event* pEvents = &m_vecEvents[k.nFirst];
+				for (; m_nEvent < k.nCount && m_nClipStart + pEvents[m_nEvent].nOffset < nEnd; m_nEvent++)
+					Apply(pEvents[m_nEvent], m_nClipStart + pEvents[m_nEvent].nOffset);
+				if (m_nClipStart + k.nLength > nEnd)
+					break;
+
+				// On to the next play of the clip, or the next clip
+				m_nClipStart += k.nLength;
+				m_nEvent = 0;
+				if (++m_nRepeat >= m_vecChain[m_nEntry].nTimes)
+				{
+					m_nRepeat = 0;
+					m_nEntry = (m_nEntry + 1) % m_vecChain.size();
+				}
+			}
+		}
+
+		// Of the chain entry playing, audio thread only
+		FTYPE Tempo() const { return m_vecChain.empty() ? 0.0 : m_vecClips[m_vecChain[m_nEntry].nClip].dTempo; }
+		int Entry() const { return (int)m_nEntry; }
+
+		// Pattern name of a chain entry
+		const string& Name(int nEntry) const { return m_vecNames[m_vecChain[nEntry].nClip]; }
+		int Entries() const { return (int)m_vecChain.size(); }
+
+	private:
+		struct clip
+		{
+			int nPattern = 0;
+			FTYPE dTempo = 0.0;
+			int nSubBeats = 0;
+			size_t nFirst = 0, nCount = 0;	// In m_vecEvents
+			uint64_t nLength = 1;			// Samples
+		};
+
+		struct entry
+		{
+			size_t nClip;
+			int nTimes;
+		};
+
+		vector<event> m_vecEvents;
+		vector<clip> m_vecClips;
+		vector<string> m_vecNames;			// Per clip
+		vector<entry> m_vecChain;
+
+		// Playback cursor
+		size_t m_nEntry = 0;
+		int m_nRepeat = 0;
+		size_t m_nEvent = 0;
+		uint64_t m_nClipStart = 0;
+
+		// Appends a pattern's events with steps dStep samples long
+		template <class F>
+		bool CompilePattern(const song_pattern& p, F FindInstrument, FTYPE dStep, uint64_t& nLength, string& sError)
+		{
+			nLength = max((uint64_t)llround(p.nSteps * dStep), (uint64_t)1);
+			auto StepStart = [&](int s) { return (uint64_t)llround((s + (s % 2 ? p.dSwing : 0.0)) * dStep); };
+
+			size_t nFirst = m_vecEvents.size();
+			for (const song_row& row : p.vecRows)
+			{
+				instrument_base* pInstrument = FindInstrument(row.sInstrument);
+				if (pInstrument == nullptr)
+				{
+					sError = "pattern '" + p.sName + "': no instrument '" + row.sInstrument + "'";
+					return false;
+				}
+
+				for (int s = 0; s < p.nSteps; s++)
+				{
+					const song_step& step = row.vecSteps[s];
+					if (step.nNote < 0)
+						continue;
+					uint64_t nOn = min(StepStart(s), nLength - 1);
+					if (step.fLength <= 0.0f)
+					{
+						m_vecEvents.push_back({ (uint32_t)nOn, EVENT_TRIGGER, step.nNote, step.fVelocity, pInstrument });
+						continue;
+					}
+
+					// Held until its length is up, the pattern ends or the row plays the note again
+					uint64_t nOff = (uint64_t)llround((s + (s % 2 ? p.dSwing : 0.0) + step.fLength) * dStep);
+					nOff = min(nOff, nLength - 1);
+					for (int t = s + 1; t < p.nSteps; t++)
+						if (row.vecSteps[t].nNote == step.nNote)
+						{
+							nOff = min(nOff, StepStart(t));
+							break;
+						}
+					if (nOff <= nOn)
+						continue;
+					m_vecEvents.push_back({ (uint32_t)nOn, EVENT_NOTE_ON, step.nNote, step.fVelocity, pInstrument });
+					m_vecEvents.push_back({ (uint32_t)nOff, EVENT_NOTE_OFF, step.nNote, step.fVelocity, pInstrument });
+				}
+			}
+
+			// Releases first on a shared sample, so a note played again restarts
+			stable_sort(m_vecEvents.begin() + nFirst, m_vecEvents.end(), [](const event& a, const event& b)
+			{
+				return a.nOffset != b.nOffset ? a.nOffset < b.nOffset : (a.nType == EVENT_NOTE_OFF) > (b.nType == EVENT_NOTE_OFF);
+			});
+			return true;
+		}
+	};
+
+	// One complete, self-contained synthesizer. It owns its playing notes, its
+	// instruments, its sequencer and its clock, so any number of engines can run
+	// side by side without sharing anything. Hand it to olcNoiseMaker::SetUserSource()
+	// or call ProcessBlock() directly to render.
+	//
+	// Only the render thread touches the playing notes. Other threads send note
+	// events through a lock-free queue, which ProcessBlock() applies at the start
+	// of the next block, so rendering never locks or allocates.
+	class engine : public olcNoiseSource
+	{
+	public:
+		// What the engine was doing at the end of its last block
+		struct snapshot
+		{
+			FTYPE dTime = 0.0;
+			size_t nNotes = 0;
+			int nCurrentBeat = 0;
+			int nSongEntry = -1;		// Chain entry of the song playing, -1 without one
+			uint64_t nLateEvents = 0;	// Events that arrived after their time had been rendered
+		};
+
+	public:
+		engine(unsigned int nSampleRate = 44100, size_t nMaxNotes = 1024)
+		{
+			m_dTimeStep = 1.0 / (FTYPE)nSampleRate;
+			m_nClock = 0;
+			m_nNoteCount = 0;
+			vecNotes.reserve(nMaxNotes);
+			m_vecLaneNotes.assign(nMaxNotes, nullptr);
+			instSupersaw.dSampleRate = (FTYPE)nSampleRate;
+			instSampler.dSampleRate = (FTYPE)nSampleRate;
+			instFM.dSampleRate = (FTYPE)nSampleRate;
+			instAnalog.dSampleRate = (FTYPE)nSampleRate;
+			instPatch.dSampleRate = (FTYPE)nSampleRate;
+			m_vecPending.reserve(MAX_PENDING_EVENTS);
+			m_vecDue.reserve(MAX_PENDING_EVENTS);
+			m_vecSongDue.reserve(MAX_PENDING_EVENTS);
+
+			fx.Create((FTYPE)nSampleRate, MAX_BLOCK_FRAMES);
+			m_vecDry.assign(MAX_BLOCK_FRAMES, 0.0);
+			m_vecLanes.assign(MAX_BLOCK_FRAMES, 0.0);
+			for (int s = 0; s < SEND_COUNT; s++)
+			{
+				m_vecSend[s].assign(MAX_BLOCK_FRAMES, 0.0);
+				m_pSend[s] = m_vecSend[s].data();
+			}
+		}
+
+		// Longest stretch rendered in one go, longer blocks are split
+		static constexpr unsigned int MAX_BLOCK_FRAMES = 1024;
+
+		// Events scheduled ahead that can wait at once
+		static const size_t MAX_PENDING_EVENTS = 4096;
+
+	public:
+		instrument_bell instBell;
+		instrument_bell8 instBell8;
+		instrument_harmonica instHarm;
+		instrument_drumkick instKick;
+		instrument_drumsnare instSnare;
+		instrument_drumhihat instHiHat;
+		instrument_supersaw instSupersaw;
+		instrument_sampler instSampler;
+		instrument_fm instFM;
+		instrument_analog instAnalog;
+		instrument_patch instPatch;
+
+		sequencer seq;
+		arrangement song;	// Plays alongside the sequencer, set it up with LoadSong()
+		effects_bus fx;
+		bool bVoiceLanes = true;	// Render instruments that have voice lanes through them
+
+	public:
+		// Instruments by a fixed index, which performance logs store
+		static const int INSTRUMENT_COUNT = 11;
+
+		instrument_base* Instrument(int nIndex)
+		{
+			switch (nIndex)
+			{
+			case 0: return &instBell;
+			case 1: return &instBell8;
+			case 2: return &instHarm;
+			case 3: return &instKick;
+			case 4: return &instSnare;
+			case 5: return &instHiHat;
+			case 6: return &instSupersaw;
+			case 7: return &instSampler;
+			case 8: return &instFM;
+			case 9: return &instAnalog;
+			case 10: return &instPatch;
+			default: return nullptr;
+			}
+		}
+
+		static const char* InstrumentName(int nIndex)
+		{
+			static const char* sNames[INSTRUMENT_COUNT] = { "bell", "bell8", "harmonica", "kick", "snare", "hihat", "supersaw", "sampler", "fm", "analog", "patch" };
+			return nIndex >= 0 && nIndex < INSTRUMENT_COUNT ? sNames[nIndex] : nullptr;
+		}
+
+		// -1 if it is not one of this engine's
+		int InstrumentIndex(const instrument_base* pInstrument)
+		{
+			for (int i = 0; i < INSTRUMENT_COUNT; i++)
+				if (Instrument(i) == pInstrument)
+					return i;
+			return -1;
+		}
+
+		// Returns this engine's instrument for a short name, or nullptr if unknown.
+		// Never allocates, so it is safe on the audio and network threads.
+		instrument_base* FindInstrument(const char* sName)
+		{
+			for (int i = 0; i < INSTRUMENT_COUNT; i++)
+				if (strcmp(sName, InstrumentName(i)) == 0)
+					return Instrument(i);
+			return nullptr;
+		}
+
+		instrument_base* FindInstrument(const string& sName)
+		{
+			return FindInstrument(sName.c_str());
+		}
+
+		// Time of the next sample to be rendered. The clock starts one sample in,
+		// a note switched on at exactly 0.0 would otherwise look released (notes
+		// are held while on > off).
+		FTYPE GetTime()
+		{
+			return (FTYPE)(m_nClock + 1) * m_dTimeStep;
+		}
+
+		// Playing notes as of the last rendered block
+		size_t GetNoteCount()
+		{
+			return m_nNoteCount;
+		}
+
+		// Lock-free view of the engine for one reader thread, such as the UI
+		const snapshot& GetSnapshot()
+		{
+			return m_snapshot.Read();
+		}
+
+		// Note events take effect at engine time dWhen (see GetTime()), to the
+		// sample. Zero, or a time already rendered, means the next block.
+
+		// Starts a note, or restarts it if it is still releasing
+		bool NoteOn(int nNoteID, instrument_base* pInstrument, FTYPE dWhen = 0.0)
+		{
+			return queEvents.push({ EVENT_NOTE_ON, nNoteID, pInstrument, SampleAt(dWhen), 0 });
+		}
+
+		// Releases a held note
+		bool NoteOff(int nNoteID, instrument_base* pInstrument, FTYPE dWhen = 0.0)
+		{
+			return queEvents.push({ EVENT_NOTE_OFF, nNoteID, pInstrument, SampleAt(dWhen), 0 });
+		}
+
+		// Starts a new note regardless of what is already playing (drum hits)
+		bool Trigger(int nNoteID, instrument_base* pInstrument, FTYPE dWhen = 0.0)
+		{
+			return queEvents.push({ EVENT_TRIGGER, nNoteID, pInstrument, SampleAt(dWhen), 0 });
+		}
+
+		// Any of the above at an exact clock sample, for replaying a performance log
+		bool PostEvent(int nType, int nNoteID, instrument_base* pInstrument, uint64_t nSample)
+		{
+			return queEvents.push({ nType, nNoteID, pInstrument, nSample, 0 });
+		}
+
+		// Compiles a song against this engine's instruments, to play from the
+		// first block. Load it before rendering starts.
+		bool LoadSong(const song_score& score, string& sError)
+		{
+			return song.Compile(score, [&](const string& sName) { return FindInstrument(sName); }, 1.0 / m_dTimeStep, sError);
+		}
+
+		// Logs every queued note event as it is applied, and the block sizes, so
+		// the session can be replayed. nullptr stops logging. Set it before
+		// rendering starts, the audio thread reads it without a lock.
+		void SetLog(performance_log* pLog)
+		{
+			m_pLog = pLog;
+		}
+
+		// Renders the next block and advances the clock
+		virtual void ProcessBlock(FTYPE* pBuffer, unsigned int nFrames, unsigned int nChannels)
+		{
+			rt::scope realtime;
+			FTYPE dBlockTime = GetTime();
+			uint64_t nBlockStart = m_nClock;
+			bool bLog = m_pLog != nullptr && m_pLog->IsRecording();
+			if (bLog)
+				m_pLog->Block(nBlockStart, nFrames);
+
+			// Note events sent since the last block wait until they are due. If
+			// too many are waiting the newcomer plays now rather than never.
+			note_event ev;
+			while (queEvents.pop(ev))
+			{
+				if (ev.nSample != 0 && ev.nSample < nBlockStart)
+					m_nLateEvents++;
+				ev.nOrder = m_nEventOrder++;
+				if (m_vecPending.size() < m_vecPending.capacity())
+					m_vecPending.push_back(ev);
+				else
+					ApplyQueued(ev, nBlockStart, dBlockTime, bLog);
+			}
+
+			// The ones due in this block, in time order
+			m_vecDue.clear();
+			for (size_t i = 0; i < m_vecPending.size(); )
+			{
+				if (m_vecPending[i].nSample < nBlockStart + nFrames)
+				{
+					m_vecDue.push_back(m_vecPending[i]);
+					m_vecPending[i] = m_vecPending.back();
+					m_vecPending.pop_back();
+				}
+				else
+					i++;
+			}
+			sort(m_vecDue.begin(), m_vecDue.end(), [](const note_event& a, const note_event& b)
+			{
+				return a.nSample != b.nSample ? a.nSample < b.nSample : a.nOrder < b.nOrder;
+			});
+
+			// Sequencer (generates notes, note offs applied by note lifespan)
+			int nNewNotes = seq.Update(nFrames * m_dTimeStep);
+			for (int a = 0; a < nNewNotes; a++)
+				ApplyEvent({ EVENT_TRIGGER, seq.vecNotes[a].id, seq.vecNotes[a].channel, 0, 0 }, dBlockTime);
+
+			// Song events in this block, already in time order. They are not
+			// logged, a replaying engine with the same song plays them itself.
+			m_vecSongDue.clear();
+			song.Events(nBlockStart, nFrames, [&](const arrangement::event& e, uint64_t nSample)
+			{
+				note_event ev = { e.nType, e.nNoteID, e.pInstrument, nSample, 0, e.fVelocity };
+				if (m_vecSongDue.size() < m_vecSongDue.capacity())
+					m_vecSongDue.push_back(ev);
+				else
+					ApplyEvent(ev, dBlockTime);
+			});
+
+			fx.delay.SetTempo(song.Empty() ? seq.fTempo : song.Tempo());
+
+			// Notes into the dry and send buses, then the effects into the output.
+			// Rendering stops at every due event so it lands on its own sample.
+			size_t nNextDue = 0, nNextSong = 0;
+			for (unsigned int nDone = 0; nDone < nFrames; )
+			{
+				while (nNextDue < m_vecDue.size() && m_vecDue[nNextDue].nSample <= nBlockStart + nDone)
+					ApplyQueued(m_vecDue[nNextDue++], nBlockStart + nDone, dBlockTime + nDone * m_dTimeStep, bLog);
+				while (nNextSong < m_vecSongDue.size() && m_vecSongDue[nNextSong].nSample <= nBlockStart + nDone)
+					ApplyEvent(m_vecSongDue[nNextSong++], dBlockTime + nDone * m_dTimeStep);
+
+				unsigned int nChunk = min(nFrames - nDone, MAX_BLOCK_FRAMES);
+				if (nNextDue < m_vecDue.size())
+					nChunk = min(nChunk, (unsigned int)(m_vecDue[nNextDue].nSample - nBlockStart - nDone));
+				if (nNextSong < m_vecSongDue.size())
+					nChunk = min(nChunk, (unsigned int)(m_vecSongDue[nNextSong].nSample - nBlockStart - nDone));
+				bool bVoices = MakeNoise(dBlockTime + nDone * m_dTimeStep, nChunk);
+				fx.Process(m_vecDry.data(), m_pSend, pBuffer + nDone * nChannels, nChunk, nChannels, !bVoices);
+				nDone += nChunk;
+			}
+			instPatch.BlockDone();
+
+			// Woah! Modern C++ Overload!!! Remove notes which are now inactive
+			safe_remove<vector<note>>(vecNotes, [](note const& item) { return item.active; });
+			m_nNoteCount = vecNotes.size();
+			m_nClock += nFrames;
+
+			snapshot& s = m_snapshot.Back();
+			s.dTime = GetTime();
+			s.nNotes = vecNotes.size();
+			s.nCurrentBeat = seq.nCurrentBeat;
+			s.nSongEntry = song.Empty() ? -1 : song.Entry();
+			s.nLateEvents = m_nLateEvents;
+			m_snapshot.Publish();
+		}
+
+	private:
+		struct note_event
+		{
+			int nType;
+			int nNoteID;
+			instrument_base* pInstrument;
+			uint64_t nSample;	// Clock sample it takes effect at, 0 for the next block
+			uint64_t nOrder;	// Arrival order, for events on the same sample
+			float fVelocity = 1.0f;
+		};
+
+		uint64_t SampleAt(FTYPE dWhen)
+		{
+			return dWhen > 0.0 ? (uint64_t)llround(dWhen / m_dTimeStep) - 1 : 0;
+		}
+
+		// An event from the queue, logged at the sample it lands on
+		void ApplyQueued(const note_event& ev, uint64_t nSample, FTYPE dTime, bool bLog)
+		{
+			if (bLog)
+			{
+				log_record r;
+				r.nSample = nSample;
+				r.nType = (uint8_t)ev.nType;
+				r.nInstrument = (uint8_t)InstrumentIndex(ev.pInstrument);
+				r.nNoteID = ev.nNoteID;
+				m_pLog->Record(r);
+			}
+			ApplyEvent(ev, dTime);
+		}
+
+		void ApplyEvent(const note_event& ev, FTYPE dTime)
+		{
+			auto noteFound = vecNotes.end();
+			if (ev.nType != EVENT_TRIGGER)
+				noteFound = find_if(vecNotes.begin(), vecNotes.end(), [&](note const& item) { return item.id == ev.nNoteID && item.channel == ev.pInstrument; });
+
+			if (ev.nType == EVENT_NOTE_OFF)
+			{
+				if (noteFound != vecNotes.end() && noteFound->off < noteFound->on)
+					noteFound->off = dTime;
+			}
+			else if (noteFound != vecNotes.end())
+			{
+				// Pressed again during release phase
+				if (noteFound->off > noteFound->on)
+				{
+					noteFound->on = dTime;
+					noteFound->active = true;
+					noteFound->velocity = ev.fVelocity;
+				}
+			}
+			else if (vecNotes.size() < vecNotes.capacity()) // Growing would allocate, so drop the note
+			{
+				note n;
+				n.id = ev.nNoteID;
+				n.on = dTime;
+				n.active = true;
+				n.channel = ev.pInstrument;
+				n.velocity = ev.fVelocity;
+				vecNotes.emplace_back(n);
+			}
+		}
+
+		// Mixes nFrames of every active note into the dry and send buses. Returns
+		// false, leaving the buses silent, when no note is playing.
+		bool MakeNoise(FTYPE dStartTime, unsigned int nFrames)
+		{
+			memset(m_vecDry.data(), 0, nFrames * sizeof(FTYPE));
+			for (int s = 0; s < SEND_COUNT; s++)
+				memset(m_vecSend[s].data(), 0, nFrames * sizeof(FTYPE));
+
+			if (none_of(vecNotes.begin(), vecNotes.end(), [](note const& item) { return item.active && item.channel != nullptr; }))
+				return false;
+
+			// Instruments with voice lanes render all of their notes together
+			size_t nLaneNotes = 0;
+			if (bVoiceLanes)
+			{
+				for (auto& n : vecNotes)
+					if (n.active && n.channel != nullptr && n.channel->has_lanes())
+						m_vecLaneNotes[nLaneNotes++] = &n;
+				sort(m_vecLaneNotes.begin(), m_vecLaneNotes.begin() + nLaneNotes, [](note* a, note* b) { return less<instrument_base*>()(a->channel, b->channel); });
+
+				for (size_t i = 0; i < nLaneNotes; )
+				{
+					instrument_base* pInstrument = m_vecLaneNotes[i]->channel;
+					size_t j = i;
+					while (j < nLaneNotes && m_vecLaneNotes[j]->channel == pInstrument)
+						j++;
+
+					memset(m_vecLanes.data(), 0, nFrames * sizeof(FTYPE));
+					pInstrument->sound_lanes(&m_vecLaneNotes[i], j - i, dStartTime, m_dTimeStep, nFrames, m_vecLanes.data());
+					for (unsigned int f = 0; f < nFrames; f++)
+					{
+						m_vecDry[f] += m_vecLanes[f];
+						for (int s = 0; s < SEND_COUNT; s++)
+							m_vecSend[s][f] += m_vecLanes[f] * pInstrument->dSend[s];
+					}
+					i = j;
+				}
+			}
+
+			if ((ptrdiff_t)nLaneNotes == count_if(vecNotes.begin(), vecNotes.end(), [](note const& item) { return item.active && item.channel != nullptr; }))
+				return true;
+
+			for (unsigned int f = 0; f < nFrames; f++)
+			{
+				FTYPE dTime = dStartTime + f * m_dTimeStep;
+
+				// Iterate through all active notes, and mix together
+				for (auto& n : vecNotes)
+				{
+					if (!n.active || n.channel == nullptr || (bVoiceLanes && n.channel->has_lanes()))
+						continue;
+
+					// Get sample for this note by using the correct instrument and envelope
+					bool bNoteFinished = false;
+					FTYPE dSound = n.channel->sound(dTime, n, bNoteFinished) * n.velocity;
+
+					// Mix into output, and into the effects the instrument sends to
+					m_vecDry[f] += dSound;
+					for (int s = 0; s < SEND_COUNT; s++)
+						m_vecSend[s][f] += dSound * n.channel->dSend[s];
+
+					if (bNoteFinished) // Flag note to be removed
+						n.active = false;
+				}
+			}
+			return true;
+		}
+
+	private:
+		vector<note> vecNotes;
+		rt::queue<note_event, 1024> queEvents;
+		vector<note_event> m_vecPending;	// Received, not yet due
+		vector<note_event> m_vecDue;		// Due in the block being rendered
+		vector<note_event> m_vecSongDue;	// From the song, in the block being rendered
+		uint64_t m_nEventOrder = 0;
+		uint64_t m_nLateEvents = 0;
+		FTYPE m_dTimeStep;
+		atomic<uint64_t> m_nClock;
+		atomic<size_t> m_nNoteCount;
+		rt::triple_buffer<snapshot> m_snapshot;
+		performance_log* m_pLog = nullptr;
+
+		vector<FTYPE> m_vecDry;
+		vector<FTYPE> m_vecLanes;			// One lane instrument's notes
+		vector<note*> m_vecLaneNotes;		// Notes for lane instruments, grouped by instrument
+		vector<FTYPE> m_vecSend[SEND_COUNT];
+		FTYPE* m_pSend[SEND_COUNT];
+	};
+
+	// Throughput of supersaw chords rendered one voice at a time against voice
+	// lanes, and how far apart the two renders are
+	inline int BenchmarkVoices(FTYPE dSeconds = 5.0)
+	{
+		cout << "Supersaw, " << instrument_supersaw::UNISON << " saws per note, " << SYNTH_LANES << " lanes, " << dSeconds << "s per run" << endl;
+		for (int nChord : { 1, 4, 16, 64 })
+		{
+			double dWall[2] = { 0.0, 0.0 };
+			vector<FTYPE> vecOut[2];
+			for (int bLanes = 0; bLanes < 2; bLanes++)
+			{
+				engine e(44100);
+				e.bVoiceLanes = bLanes != 0;
+				for (int n = 0; n < nChord; n++)
+					e.NoteOn(40 + n, &e.instSupersaw);
+
+				size_t nBlocks = (size_t)(dSeconds * 44100.0 / 256);
+				vecOut[bLanes].assign(nBlocks * 256, 0.0);
+				auto tStart = chrono::steady_clock::now();
+				for (size_t b = 0; b < nBlocks; b++)
+					e.ProcessBlock(&vecOut[bLanes][b * 256], 256, 1);
+				dWall[bLanes] = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+			}
+
+			FTYPE dDiff = 0.0, dPeak = 0.0;
+			for (size_t i = 0; i < vecOut[0].size(); i++)
+			{
+				dDiff = max(dDiff, fabs(vecOut[0][i] - vecOut[1][i]));
+				dPeak = max(dPeak, fabs(vecOut[0][i]));
+			}
+
+			cout << fixed << setprecision(1)
+				<< "  " << setw(2) << nChord << " notes  scalar " << setw(7) << nChord * dSeconds / dWall[0] << " voices/core"
+				<< "  lanes " << setw(7) << nChord * dSeconds / dWall[1] << " voices/core"
+				<< "  x" << setprecision(2) << dWall[0] / dWall[1]
+				<< "  difference " << setprecision(1) << 20.0 * log10(max(dDiff, (FTYPE)1e-12) / max(dPeak, (FTYPE)1e-9)) << "dB" << endl;
+		}
+		return 0;
+	}
+
+	// Load time and resident memory of a sample library, then resident memory
+	// and underruns while chords play at real time pace, as behind a sound card
+	inline int BenchmarkSampler(const string& sFile, FTYPE dSeconds = 5.0)
+	{
+		const double MB = 1024.0 * 1024.0;
+		size_t nStartBytes = ResidentBytes();
+		engine e(44100);
+
+		string sError;
+		auto tLoad = chrono::steady_clock::now();
+		if (!e.instSampler.Load(sFile, sError))
+		{
+			cerr << "Sampler: " << sError << endl;
+			return 1;
+		}
+		double dLoad = chrono::duration<double>(chrono::steady_clock::now() - tLoad).count();
+		size_t nLoadedBytes = ResidentBytes();
+
+		cout << fixed << setprecision(1)
+			<< e.instSampler.Samples() << " samples, " << e.instSampler.LibraryBytes() / MB << "MB on disk" << endl
+			<< "  load " << dLoad * 1000.0 << "ms, resident +" << (nLoadedBytes - nStartBytes) / MB << "MB" << endl;
+
+		// Eight note chords every half second, spread over the keyboard
+		const unsigned int nBlock = 256;
+		size_t nBlocks = (size_t)(dSeconds * 44100.0 / nBlock);
+		size_t nChordBlocks = (size_t)(0.5 * 44100.0 / nBlock);
+		vector<FTYPE> vecOut(nBlock);
+		size_t nPeakBytes = nLoadedBytes;
+		int nChord[8] = { 0 };
+		uint32_t nRandom = 12345;
+
+		auto tStart = chrono::steady_clock::now();
+		for (size_t b = 0; b < nBlocks; b++)
+		{
+			if (b % nChordBlocks == 0)
+			{
+				for (int& n : nChord)
+				{
+					e.NoteOff(n, &e.instSampler);
+					nRandom = nRandom * 1664525u + 1013904223u;
+					n = 36 + (int)(nRandom >> 16) % 60;
+					e.NoteOn(n, &e.instSampler);
+				}
+			}
+			e.ProcessBlock(vecOut.data(), nBlock, 1);
+			if (b % 16 == 0)
+				nPeakBytes = max(nPeakBytes, ResidentBytes());
+			this_thread::sleep_until(tStart + chrono::microseconds((long long)((b + 1) * nBlock * 1000000.0 / 44100.0)));
+		}
+
+		cout << "  playing " << dSeconds << "s: resident +" << (nPeakBytes - nStartBytes) / MB << "MB at peak, "
+			<< e.instSampler.Underruns() << " frames underrun" << endl;
+		return 0;
+	}
+
+	// Holds nNotes notes of an instrument for dSeconds and prints what each costs
+	inline void MeasureVoices(engine& e, instrument_base* pInstrument, const char* sName, int nNotes, FTYPE dSeconds)
+	{
+		for (int n = 0; n < nNotes; n++)
+			e.NoteOn(40 + n, pInstrument);
+
+		size_t nBlocks = (size_t)(dSeconds * 44100.0 / 256);
+		vector<FTYPE> vecOut(256);
+		auto tStart = chrono::steady_clock::now();
+		for (size_t b = 0; b < nBlocks; b++)
+			e.ProcessBlock(vecOut.data(), 256, 1);
+		double dWall = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+
+		cout << fixed << setprecision(1) << "  " << left << setw(18) << sName << right
+			<< setw(8) << nNotes * dSeconds / dWall << " voices/core, "
+			<< setprecision(1) << dWall * 1e9 / (nNotes * nBlocks * 256.0) << "ns per voice sample" << endl;
+	}
+
+	// Cost of a held FM voice against the three oscillator bell it can stand in for
+	inline int BenchmarkFM(FTYPE dSeconds = 5.0)
+	{
+		const int nNotes = 16;
+		cout << nNotes << " held notes, " << dSeconds << "s per run" << endl;
+
+		for (int nCase = 0; nCase < 4; nCase++)
+		{
+			engine e(44100);
+			instrument_base* pInstrument = &e.instFM;
+			const char* sName = "";
+			switch (nCase)
+			{
+			case 0: pInstrument = &e.instBell; sName = "bell, 3 osc"; break;
+			case 1: sName = "fm, 4 operators"; break;
+			case 2: e.instFM.algorithm = fm_algorithm::Stack(6); sName = "fm, 6 operators"; break;
+			case 3: e.instFM.algorithm = fm_algorithm::Stack(6); e.bVoiceLanes = false; sName = "fm, 6 per sample"; break;
+			}
+
+			// Sustain everything so no note finishes early
+			pInstrument->env.dSustainAmplitude = 1.0;
+			for (auto& o : e.instFM.op)
+			{
+				o.Set(o.dRatio, o.dLevel, o.env.dAttackTime, o.env.dDecayTime, 1.0, o.env.dReleaseTime);
+				o.dLevel = max(o.dLevel, (FTYPE)0.5);
+			}
+			MeasureVoices(e, pInstrument, sName, nNotes, dSeconds);
+		}
+		return 0;
+	}
+
+	// Cost of a filtered analog voice against the harmonica's pile of oscillators
+	inline int BenchmarkFilters(FTYPE dSeconds = 5.0)
+	{
+		const int nNotes = 16;
+		cout << nNotes << " held notes, " << dSeconds << "s per run" << endl;
+
+		for (int nCase = 0; nCase < 4; nCase++)
+		{
+			engine e(44100);
+			instrument_base* pInstrument = &e.instAnalog;
+			const char* sName = "";
+			switch (nCase)
+			{
+			case 0: pInstrument = &e.instHarm; sName = "harmonica"; break;
+			case 1: sName = "analog, ladder"; break;
+			case 2: e.instAnalog.nFilter = FILTER_LOW_PASS; sName = "analog, svf"; break;
+			case 3: e.bVoiceLanes = false; sName = "analog, per sample"; break;
+			}
+			MeasureVoices(e, pInstrument, sName, nNotes, dSeconds);
+		}
+		return 0;
+	}
+
+	// Patches against the instruments they were written from, and what a
+	// reload costs the notes playing through it
+	inline int BenchmarkPatch(FTYPE dSeconds = 5.0)
+	{
+		const char* sNames[] = { "bell", "bell8", "harmonica", "kick", "snare", "hihat" };
+		const char* sPatches[] = { PATCH_BELL, PATCH_BELL8, PATCH_HARMONICA, PATCH_KICK, PATCH_SNARE, PATCH_HIHAT };
+
+		// Noise never lines up between the two, so those differ by the noise
+		cout << "Against the hard coded instruments, one note held 0.5s then released" << endl;
+		for (int i = 0; i < 6; i++)
+		{
+			vector<FTYPE> vecOut[2];
+			for (int nPath = 0; nPath < 2; nPath++)
+			{
+				engine e(44100);
+				string sError;
+				if (nPath == 1 && !e.instPatch.Compile(sPatches[i], sNames[i], sError))
+				{
+					cerr << sError << endl;
+					return 1;
+				}
+				instrument_base* pInstrument = nPath == 1 ? &e.instPatch : e.FindInstrument(sNames[i]);
+				e.NoteOn(64, pInstrument);
+				e.NoteOff(64, pInstrument, 0.5);
+				vecOut[nPath].assign(2 * 44100, 0.0);
+				for (size_t n = 0; n < vecOut[nPath].size(); n += 256)
+					e.ProcessBlock(&vecOut[nPath][n], (unsigned int)min((size_t)256, vecOut[nPath].size() - n), 1);
+			}
+
+			FTYPE dPeak = 0.0, dSignal = 0.0, dError = 0.0;
+			for (size_t n = 0; n < vecOut[0].size(); n++)
+			{
+				FTYPE d = vecOut[1][n] - vecOut[0][n];
+				dPeak = max(dPeak, fabs(d));
+				dSignal += vecOut[0][n] * vecOut[0][n];
+				dError += d * d;
+			}
+			cout << fixed << setprecision(4) << "  " << left << setw(10) << sNames[i] << right
+				<< "peak error " << dPeak << ", SNR " << setprecision(1) << 10.0 * log10(dSignal / max(dError, 1e-30)) << "dB" << endl;
+		}
+
+		const int nNotes = 16;
+		cout << nNotes << " held notes, " << dSeconds << "s per run" << endl;
+		for (int nCase = 0; nCase < 4; nCase++)
+		{
+			engine e(44100);
+			string sError;
+			e.instPatch.Compile(nCase < 2 ? PATCH_BELL8 : PATCH_HARMONICA, "patch", sError);
+			switch (nCase)
+			{
+			case 0: MeasureVoices(e, &e.instBell8, "bell8", nNotes, dSeconds); break;
+			case 1: MeasureVoices(e, &e.instPatch, "bell8, patch", nNotes, dSeconds); break;
+			case 2: MeasureVoices(e, &e.instHarm, "harmonica", nNotes, dSeconds); break;
+			case 3: MeasureVoices(e, &e.instPatch, "harmonica, patch", nNotes, dSeconds); break;
+			}
+		}
+
+		// Swapping patches as fast as they compile while the notes play
+		engine e(44100);
+		for (int n = 0; n < nNotes; n++)
+			e.NoteOn(40 + n, &e.instPatch);
+		atomic<bool> bRunning{ true };
+		thread control([&]()
+		{
+			string sError;
+			for (int n = 0; bRunning; n++)
+				e.instPatch.Compile(n % 2 ? PATCH_HARMONICA : PATCH_BELL8, "patch", sError);
+		});
+
+		vector<FTYPE> vecOut(256);
+		FTYPE dPeak = 0.0;
+		size_t nBlocks = (size_t)(44100.0 / 256);
+		for (size_t b = 0; b < nBlocks; b++)
+		{
+			e.ProcessBlock(vecOut.data(), 256, 1);
+			for (FTYPE d : vecOut)
+				dPeak = max(dPeak, fabs(d));
+		}
+		bRunning = false;
+		control.join();
+		cout << "Reloaded " << e.instPatch.Loads() << " times over 1s of audio, " << e.GetSnapshot().nNotes << " notes still playing, peak "
+			<< setprecision(2) << dPeak << ", " << e.instPatch.Retired() << " old programs left to delete" << endl;
+		return 0;
+	}
+
+	// Events a block, from the sequencer against a compiled song with the same
+	// beats, and a song with tempo changes and held notes rendered in full
+	inline int BenchmarkSong(FTYPE dSeconds = 5.0)
+	{
+		const int nRows = 16;
+		const unsigned int nFrames = 256;
+		cout << nRows << " rows of 16 steps, every step a hit, " << nFrames << " sample blocks" << endl;
+
+		engine e(44100);
+		sequencer seq(120.0);
+		song_score score;
+		song_pattern p;
+		p.sName = "dense";
+		for (int r = 0; r < nRows; r++)
+		{
+			seq.AddInstrument(&e.instKick);
+			seq.vecChannel.back().sBeat = L"XXXXXXXXXXXXXXXX";
+			song_row row;
+			row.sInstrument = "kick";
+			row.vecSteps.resize(p.nSteps);
+			for (song_step& step : row.vecSteps)
+				step.nNote = 64;
+			p.vecRows.push_back(row);
+		}
+		score.vecPatterns.push_back(p);
+		score.vecChain.push_back(song_play());
+		string sError;
+		if (!e.LoadSong(score, sError))
+		{
+			cerr << sError << endl;
+			return 1;
+		}
+
+		for (int nPath = 0; nPath < 2; nPath++)
+		{
+			size_t nEvents = 0, nBlocks = 0;
+			auto tStart = chrono::steady_clock::now();
+			double dElapsed = 0.0;
+			while (dElapsed < dSeconds)
+			{
+				for (int b = 0; b < 1000; b++, nBlocks++)
+				{
+					if (nPath == 0)
+						nEvents += seq.Update(nFrames / 44100.0);
+					else
+						e.song.Events(nBlocks * nFrames, nFrames, [&](const arrangement::event&, uint64_t) { nEvents++; });
+				}
+				dElapsed = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+			}
+			cout << fixed << setprecision(1) << "  " << left << setw(10) << (nPath == 0 ? "sequencer" : "song") << right
+				<< setw(8) << dElapsed * 1e9 / nBlocks << "ns a block, " << setprecision(2) << (double)nEvents / nBlocks << " events a block" << endl;
+		}
+
+		const char* sSong =
+			"pattern verse 16 swing 0.2\n"
+			"kick  X...X...X..X.X..\n"
+			"snare ..X...X...X...X.\n"
+			"hihat xxXxxxXxxxXxxxXx\n"
+			"bell  60:1:2 . . . 64:0.6 . . . 67:0.8:4 . . . . . . .\n"
+			"pattern fill 8\n"
+			"snare XxXxXXXX\n"
+			"fm    48:1:8 . . . . . . .\n"
+			"tempo 90\n"
+			"play verse 2\n"
+			"tempo 120\n"
+			"play verse\n"
+			"play fill\n";
+		istringstream text(sSong);
+		engine song(44100);
+		if (!ParseSong(text, "song", score, sError) || !song.LoadSong(score, sError))
+		{
+			cerr << sError << endl;
+			return 1;
+		}
+		vector<FTYPE> vecOut(nFrames);
+		size_t nBlocks = (size_t)(dSeconds * 44100.0 / nFrames), nPeakNotes = 0;
+		auto tStart = chrono::steady_clock::now();
+		for (size_t b = 0; b < nBlocks; b++)
+		{
+			song.ProcessBlock(vecOut.data(), nFrames, 1);
+			nPeakNotes = max(nPeakNotes, song.GetNoteCount());
+		}
+		double dElapsed = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+		cout << "Song with tempo changes, " << dSeconds << "s rendered in " << setprecision(3) << dElapsed << "s, up to " << nPeakNotes << " notes" << endl;
+
+		// A note at half velocity must come out at half the level on both
+		// paths, and the paths must still agree with each other
+		cout << "Velocity 0.5 against 1.0, per sample and through voice lanes" << endl;
+		bool bOk = true;
+		const char* sLaneInstruments[] = { "supersaw", "fm", "analog", "patch" };
+		for (const char* sName : sLaneInstruments)
+		{
+			vector<FTYPE> vecOut[2][2];		// [lanes][half velocity]
+			for (int nLanes = 0; nLanes < 2; nLanes++)
+				for (int nHalf = 0; nHalf < 2; nHalf++)
+				{
+					string sText = string("pattern p 1\n") + sName + (nHalf ? " 60:0.5" : " 60:1") + "\nplay p\n";
+					istringstream note(sText);
+					engine v(44100);
+					v.bVoiceLanes = nLanes == 1;
+					v.instPatch.Compile(PATCH_BELL8, "patch", sError);
+					if (!ParseSong(note, "velocity", score, sError) || !v.LoadSong(score, sError))
+					{
+						cerr << sError << endl;
+						return 1;
+					}
+					SeedNoise();
+					vecOut[nLanes][nHalf].assign(86 * nFrames, 0.0);
+					for (size_t n = 0; n < vecOut[nLanes][nHalf].size(); n += nFrames)
+						v.ProcessBlock(&vecOut[nLanes][nHalf][n], nFrames, 1);
+				}
+
+			auto Energy = [](const vector<FTYPE>& vec) { FTYPE d = 0.0; for (FTYPE x : vec) d += x * x; return d; };
+			FTYPE dRatio[2], dError = 0.0;
+			for (int nLanes = 0; nLanes < 2; nLanes++)
+				dRatio[nLanes] = sqrt(Energy(vecOut[nLanes][1]) / Energy(vecOut[nLanes][0]));
+			for (size_t n = 0; n < vecOut[0][1].size(); n++)
+				dError += (vecOut[1][1][n] - vecOut[0][1][n]) * (vecOut[1][1][n] - vecOut[0][1][n]);
+			FTYPE dSNR = 10.0 * log10(Energy(vecOut[0][1]) / max(dError, 1e-30));
+			bool bScaled = fabs(dRatio[0] - 0.5) < 1e-3 && fabs(dRatio[1] - 0.5) < 1e-3;
+			bOk = bOk && bScaled;
+			cout << "  " << left << setw(10) << sName << right << setprecision(4) << "level per sample " << dRatio[0] << ", lanes " << dRatio[1]
+				<< ", paths apart by SNR " << setprecision(1) << dSNR << "dB" << (bScaled ? "" : "  WRONG") << endl;
+		}
+		return bOk ? 0 : 1;
+	}
+}
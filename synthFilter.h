@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Voice filters
+	//
+	// Resonant filters small enough to give every voice its own. Both are zero
+	// delay feedback designs from trapezoidal integrators, so they stay stable
+	// for any cutoff and resonance, even when the cutoff moves every block.
+	// Coefficients are set at control rate with Set(), then a block runs through
+	// Process(). States that decay below hearing are flushed to zero at the end
+	// of each block, there may be no FTZ on the thread rendering.
+
+	const int FILTER_LOW_PASS = 0;
+	const int FILTER_BAND_PASS = 1;
+	const int FILTER_HIGH_PASS = 2;
+	const int FILTER_NOTCH = 3;
+	const int FILTER_LADDER = 4;	// Four pole low pass, see filter_ladder
+
+	// Warped integrator gain for a cutoff, kept clear of Nyquist
+	inline FTYPE FilterGain(FTYPE dHertz, FTYPE dSampleRate)
+	{
+		dHertz = min(max(dHertz, (FTYPE)10.0), dSampleRate * 0.45);
+		return tan(PI * dHertz / dSampleRate);
+	}
+
+	inline void FlushDenormal(FTYPE& d)
+	{
+		if (fabs(d) < 1e-15)
+			d = 0.0;
+	}
+
+	// Two pole state variable filter with low, band, high pass and notch
+	// outputs (Simper's trapezoidal SVF)
+	class filter_svf
+	{
+	public:
+		// Resonance from 0 to 1, 1 rings for a long time (Q of 20) but never blows up
+		void Set(FTYPE dHertz, FTYPE dResonance, FTYPE dSampleRate)
+		{
+			FTYPE g = FilterGain(dHertz, dSampleRate);
+			m_k = 2.0 - 1.95 * min(max(dResonance, (FTYPE)0.0), (FTYPE)1.0);
+			m_a1 = 1.0 / (1.0 + g * (g + m_k));
+			m_a2 = g * m_a1;
+			m_a3 = g * m_a2;
+		}
+
+		void Reset()
+		{
+			m_ic1 = m_ic2 = 0.0;
+		}
+
+		FTYPE Process(FTYPE x, int nMode)
+		{
+			FTYPE v3 = x - m_ic2;
+			FTYPE v1 = m_a1 * m_ic1 + m_a2 * v3;	// Band
+			FTYPE v2 = m_ic2 + m_a2 * m_ic1 + m_a3 * v3;	// Low
+			m_ic1 = 2.0 * v1 - m_ic1;
+			m_ic2 = 2.0 * v2 - m_ic2;
+
+			switch (nMode)
+			{
+			case FILTER_BAND_PASS: return v1;
+			case FILTER_HIGH_PASS: return x - m_k * v1 - v2;
+			case FILTER_NOTCH: return x - m_k * v1;
+			default: return v2;
+			}
+		}
+
+		// In place
+		void Process(FTYPE* pBuffer, unsigned int nFrames, int nMode)
+		{
+			for (unsigned int n = 0; n < nFrames; n++)
+				pBuffer[n] = Process(pBuffer[n], nMode);
+			FlushDenormal(m_ic1);
+			FlushDenormal(m_ic2);
+		}
+
+	private:
+		FTYPE m_k = 2.0, m_a1 = 1.0, m_a2 = 0.0, m_a3 = 0.0;
+		FTYPE m_ic1 = 0.0, m_ic2 = 0.0;
+	};
+
+	// Four pole transistor ladder low pass (Zavalishin's zero delay feedback
+	// form). The feedback loop is solved exactly for the linear filter and
+	// the input is soft clipped, so at full resonance it self oscillates at a
+	// bounded level rather than running away.
+	class filter_ladder
+	{
+	public:
+		// Resonance from 0 to 1, self oscillation starts at 1
+		void Set(FTYPE dHertz, FTYPE dResonance, FTYPE dSampleRate)
+		{
+			FTYPE g = FilterGain(dHertz, dSampleRate);
+			m_G = g / (1.0 + g);
+			m_k = 4.0 * min(max(dResonance, (FTYPE)0.0), (FTYPE)1.0);
+			m_dCompensate = 1.0 + 0.5 * m_k; // Resonance thins out the pass band, make some of it back
+		}
+
+		void Reset()
+		{
+			for (auto& s : m_s)
+				s = 0.0;
+		}
+
+		FTYPE Process(FTYPE x)
+		{
+			// What the stages would output with no input, then the loop solved for it
+			FTYPE G = m_G;
+			FTYPE S = (((m_s[0] * G + m_s[1]) * G + m_s[2]) * G + m_s[3]) * (1.0 - G);
+			FTYPE G4 = G * G * G * G;
+			FTYPE u = Saturate((x * m_dCompensate - m_k * S) / (1.0 + m_k * G4));
+
+			for (auto& s : m_s)
+			{
+				FTYPE v = (u - s) * G;
+				u = v + s;
+				s = u + v;
+			}
+			return u;
+		}
+
+		// In place
+		void Process(FTYPE* pBuffer, unsigned int nFrames)
+		{
+			for (unsigned int n = 0; n < nFrames; n++)
+				pBuffer[n] = Process(pBuffer[n]);
+			for (auto& s : m_s)
+				FlushDenormal(s);
+		}
+
+	private:
+		FTYPE m_G = 0.0, m_k = 0.0, m_dCompensate = 1.0;
+		FTYPE m_s[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+		// tanh() near enough, and far cheaper
+		static FTYPE Saturate(FTYPE x)
+		{
+			if (x <= -3.0) return -1.0;
+			if (x >= 3.0) return 1.0;
+			return x * (27.0 + x * x) / (27.0 + 9.0 * x * x);
+		}
+	};
+}
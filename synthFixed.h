@@ -0,0 +1,633 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+#include "synthRealtime.h"
+#include "synthEngine.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Fixed point rendering
+	//
+	// An engine for small boxes where double precision sin() and pow() cost too
+	// much. It plays the oscillator instruments (bells, harmonica and drums) in
+	// integers all the way to the 16 bit output block:
+	//
+	//   phases        Q32, an unsigned fraction of a cycle that wraps by itself
+	//   wave tables   Q30, linearly interpolated
+	//   envelopes     Q31, stepped per sample
+	//   gains         Q15
+	//   mix           Q23, a 16 bit sample with 8 guard bits, saturated on output
+	//
+	// Every multiply is 32 x 32 -> 64 bits, a single instruction on ARM and x86.
+	// Floating point is only used setting a note up. There are no effects.
+
+	namespace fixedpoint
+	{
+		const int WAVE_SINE = 0;
+		const int WAVE_SQUARE = 1;
+		const int WAVE_SAW = 2;		// 99 harmonics, as OSC_SAW_ANA plays by default
+		const int WAVE_NOISE = 3;
+
+		// Quieter than ENV_SILENCE, in Q31
+		const int32_t SILENCE = (int32_t)(ENV_SILENCE * 2147483648.0);
+
+		inline int32_t Q15(FTYPE d) { return (int32_t)lround(d * 32768.0); }
+		inline int32_t Q31(FTYPE d) { return (int32_t)min(llround(d * 2147483648.0), 2147483647ll); }
+
+		// One cycle of a waveform. The saw's edge needs the longer table to
+		// interpolate as cleanly as the sine.
+		template <int BITS>
+		class wave_table
+		{
+		public:
+			// Built on first use, which should not be on the audio thread
+			static const wave_table& Sine() { static const wave_table table(WAVE_SINE); return table; }
+			static const wave_table& Saw() { static const wave_table table(WAVE_SAW); return table; }
+
+			// Q30
+			int32_t operator()(uint32_t nPhase) const
+			{
+				uint32_t i = nPhase >> (32 - BITS);
+				int64_t nFrac = nPhase & ((1u << (32 - BITS)) - 1);
+				return m_nTable[i] + (int32_t)(((int64_t)(m_nTable[i + 1] - m_nTable[i]) * nFrac) >> (32 - BITS));
+			}
+
+		private:
+			static const int SIZE = 1 << BITS;
+			int32_t m_nTable[SIZE + 1];
+
+			wave_table(int nWave)
+			{
+				for (int i = 0; i <= SIZE; i++)
+				{
+					FTYPE dPhase = 2.0 * PI * i / SIZE;
+					FTYPE d = 0.0;
+					if (nWave == WAVE_SAW)
+					{
+						for (FTYPE n = 1.0; n < 100.0; n++)
+							d += sin(n * dPhase) / n;
+						d *= 2.0 / PI;
+					}
+					else
+						d = sin(dPhase);
+					m_nTable[i] = (int32_t)llround(d * 1073741824.0);
+				}
+			}
+		};
+
+		typedef wave_table<12> sine_wave;
+		typedef wave_table<14> saw_wave;
+
+		// Same generator and seed as synth::noise(), Q15
+		inline int32_t Noise()
+		{
+			static thread_local uint32_t nState = 2463534242u;
+			nState ^= nState << 13;
+			nState ^= nState >> 17;
+			nState ^= nState << 5;
+			return (int32_t)(nState >> 16) - 32768;
+		}
+
+		// One osc() term of an instrument's sound()
+		struct partial
+		{
+			int nWave = WAVE_SINE;
+			int nNoteOffset = 0;	// Added to the note id
+			FTYPE dGain = 1.0;
+			FTYPE dLFOHertz = 0.0;
+			FTYPE dLFOAmplitude = 0.0;
+		};
+
+		// An engine instrument as partials. Its envelope, volume and lifetime are
+		// read from the instrument whenever a note starts.
+		struct patch
+		{
+			static const int MAX_PARTIALS = 4;
+
+			instrument_base* pInstrument = nullptr;
+			partial partials[MAX_PARTIALS];
+			int nPartials = 0;
+
+			patch& Add(int nWave, int nNoteOffset, FTYPE dGain, FTYPE dLFOHertz = 0.0, FTYPE dLFOAmplitude = 0.0)
+			{
+				partial& p = partials[nPartials++];
+				p.nWave = nWave;
+				p.nNoteOffset = nNoteOffset;
+				p.dGain = dGain;
+				p.dLFOHertz = dLFOHertz;
+				p.dLFOAmplitude = dLFOAmplitude;
+				return *this;
+			}
+		};
+
+		// One playing note
+		struct voice
+		{
+			enum { ATTACK, DECAY, SUSTAIN, RELEASE, DONE };
+
+			const patch* pPatch = nullptr;
+			int nNoteID = 0;
+			bool bActive = false;
+			bool bReleased = false;
+
+			uint32_t nPhase[patch::MAX_PARTIALS];
+			uint32_t nIncrement[patch::MAX_PARTIALS];
+			uint32_t nLFOPhase[patch::MAX_PARTIALS];
+			uint32_t nLFOIncrement[patch::MAX_PARTIALS];
+			int64_t nDepth[patch::MAX_PARTIALS];	// Phase swing of the LFO, 0 for none
+			int32_t nGain[patch::MAX_PARTIALS];
+
+			// Envelope, linear segments as envelope_adsr. The level carries 32 bits
+			// below Q31 so a long segment does not drift off its end point.
+			int nStage = DONE;
+			int64_t nLevel = 0;
+			int64_t nStep = 0;
+			uint32_t nLeft = 0;		// Samples to the end of the segment
+			int32_t nStart = 0, nSustain = 0;
+			uint32_t nDecay = 0, nRelease = 0;
+
+			uint32_t nAge = 0;		// Samples since the note started
+			uint32_t nAttack = 0;
+			uint32_t nMaxAge = 0;	// 0 for no limit
+			int32_t nVolume = 0;
+
+			void NextStage()
+			{
+				switch (nStage)
+				{
+				case ATTACK:
+					nLevel = (int64_t)nStart << 32;
+					nStage = DECAY;
+					nStep = nDecay > 0 ? (((int64_t)nSustain - nStart) << 32) / nDecay : 0;
+					nLeft = nDecay;
+					if (nDecay == 0)
+						NextStage();
+					break;
+				case DECAY:
+					nLevel = (int64_t)nSustain << 32;
+					nStage = SUSTAIN;
+					nStep = 0;
+					nLeft = 0;
+					break;
+				default:
+					nLevel = 0;
+					nStage = DONE;
+					nStep = 0;
+					nLeft = 0;
+					break;
+				}
+			}
+
+			void Release()
+			{
+				bReleased = true;
+				nStage = RELEASE;
+				nStep = nRelease > 0 ? -(nLevel / nRelease) : 0;
+				nLeft = nRelease;
+				if (nRelease == 0)
+					NextStage();
+			}
+
+			// Adds nFrames into pMix, Q23. False once the note has finished.
+			bool Render(int32_t* pMix, unsigned int nFrames)
+			{
+				const sine_wave& sine = sine_wave::Sine();
+				const saw_wave& saw = saw_wave::Saw();
+				int nPartials = pPatch->nPartials;
+
+				for (unsigned int f = 0; f < nFrames; f++)
+				{
+					int32_t nAmplitude = (int32_t)(nLevel >> 32);
+					if (nAmplitude <= SILENCE)
+						nAmplitude = 0;
+
+					int64_t nSum = 0;	// Q45
+					for (int p = 0; p < nPartials; p++)
+					{
+						uint32_t nAt = nPhase[p];
+						if (nDepth[p] != 0)
+							nAt += (uint32_t)((nDepth[p] * (sine(nLFOPhase[p]) >> 10)) >> 20);
+						nPhase[p] += nIncrement[p];
+						nLFOPhase[p] += nLFOIncrement[p];
+						if (nAmplitude == 0)
+							continue;
+
+						switch (pPatch->partials[p].nWave)
+						{
+						case WAVE_SINE: nSum += (int64_t)sine(nAt) * nGain[p]; break;
+						case WAVE_SQUARE: nSum += (nAt - 1u < 0x7FFFFFFFu ? (int64_t)nGain[p] : -(int64_t)nGain[p]) << 30; break;
+						case WAVE_SAW: nSum += (int64_t)saw(nAt) * nGain[p]; break;
+						case WAVE_NOISE: nSum += ((int64_t)Noise() << 15) * nGain[p]; break;
+						}
+					}
+
+					if (nAmplitude != 0)
+					{
+						int32_t nSound = (int32_t)(nSum >> 17);									// Q28
+						int32_t nShaped = (int32_t)(((int64_t)nSound * nAmplitude) >> 31);	// Q28
+						pMix[f] += (int32_t)(((int64_t)nShaped * nVolume) >> 20);				// Q23
+					}
+
+					// As envelope_adsr::finished(), or out of lifetime
+					bool bFinished = nAmplitude == 0 && (bReleased || (nAge > nAttack && nSustain <= SILENCE));
+					if (nMaxAge > 0 && nAge >= nMaxAge)
+						bFinished = true;
+
+					if (nLeft > 0 && --nLeft == 0)
+						NextStage();
+					else
+						nLevel += nStep;
+					nAge++;
+
+					if (bFinished)
+						return false;
+				}
+				return true;
+			}
+		};
+
+		// Plays the engine's oscillator instruments and its sequencer, in
+		// integers. Note events work as synth::engine's, from any thread.
+		class engine : public olcNoiseSource
+		{
+		public:
+			static const int MAX_VOICES = 64;
+			static constexpr unsigned int MAX_BLOCK_FRAMES = 1024;
+			static const size_t MAX_PENDING_EVENTS = 4096;
+
+			engine(unsigned int nSampleRate = 44100)
+			{
+				m_nSampleRate = nSampleRate;
+				m_dTimeStep = 1.0 / (FTYPE)nSampleRate;
+				m_nClock = 0;
+				m_vecVoices.resize(MAX_VOICES);
+				m_vecMix.assign(MAX_BLOCK_FRAMES, 0);
+				m_vecOutput.assign(MAX_BLOCK_FRAMES, 0);
+				m_vecPending.reserve(MAX_PENDING_EVENTS);
+				m_vecDue.reserve(MAX_PENDING_EVENTS);
+
+				// Note ids -64 to 191, from synth::scale()
+				for (int i = 0; i < 256; i++)
+					m_nIncrement[i] = sine_table::Increment(scale(i - 64), (FTYPE)nSampleRate);
+				sine_wave::Sine();
+				saw_wave::Saw();
+
+				// The same terms as each instrument's sound(). The harmonica's saw
+				// runs on negative time there, which turns it upside down.
+				m_patches[0].Add(WAVE_SINE, 12, 1.00, 5.0, 0.001).Add(WAVE_SINE, 24, 0.50).Add(WAVE_SINE, 36, 0.25).pInstrument = &instBell;
+				m_patches[1].Add(WAVE_SQUARE, 0, 1.00, 5.0, 0.001).Add(WAVE_SINE, 12, 0.50).Add(WAVE_SINE, 24, 0.25).pInstrument = &instBell8;
+				m_patches[2].Add(WAVE_SAW, -12, -1.0, 5.0, 0.001).Add(WAVE_SQUARE, 0, 1.00, 5.0, 0.001).Add(WAVE_SQUARE, 12, 0.50).Add(WAVE_NOISE, 24, 0.05).pInstrument = &instHarm;
+				m_patches[3].Add(WAVE_SINE, -36, 0.99, 1.0, 1.0).Add(WAVE_NOISE, 0, 0.01).pInstrument = &instKick;
+				m_patches[4].Add(WAVE_SINE, -24, 0.5, 0.5, 1.0).Add(WAVE_NOISE, 0, 0.5).pInstrument = &instSnare;
+				m_patches[5].Add(WAVE_SQUARE, -12, 0.1, 1.5, 1.0).Add(WAVE_NOISE, 0, 0.9).pInstrument = &instHiHat;
+			}
+
+		public:
+			// Only their envelopes, volumes and lifetimes are used
+			instrument_bell instBell;
+			instrument_bell8 instBell8;
+			instrument_harmonica instHarm;
+			instrument_drumkick instKick;
+			instrument_drumsnare instSnare;
+			instrument_drumhihat instHiHat;
+
+			sequencer seq;
+
+		public:
+			FTYPE GetTime()
+			{
+				return (FTYPE)(m_nClock + 1) * m_dTimeStep;
+			}
+
+			size_t GetNoteCount()
+			{
+				return m_nNoteCount;
+			}
+
+			// As synth::engine, instruments it has no patch for are ignored
+			bool NoteOn(int nNoteID, instrument_base* pInstrument, FTYPE dWhen = 0.0)
+			{
+				return queEvents.push({ EVENT_NOTE_ON, nNoteID, pInstrument, SampleAt(dWhen), 0 });
+			}
+
+			bool NoteOff(int nNoteID, instrument_base* pInstrument, FTYPE dWhen = 0.0)
+			{
+				return queEvents.push({ EVENT_NOTE_OFF, nNoteID, pInstrument, SampleAt(dWhen), 0 });
+			}
+
+			bool Trigger(int nNoteID, instrument_base* pInstrument, FTYPE dWhen = 0.0)
+			{
+				return queEvents.push({ EVENT_TRIGGER, nNoteID, pInstrument, SampleAt(dWhen), 0 });
+			}
+
+			// Renders the next block and advances the clock. Every channel gets the same.
+			virtual bool ProcessBlock16(int16_t* pBuffer, unsigned int nFrames, unsigned int nChannels)
+			{
+				rt::scope realtime;
+				uint64_t nBlockStart = m_nClock;
+
+				note_event ev;
+				while (queEvents.pop(ev))
+				{
+					ev.nOrder = m_nEventOrder++;
+					if (m_vecPending.size() < m_vecPending.capacity())
+						m_vecPending.push_back(ev);
+					else
+						ApplyEvent(ev);
+				}
+
+				m_vecDue.clear();
+				for (size_t i = 0; i < m_vecPending.size(); )
+				{
+					if (m_vecPending[i].nSample < nBlockStart + nFrames)
+					{
+						m_vecDue.push_back(m_vecPending[i]);
+						m_vecPending[i] = m_vecPending.back();
+						m_vecPending.pop_back();
+					}
+					else
+						i++;
+				}
+				sort(m_vecDue.begin(), m_vecDue.end(), [](const note_event& a, const note_event& b)
+				{
+					return a.nSample != b.nSample ? a.nSample < b.nSample : a.nOrder < b.nOrder;
+				});
+
+				int nNewNotes = seq.Update(nFrames * m_dTimeStep);
+				for (int a = 0; a < nNewNotes; a++)
+					ApplyEvent({ EVENT_TRIGGER, seq.vecNotes[a].id, seq.vecNotes[a].channel, 0, 0 });
+
+				size_t nNextDue = 0;
+				for (unsigned int nDone = 0; nDone < nFrames; )
+				{
+					while (nNextDue < m_vecDue.size() && m_vecDue[nNextDue].nSample <= nBlockStart + nDone)
+						ApplyEvent(m_vecDue[nNextDue++]);
+
+					unsigned int nChunk = min(nFrames - nDone, MAX_BLOCK_FRAMES);
+					if (nNextDue < m_vecDue.size())
+						nChunk = min(nChunk, (unsigned int)(m_vecDue[nNextDue].nSample - nBlockStart - nDone));
+
+					memset(m_vecMix.data(), 0, nChunk * sizeof(int32_t));
+					for (auto& v : m_vecVoices)
+						if (v.bActive && !v.Render(m_vecMix.data(), nChunk))
+							v.bActive = false;
+
+					// Q23 to 16 bits, truncated toward zero like the float conversion
+					int16_t* pOut = pBuffer + nDone * nChannels;
+					for (unsigned int f = 0; f < nChunk; f++)
+					{
+						int64_t n = (int64_t)m_vecMix[f] * 32767;
+						n = n >= 0 ? n >> 23 : -((-n) >> 23);
+						int16_t nSample = (int16_t)min(max(n, (int64_t)-32767), (int64_t)32767);
+						for (unsigned int c = 0; c < nChannels; c++)
+							*pOut++ = nSample;
+					}
+					nDone += nChunk;
+				}
+
+				m_nNoteCount = count_if(m_vecVoices.begin(), m_vecVoices.end(), [](const voice& v) { return v.bActive; });
+				m_nClock += nFrames;
+				return true;
+			}
+
+			// For sources that are not 16 bit
+			virtual void ProcessBlock(FTYPE* pBuffer, unsigned int nFrames, unsigned int nChannels)
+			{
+				for (unsigned int nDone = 0; nDone < nFrames; )
+				{
+					unsigned int nChunk = min(nFrames - nDone, MAX_BLOCK_FRAMES / max(nChannels, 1u));
+					ProcessBlock16(m_vecOutput.data(), nChunk, nChannels);
+					for (unsigned int n = 0; n < nChunk * nChannels; n++)
+						pBuffer[nDone * nChannels + n] = (FTYPE)m_vecOutput[n] / 32767.0;
+					nDone += nChunk;
+				}
+			}
+
+		private:
+			struct note_event
+			{
+				int nType;
+				int nNoteID;
+				instrument_base* pInstrument;
+				uint64_t nSample;
+				uint64_t nOrder;
+			};
+
+			uint64_t SampleAt(FTYPE dWhen)
+			{
+				return dWhen > 0.0 ? (uint64_t)llround(dWhen / m_dTimeStep) - 1 : 0;
+			}
+
+			void ApplyEvent(const note_event& ev)
+			{
+				const patch* pPatch = nullptr;
+				for (auto& p : m_patches)
+					if (p.pInstrument == ev.pInstrument)
+						pPatch = &p;
+				if (pPatch == nullptr)
+					return;
+
+				voice* pFound = nullptr;
+				if (ev.nType != EVENT_TRIGGER)
+					for (auto& v : m_vecVoices)
+						if (v.bActive && v.pPatch == pPatch && v.nNoteID == ev.nNoteID)
+						{
+							pFound = &v;
+							break;
+						}
+
+				if (ev.nType == EVENT_NOTE_OFF)
+				{
+					if (pFound != nullptr && !pFound->bReleased)
+						pFound->Release();
+				}
+				else if (pFound != nullptr)
+				{
+					// Pressed again during release phase
+					if (pFound->bReleased)
+						Start(*pFound, pPatch, ev.nNoteID);
+				}
+				else
+				{
+					// With every voice playing the note is dropped
+					for (auto& v : m_vecVoices)
+						if (!v.bActive)
+						{
+							Start(v, pPatch, ev.nNoteID);
+							break;
+						}
+				}
+			}
+
+			void Start(voice& v, const patch* pPatch, int nNoteID)
+			{
+				const instrument_base& inst = *pPatch->pInstrument;
+				FTYPE dRate = (FTYPE)m_nSampleRate;
+
+				v.pPatch = pPatch;
+				v.nNoteID = nNoteID;
+				v.bActive = true;
+				v.bReleased = false;
+				for (int p = 0; p < pPatch->nPartials; p++)
+				{
+					const partial& part = pPatch->partials[p];
+					v.nPhase[p] = 0;
+					v.nIncrement[p] = m_nIncrement[min(max(nNoteID + part.nNoteOffset + 64, 0), 255)];
+					v.nLFOPhase[p] = 0;
+					v.nLFOIncrement[p] = sine_table::Increment(part.dLFOHertz, dRate);
+					v.nDepth[p] = (int64_t)llround(part.dLFOAmplitude * v.nIncrement[p] * dRate / (2.0 * PI));
+					v.nGain[p] = Q15(part.dGain);
+				}
+
+				v.nAttack = (uint32_t)lround(inst.env.dAttackTime * dRate);
+				v.nDecay = (uint32_t)lround(inst.env.dDecayTime * dRate);
+				v.nRelease = (uint32_t)lround(inst.env.dReleaseTime * dRate);
+				v.nStart = Q31(inst.env.dStartAmplitude);
+				v.nSustain = Q31(inst.env.dSustainAmplitude);
+				v.nMaxAge = inst.fMaxLifeTime > 0.0 ? (uint32_t)lround(inst.fMaxLifeTime * dRate) : 0;
+				v.nVolume = Q15(inst.dVolume);
+				v.nAge = 0;
+
+				v.nStage = voice::ATTACK;
+				v.nLevel = 0;
+				v.nStep = v.nAttack > 0 ? ((int64_t)v.nStart << 32) / v.nAttack : 0;
+				v.nLeft = v.nAttack;
+				if (v.nAttack == 0)
+					v.NextStage();
+			}
+
+		private:
+			unsigned int m_nSampleRate;
+			FTYPE m_dTimeStep;
+			atomic<uint64_t> m_nClock;
+			atomic<size_t> m_nNoteCount{ 0 };
+			uint32_t m_nIncrement[256];
+			patch m_patches[6];
+			vector<voice> m_vecVoices;
+			vector<int32_t> m_vecMix;
+			vector<int16_t> m_vecOutput;
+
+			rt::queue<note_event, 1024> queEvents;
+			vector<note_event> m_vecPending;
+			vector<note_event> m_vecDue;
+			uint64_t m_nEventOrder = 0;
+		};
+	}
+
+	// How far the fixed point engine is from the floating point instruments, and
+	// what each costs. The error is taken on one note at a time, each path on a
+	// fresh thread so their noise generators line up.
+	inline int BenchmarkFixed(FTYPE dSeconds = 5.0)
+	{
+		const int nNoteID = 64;
+		const uint32_t nHold = 22050, nLength = 3 * 44100;
+
+		// Square waves and the envelope's silence gate switch, so where the two
+		// paths land either side of a switch one sample differs by the whole step
+		cout << "Error against floating point, one note held 0.5s then released, in 16 bit steps" << endl;
+		for (int i = 0; i < 6; i++)
+		{
+			fixedpoint::engine fe(44100);
+			instrument_base* pInstruments[] = { &fe.instBell, &fe.instBell8, &fe.instHarm, &fe.instKick, &fe.instSnare, &fe.instHiHat };
+			const char* sNames[] = { "bell", "bell8", "harmonica", "kick", "snare", "hihat" };
+			instrument_base* pInstrument = pInstruments[i];
+
+			vector<short> vecFloat(nLength, 0), vecFixed(nLength, 0);
+			thread tFloat([&]()
+			{
+				note n;
+				n.id = nNoteID;
+				n.on = 1.0 / 44100.0;
+				n.active = true;
+				n.channel = pInstrument;
+				for (uint32_t k = 0; k < nLength && n.active; k++)
+				{
+					FTYPE dTime = (FTYPE)(k + 1) / 44100.0;
+					if (k == nHold)
+						n.off = dTime;
+					bool bFinished = false;
+					FTYPE dSample = pInstrument->sound(dTime, n, bFinished);
+					dSample = dSample >= 0.0 ? fmin(dSample, 1.0) : fmax(dSample, -1.0);
+					vecFloat[k] = (short)(dSample * 32767.0);
+					if (bFinished)
+						n.active = false;
+				}
+			});
+			tFloat.join();
+
+			thread tFixed([&]()
+			{
+				fe.NoteOn(nNoteID, pInstrument);
+				fe.ProcessBlock16(vecFixed.data(), nHold, 1);
+				fe.NoteOff(nNoteID, pInstrument);
+				fe.ProcessBlock16(vecFixed.data() + nHold, nLength - nHold, 1);
+			});
+			tFixed.join();
+
+			int nPeak = 0, nSwitched = 0;
+			double dSquares = 0.0, dSignal = 0.0;
+			for (uint32_t k = 0; k < nLength; k++)
+			{
+				int nError = abs(vecFloat[k] - vecFixed[k]);
+				nPeak = max(nPeak, nError);
+				nSwitched += nError > 16;
+				dSquares += (double)nError * nError;
+				dSignal += (double)vecFloat[k] * vecFloat[k];
+			}
+			cout << fixed << setprecision(2) << "  " << left << setw(10) << sNames[i] << right
+				<< " peak " << setw(5) << nPeak << "  rms " << setw(6) << sqrt(dSquares / nLength)
+				<< "  SNR " << setprecision(1) << setw(5) << 10.0 * log10(dSignal / max(dSquares, 1.0)) << "dB"
+				<< "  switched " << nSwitched << " of " << nLength << " samples" << endl;
+		}
+
+		const int nNotes = 16;
+		cout << nNotes << " held notes, " << dSeconds << "s per run" << endl;
+		size_t nBlocks = (size_t)(dSeconds * 44100.0 / 256);
+		for (int i = 0; i < 3; i++)
+		{
+			const char* sNames[] = { "bell", "bell8", "harmonica" };
+			double dWall[2];
+			for (int bFixed = 0; bFixed < 2; bFixed++)
+			{
+				synth::engine e(44100);
+				fixedpoint::engine fe(44100);
+				instrument_base* pInstrument = bFixed ? (i == 0 ? (instrument_base*)&fe.instBell : i == 1 ? (instrument_base*)&fe.instBell8 : &fe.instHarm)
+					: (i == 0 ? (instrument_base*)&e.instBell : i == 1 ? (instrument_base*)&e.instBell8 : &e.instHarm);
+
+				// Sustain everything so no note finishes early
+				pInstrument->env.dSustainAmplitude = 1.0;
+				for (int n = 0; n < nNotes; n++)
+					bFixed ? fe.NoteOn(40 + n, pInstrument) : e.NoteOn(40 + n, pInstrument);
+
+				vector<FTYPE> vecOut(256);
+				vector<int16_t> vecOut16(256);
+				auto tStart = chrono::steady_clock::now();
+				for (size_t b = 0; b < nBlocks; b++)
+				{
+					if (bFixed)
+						fe.ProcessBlock16(vecOut16.data(), 256, 1);
+					else
+						e.ProcessBlock(vecOut.data(), 256, 1);
+				}
+				dWall[bFixed] = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+			}
+
+			cout << fixed << setprecision(1) << "  " << left << setw(10) << sNames[i] << right
+				<< " float " << setw(7) << dWall[0] * 1e9 / (nNotes * nBlocks * 256.0) << "ns"
+				<< "  fixed " << setw(6) << dWall[1] * 1e9 / (nNotes * nBlocks * 256.0) << "ns per voice sample"
+				<< "  x" << dWall[0] / dWall[1] << endl;
+		}
+		return 0;
+	}
+}
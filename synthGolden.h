@@ -0,0 +1,384 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#include "synthEngine.h"
+#include "synthWave.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Golden renders
+	//
+	// A fixed set of scenes rendered offline and held against references kept
+	// in a directory, so rendering can be made faster without the sound quietly
+	// changing. Every scene starts the noise from the same seed. A scene fails
+	// when its signal to error ratio or largest sample error is outside its
+	// tolerance, or, when timings are asked for, when it takes more time a
+	// sample than the baseline allows.
+	//
+	// The directory, golden/ in the repository, holds <scene>.wav, 16-bit
+	// mono. Rounding to 16 bits is far inside every tolerance. Timings only
+	// mean something on the machine that took them, so baseline.txt, one
+	// "<scene> <ns a sample>" per line, is written on the machine doing the
+	// checking and never committed.
+
+	namespace golden
+	{
+		// Sets an engine up as the application does, for the default beat
+		typedef function<bool(engine&)> set_up;
+
+		struct scene
+		{
+			string sName;
+			FTYPE dSeconds = 2.0;
+			FTYPE dMinSNR = 60.0;		// dB
+			FTYPE dMaxError = 2e-3;
+			FTYPE dGain = 1.0;			// On the output, so a loud scene fits in 16 bits
+			function<bool(engine&, string&)> Play;	// Sets up and sends the notes, before the first block
+		};
+
+		struct result
+		{
+			FTYPE dSNR = 0.0;
+			FTYPE dMaxError = 0.0;
+			double dNanoseconds = 0.0;	// A sample, median of the rounds
+			vector<float> vecOutput;
+		};
+
+		const unsigned int SAMPLE_RATE = 44100;
+		const unsigned int BLOCK_FRAMES = 256;
+		const uint32_t NOISE_SEED = 2463534242u;
+
+		// Notes centred on 64, held for dHold seconds
+		inline bool Chord(engine& e, instrument_base* pInstrument, int nVoices, FTYPE dHold)
+		{
+			for (int k = 0; k < nVoices; k++)
+			{
+				int nNote = 64 - nVoices / 2 + k;
+				if (!e.NoteOn(nNote, pInstrument) || !e.NoteOff(nNote, pInstrument, dHold))
+					return false;
+			}
+			return true;
+		}
+
+		// A short decaying tone for the sampler, written to the temporary
+		// directory so the references are only ever read
+		inline bool SamplerTone(string& sFile, string& sError)
+		{
+			vector<short> vecTone(4096);
+			for (size_t n = 0; n < vecTone.size(); n++)
+				vecTone[n] = (short)(20000.0 * exp(-3.0 * n / vecTone.size()) * sin(2.0 * PI * 261.63 * n / SAMPLE_RATE));
+#ifdef _WIN32
+			const char* sTemp = getenv("TEMP");
+			const char* sDefault = ".";
+#else
+			const char* sTemp = getenv("TMPDIR");
+			const char* sDefault = "/tmp";
+#endif
+			sFile = string(sTemp != nullptr && *sTemp != 0 ? sTemp : sDefault) + "/synth_golden_tone.wav";
+			if (!wave::Write(sFile, vecTone, SAMPLE_RATE, 1))
+			{
+				sError = "cannot write " + sFile;
+				return false;
+			}
+			return true;
+		}
+
+		// The sampler tone is written once here, before any scene plays
+		inline vector<scene> Scenes(set_up SetUp)
+		{
+			vector<scene> vecScenes;
+			string sTone, sToneError;
+			bool bTone = SamplerTone(sTone, sToneError);
+			auto Add = [&](const string& sName, FTYPE dSeconds, FTYPE dMinSNR, FTYPE dMaxError, function<bool(engine&, string&)> Play, FTYPE dGain = 1.0)
+			{
+				scene s;
+				s.sName = sName;
+				s.dSeconds = dSeconds;
+				s.dMinSNR = dMinSNR;
+				s.dMaxError = dMaxError;
+				s.dGain = dGain;
+				s.Play = Play;
+				vecScenes.push_back(s);
+			};
+
+			// Every instrument, three notes staggered and held to 0.75 seconds. Noise
+			// heavy ones get looser tolerances, a change in how noise is
+			// drawn moves them more.
+			const char* sInstruments[] = { "bell", "bell8", "harmonica", "kick", "snare", "hihat", "supersaw", "fm", "analog" };
+			for (const char* sName : sInstruments)
+			{
+				bool bNoisy = strcmp(sName, "snare") == 0 || strcmp(sName, "hihat") == 0;
+				Add(sName, 1.5, bNoisy ? 40.0 : 60.0, bNoisy ? 1e-2 : 2e-3, [sName](engine& e, string&)
+				{
+					instrument_base* pInstrument = e.FindInstrument(sName);
+					return Chord(e, pInstrument, 1, 0.75) && e.NoteOn(67, pInstrument, 0.25) && e.NoteOff(67, pInstrument, 0.75)
+						&& e.NoteOn(71, pInstrument, 0.5) && e.NoteOff(71, pInstrument, 0.75);
+				});
+			}
+
+			Add("sampler", 1.5, 60.0, 2e-3, [bTone, sTone, sToneError](engine& e, string& sError)
+			{
+				if (!bTone)
+				{
+					sError = sToneError;
+					return false;
+				}
+				return e.instSampler.AddSample(sTone, 60, 0, 127, sError) && Chord(e, &e.instSampler, 3, 0.75);
+			});
+
+			Add("patch", 1.5, 60.0, 2e-3, [](engine& e, string& sError)
+			{
+				return e.instPatch.Compile(PATCH_HARMONICA, "harmonica", sError) && Chord(e, &e.instPatch, 3, 0.75);
+			});
+
+			// The application's drum beat, with its effects
+			Add("drums", 4.0, 40.0, 1e-2, [SetUp](engine& e, string& sError)
+			{
+				if (!SetUp(e))
+				{
+					sError = "engine set up failed";
+					return false;
+				}
+				return true;
+			});
+
+			// Chords on the voice lanes path and the per-sample path. The bell
+			// does not share its level out between voices, so big chords of it
+			// are turned down.
+			for (int nVoices : { 1, 16, 128 })
+			{
+				Add("supersaw_x" + to_string(nVoices), 0.5, 60.0, 2e-3, [nVoices](engine& e, string&) { return Chord(e, &e.instSupersaw, nVoices, 0.25); }, nVoices > 16 ? 0.5 : 1.0);
+				Add("bell_x" + to_string(nVoices), 0.5, 60.0, 2e-3, [nVoices](engine& e, string&) { return Chord(e, &e.instBell, nVoices, 0.25); }, nVoices > 1 ? 0.125 : 1.0);
+			}
+			return vecScenes;
+		}
+
+		// Renders a scene from scratch, returning how long it took a sample
+		inline bool Render(const scene& s, vector<FTYPE>& vecOut, double& dNanoseconds, string& sError)
+		{
+			engine e(SAMPLE_RATE);
+			SeedNoise(NOISE_SEED);
+			if (!s.Play(e, sError))
+			{
+				if (sError.empty())
+					sError = "could not send the notes";
+				return false;
+			}
+
+			vecOut.assign((size_t)(s.dSeconds * SAMPLE_RATE), 0.0);
+			auto tStart = chrono::steady_clock::now();
+			for (size_t n = 0; n < vecOut.size(); n += BLOCK_FRAMES)
+				e.ProcessBlock(&vecOut[n], (unsigned int)min((size_t)BLOCK_FRAMES, vecOut.size() - n), 1);
+			dNanoseconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count() * 1e9 / vecOut.size();
+			return true;
+		}
+
+		// Signal to error ratio and largest error of an output against its reference
+		inline void Compare(const vector<double>& vecReference, result& r)
+		{
+			FTYPE dSignal = 0.0, dError = 0.0;
+			r.dMaxError = 0.0;
+			size_t nFrames = max(vecReference.size(), r.vecOutput.size());
+			for (size_t n = 0; n < nFrames; n++)
+			{
+				FTYPE dRef = n < vecReference.size() ? vecReference[n] : 0.0;
+				FTYPE dOut = n < r.vecOutput.size() ? r.vecOutput[n] : 0.0;
+				dSignal += dRef * dRef;
+				dError += (dOut - dRef) * (dOut - dRef);
+				r.dMaxError = max(r.dMaxError, fabs(dOut - dRef));
+			}
+			r.dSNR = dError > 0.0 ? 10.0 * log10(max(dSignal, 1e-30) / dError) : 999.0;
+		}
+
+		inline bool ReadBaseline(const string& sFile, map<string, double>& mapBaseline)
+		{
+			ifstream f(sFile);
+			if (!f.is_open())
+				return false;
+			string sName;
+			double dNanoseconds;
+			while (f >> sName >> dNanoseconds)
+				mapBaseline[sName] = dNanoseconds;
+			return true;
+		}
+
+		// Writes a render as 16-bit, rounded and limited
+		inline bool WriteReference(const string& sFile, const vector<float>& vecOutput)
+		{
+			vector<short> vecSamples(vecOutput.size());
+			for (size_t n = 0; n < vecOutput.size(); n++)
+				vecSamples[n] = (short)lround(max(-1.0f, min(vecOutput[n], 1.0f)) * 32767.0f);
+			return wave::Write(sFile, vecSamples, SAMPLE_RATE, 1);
+		}
+
+		// Checks every scene against the references in sDir, or writes them
+		// (bUpdate), or writes the timings (bUpdateBaseline). With bTimed a
+		// scene may take dMargin percent longer than its baseline, and one
+		// missing from the baseline fails. Each of nRounds goes
+		// through every scene, rendering it for at least dRoundSeconds, and a
+		// scene's time is the median of its rounds, so neither a busy spell on
+		// the machine nor one lucky render decides it. Returns the process
+		// exit code.
+		inline int Run(const string& sDir, bool bUpdate, bool bUpdateBaseline, bool bTimed, double dMargin, set_up SetUp, int nRounds = 7, double dRoundSeconds = 0.25)
+		{
+			vector<scene> vecScenes = Scenes(SetUp);
+			vector<result> vecResults(vecScenes.size());
+			vector<string> vecVerdicts(vecScenes.size());
+			string sBaseline = sDir + "/baseline.txt";
+			map<string, double> mapBaseline;
+			bTimed = bTimed && !bUpdate && !bUpdateBaseline;
+			bool bBaseline = bTimed && ReadBaseline(sBaseline, mapBaseline);
+
+			// The sound, from a first render that also builds tables and touches memory
+			for (size_t i = 0; i < vecScenes.size(); i++)
+			{
+				const scene& s = vecScenes[i];
+				result& r = vecResults[i];
+				string sError, sReference = sDir + "/" + s.sName + ".wav";
+				vector<FTYPE> vecOut;
+				double dNanoseconds = 0.0;
+				if (!Render(s, vecOut, dNanoseconds, sError))
+				{
+					vecVerdicts[i] = "FAIL " + sError;
+					continue;
+				}
+				r.vecOutput.resize(vecOut.size());
+				for (size_t n = 0; n < vecOut.size(); n++)
+					r.vecOutput[n] = (float)(vecOut[n] * s.dGain);
+
+				if (bUpdate)
+				{
+					if (!WriteReference(sReference, r.vecOutput))
+						vecVerdicts[i] = "FAIL cannot write " + sReference;
+					continue;
+				}
+				if (bUpdateBaseline)
+					continue;
+
+				vector<double> vecReference;
+				unsigned int nSampleRate = 0, nChannels = 0;
+				if (!wave::Read(sReference, vecReference, nSampleRate, nChannels, sError))
+					vecVerdicts[i] = "FAIL " + sError + ", write references with --update";
+				else if (nSampleRate != SAMPLE_RATE || nChannels != 1)
+					vecVerdicts[i] = "FAIL " + sReference + " is not 44100Hz mono";
+				else
+				{
+					Compare(vecReference, r);
+					if (r.dSNR < s.dMinSNR)
+						vecVerdicts[i] = "FAIL SNR under " + to_string((int)s.dMinSNR) + "dB";
+					else if (r.dMaxError > s.dMaxError)
+						vecVerdicts[i] = "FAIL error over tolerance";
+				}
+			}
+
+			// The speed
+			vector<vector<double>> vecRounds(vecScenes.size());
+			for (int nRound = 0; nRound < ((bTimed || bUpdateBaseline) ? nRounds : 0); nRound++)
+				for (size_t i = 0; i < vecScenes.size(); i++)
+				{
+					if (vecResults[i].vecOutput.empty())
+						continue;
+					vector<FTYPE> vecOut;
+					string sError;
+					double dSpent = 0.0, dNanoseconds = 0.0;
+					size_t nSamples = 0;
+					do
+					{
+						if (!Render(vecScenes[i], vecOut, dNanoseconds, sError))
+							break;
+						dSpent += dNanoseconds * vecOut.size() * 1e-9;
+						nSamples += vecOut.size();
+					} while (dSpent < dRoundSeconds);
+					if (nSamples > 0)
+						vecRounds[i].push_back(dSpent * 1e9 / nSamples);
+				}
+			for (size_t i = 0; i < vecScenes.size(); i++)
+			{
+				vector<double>& vecTimes = vecRounds[i];
+				if (vecTimes.empty())
+					continue;
+				nth_element(vecTimes.begin(), vecTimes.begin() + vecTimes.size() / 2, vecTimes.end());
+				vecResults[i].dNanoseconds = vecTimes[vecTimes.size() / 2];
+			}
+
+			cout << left << setw(14) << "scene" << right << setw(10) << "SNR dB" << setw(12) << "max error"
+				<< setw(12) << "ns/sample" << setw(12) << "baseline" << "  result" << endl;
+			int nFailed = 0;
+			ostringstream baseline;
+			for (size_t i = 0; i < vecScenes.size(); i++)
+			{
+				const scene& s = vecScenes[i];
+				const result& r = vecResults[i];
+				string& sVerdict = vecVerdicts[i];
+				auto it = mapBaseline.find(s.sName);
+				if (sVerdict.empty())
+				{
+					if (bUpdate)
+						sVerdict = "written";
+					else if (bUpdateBaseline)
+						sVerdict = "timed";
+					else if (bTimed && !bBaseline)
+						sVerdict = "FAIL no " + sBaseline + ", write it with --update-baseline";
+					else if (bTimed && it == mapBaseline.end())
+						sVerdict = "FAIL not in the baseline";
+					else if (bTimed && r.dNanoseconds > it->second * (1.0 + dMargin / 100.0))
+						sVerdict = "FAIL slower than baseline";
+					else
+						sVerdict = "ok";
+				}
+				if (sVerdict.compare(0, 4, "FAIL") == 0)
+					nFailed++;
+				baseline << s.sName << " " << fixed << setprecision(2) << r.dNanoseconds << "\n";
+
+				// Nothing was compared when writing
+				cout << left << setw(14) << s.sName << right;
+				if (bUpdate || bUpdateBaseline)
+					cout << setw(10) << "n/a" << setw(12) << "n/a";
+				else
+					cout << fixed << setprecision(1) << setw(10) << min(r.dSNR, (FTYPE)999.0)
+						<< scientific << setprecision(2) << setw(12) << r.dMaxError;
+				if (r.dNanoseconds > 0.0)
+					cout << fixed << setprecision(1) << setw(12) << r.dNanoseconds;
+				else
+					cout << setw(12) << "-";
+				if (it != mapBaseline.end())
+					cout << setw(12) << it->second;
+				else
+					cout << setw(12) << "-";
+				cout << "  " << sVerdict << endl;
+			}
+
+			if (bUpdateBaseline && nFailed == 0)
+			{
+				ofstream f(sBaseline);
+				f << baseline.str();
+				if (!f.good())
+				{
+					cerr << "Cannot write " << sBaseline << endl;
+					return 1;
+				}
+			}
+
+			cout << vecScenes.size() - nFailed << " of " << vecScenes.size() << " scenes passed";
+			if (bTimed)
+				cout << ", " << dMargin << "% slower than the baseline allowed";
+			cout << endl;
+			return nFailed == 0 ? 0 : 1;
+		}
+	}
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cmath>
+using namespace std;
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SYNTH_LANES 16
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define SYNTH_LANES 8
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SYNTH_LANES 4
+#else
+#define SYNTH_LANES 4
+#define SYNTH_LANES_SCALAR
+#endif
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Voice lanes
+	//
+	// A vector of floats as wide as the target allows, 16 with AVX-512, 8 with AVX
+	// and 4 with SSE. Voices that are rendered together get one lane each, so
+	// their phases, increments and levels all live in registers.
+
+	struct lanes
+	{
+		static const int COUNT = SYNTH_LANES;
+
+#if SYNTH_LANES == 16
+		__m512 v;
+		typedef __mmask16 mask;
+
+		lanes() {}
+		lanes(__m512 x) : v(x) {}
+		lanes(float f) : v(_mm512_set1_ps(f)) {}
+		static lanes Load(const float* p) { return _mm512_loadu_ps(p); }
+		void Store(float* p) const { _mm512_storeu_ps(p, v); }
+
+		friend lanes operator+(lanes a, lanes b) { return _mm512_add_ps(a.v, b.v); }
+		friend lanes operator-(lanes a, lanes b) { return _mm512_sub_ps(a.v, b.v); }
+		friend lanes operator*(lanes a, lanes b) { return _mm512_mul_ps(a.v, b.v); }
+		friend lanes operator/(lanes a, lanes b) { return _mm512_div_ps(a.v, b.v); }
+		friend mask operator<(lanes a, lanes b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+		friend mask operator>=(lanes a, lanes b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ); }
+
+		// a where the mask is set, otherwise b
+		static lanes Select(mask m, lanes a, lanes b) { return _mm512_mask_blend_ps(m, b.v, a.v); }
+#elif SYNTH_LANES == 8
+		__m256 v;
+		typedef __m256 mask;
+
+		lanes() {}
+		lanes(__m256 x) : v(x) {}
+		lanes(float f) : v(_mm256_set1_ps(f)) {}
+		static lanes Load(const float* p) { return _mm256_loadu_ps(p); }
+		void Store(float* p) const { _mm256_storeu_ps(p, v); }
+
+		friend lanes operator+(lanes a, lanes b) { return _mm256_add_ps(a.v, b.v); }
+		friend lanes operator-(lanes a, lanes b) { return _mm256_sub_ps(a.v, b.v); }
+		friend lanes operator*(lanes a, lanes b) { return _mm256_mul_ps(a.v, b.v); }
+		friend lanes operator/(lanes a, lanes b) { return _mm256_div_ps(a.v, b.v); }
+		friend mask operator<(lanes a, lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+		friend mask operator>=(lanes a, lanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+
+		static lanes Select(mask m, lanes a, lanes b) { return _mm256_blendv_ps(b.v, a.v, m); }
+#elif !defined(SYNTH_LANES_SCALAR)
+		__m128 v;
+		typedef __m128 mask;
+
+		lanes() {}
+		lanes(__m128 x) : v(x) {}
+		lanes(float f) : v(_mm_set1_ps(f)) {}
+		static lanes Load(const float* p) { return _mm_loadu_ps(p); }
+		void Store(float* p) const { _mm_storeu_ps(p, v); }
+
+		friend lanes operator+(lanes a, lanes b) { return _mm_add_ps(a.v, b.v); }
+		friend lanes operator-(lanes a, lanes b) { return _mm_sub_ps(a.v, b.v); }
+		friend lanes operator*(lanes a, lanes b) { return _mm_mul_ps(a.v, b.v); }
+		friend lanes operator/(lanes a, lanes b) { return _mm_div_ps(a.v, b.v); }
+		friend mask operator<(lanes a, lanes b) { return _mm_cmplt_ps(a.v, b.v); }
+		friend mask operator>=(lanes a, lanes b) { return _mm_cmpge_ps(a.v, b.v); }
+
+		static lanes Select(mask m, lanes a, lanes b) { return _mm_or_ps(_mm_and_ps(m, a.v), _mm_andnot_ps(m, b.v)); }
+#else
+		// No SIMD: plain loops, which the compiler may still vectorise
+		float v[SYNTH_LANES];
+		struct mask { bool b[SYNTH_LANES]; };
+
+		lanes() {}
+		lanes(float f) { for (int i = 0; i < COUNT; i++) v[i] = f; }
+		static lanes Load(const float* p) { lanes r; for (int i = 0; i < COUNT; i++) r.v[i] = p[i]; return r; }
+		void Store(float* p) const { for (int i = 0; i < COUNT; i++) p[i] = v[i]; }
+
+		friend lanes operator+(lanes a, lanes b) { for (int i = 0; i < COUNT; i++) a.v[i] += b.v[i]; return a; }
+		friend lanes operator-(lanes a, lanes b) { for (int i = 0; i < COUNT; i++) a.v[i] -= b.v[i]; return a; }
+		friend lanes operator*(lanes a, lanes b) { for (int i = 0; i < COUNT; i++) a.v[i] *= b.v[i]; return a; }
+		friend lanes operator/(lanes a, lanes b) { for (int i = 0; i < COUNT; i++) a.v[i] /= b.v[i]; return a; }
+		friend mask operator<(lanes a, lanes b) { mask m; for (int i = 0; i < COUNT; i++) m.b[i] = a.v[i] < b.v[i]; return m; }
+		friend mask operator>=(lanes a, lanes b) { mask m; for (int i = 0; i < COUNT; i++) m.b[i] = a.v[i] >= b.v[i]; return m; }
+
+		static lanes Select(mask m, lanes a, lanes b) { for (int i = 0; i < COUNT; i++) a.v[i] = m.b[i] ? a.v[i] : b.v[i]; return a; }
+#endif
+
+		float Sum() const
+		{
+			float f[COUNT];
+			Store(f);
+			float dSum = 0.0f;
+			for (int i = 0; i < COUNT; i++)
+				dSum += f[i];
+			return dSum;
+		}
+	};
+
+	// Band limited saw from a phase in [0, 1) advancing dt per sample (PolyBLEP)
+	inline FTYPE SawBLEP(FTYPE t, FTYPE dt)
+	{
+		FTYPE dSaw = 2.0 * t - 1.0;
+		if (t < dt)
+		{
+			FTYPE x = t / dt;
+			dSaw -= x + x - x * x - 1.0;
+		}
+		else if (t >= 1.0 - dt)
+		{
+			FTYPE x = (t - 1.0) / dt;
+			dSaw -= x * x + x + x + 1.0;
+		}
+		return dSaw;
+	}
+
+	// The same for every lane at once
+	inline lanes SawBLEP(lanes t, lanes dt)
+	{
+		lanes one(1.0f), two(2.0f);
+		lanes dSaw = two * t - one;
+		lanes x0 = t / dt;
+		lanes x1 = (t - one) / dt;
+		lanes b0 = x0 + x0 - x0 * x0 - one;
+		lanes b1 = x1 * x1 + x1 + x1 + one;
+		lanes zero(0.0f);
+		return dSaw - lanes::Select(t < dt, b0, lanes::Select(t >= one - dt, b1, zero));
+	}
+}
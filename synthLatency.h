@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+#include "synthEngine.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Adaptive latency
+	//
+	// Sizes the device queue to how long blocks actually take to render. It
+	// keeps the worst recent render time, decaying, and wants about twice that
+	// queued ahead of the block being filled. A late block grows the queue at
+	// once, an underrun at least doubles it. Latency only comes down after a
+	// calm spell, and then at most by half at a time. Blocks stay as small as
+	// the bounds allow; they only get bigger once the block count is used up.
+
+	class latency_controller : public olcNoiseLatency
+	{
+	public:
+		// Bounds, set before the controller is handed to olcNoiseMaker and
+		// within what that was created with
+		unsigned int nMinBlocks = 2, nMaxBlocks = 16;
+		unsigned int nMinBlockSamples = 128, nMaxBlockSamples = 2048;	// Powers of two apart
+		double dCalm = 3.0;		// Seconds without a late block before latency comes down
+
+		void Update(double dRender, double dBlock, unsigned int nQueued, unsigned int& nBlocks, unsigned int& nBlockSamples) override
+		{
+			double dFrame = dBlock / nBlockSamples;
+			m_dLoad = m_dLoad + (dRender / dBlock - m_dLoad) * min(dBlock / LOAD_SMOOTHING, 1.0);
+			m_dPeak = max(dRender, m_dPeak * pow(0.5, dBlock / PEAK_HALF_LIFE));
+			m_dLoadShared.store(m_dLoad, memory_order_relaxed);
+			m_dPeakShared.store(m_dPeak, memory_order_relaxed);
+
+			// The very first block always finds the device idle
+			if (!m_bStarted)
+			{
+				m_bStarted = true;
+				return;
+			}
+
+			// Late: what the device had left when filling started was nearly
+			// used up by the time the block was done, or was not enough
+			double dHeadroom = (nBlocks - 1) * dBlock;
+			bool bUnderrun = nQueued * dBlock < dRender;
+			bool bLate = nQueued * dBlock - dRender < 0.5 * dBlock;
+			if (bLate)
+			{
+				m_dSinceLate = 0.0;
+				double dWant = max(2.0 * m_dPeak, bUnderrun ? 2.0 * dHeadroom + dBlock : dHeadroom + dBlock);
+				Fit(dWant, dFrame, nBlocks, nBlockSamples);
+				m_nChanges.fetch_add(1, memory_order_relaxed);
+				return;
+			}
+
+			// Calm for long enough and more queued than needed, come down a step
+			m_dSinceLate += dBlock;
+			double dWant = 2.0 * m_dPeak;
+			if (m_dSinceLate >= dCalm && dHeadroom > 2.0 * dWant && (nBlocks > nMinBlocks || nBlockSamples > nMinBlockSamples))
+			{
+				m_dSinceLate = 0.0;
+				Fit(max(dWant, 0.5 * dHeadroom), dFrame, nBlocks, nBlockSamples);
+				m_nChanges.fetch_add(1, memory_order_relaxed);
+			}
+		}
+
+		// Render time as a fraction of real time, smoothed over about half a second
+		double Load() const { return m_dLoadShared.load(memory_order_relaxed); }
+
+		// Slowest recent block, seconds
+		double Peak() const { return m_dPeakShared.load(memory_order_relaxed); }
+
+		// Layout changes asked for
+		unsigned int Changes() const { return m_nChanges.load(memory_order_relaxed); }
+
+	private:
+		static constexpr double LOAD_SMOOTHING = 0.5;
+		static constexpr double PEAK_HALF_LIFE = 2.0;
+
+		// Audio thread only
+		bool m_bStarted = false;
+		double m_dLoad = 0.0;
+		double m_dPeak = 0.0;
+		double m_dSinceLate = 0.0;
+
+		atomic<double> m_dLoadShared{ 0.0 };
+		atomic<double> m_dPeakShared{ 0.0 };
+		atomic<unsigned int> m_nChanges{ 0 };
+
+		// Smallest blocks that queue dWant seconds ahead of the one being filled
+		void Fit(double dWant, double dFrame, unsigned int& nBlocks, unsigned int& nBlockSamples)
+		{
+			for (unsigned int nSamples = nMinBlockSamples; nSamples <= nMaxBlockSamples; nSamples *= 2)
+			{
+				unsigned int nNeed = (unsigned int)ceil(dWant / (nSamples * dFrame)) + 1;
+				if (nNeed <= nMaxBlocks)
+				{
+					nBlocks = max(nNeed, nMinBlocks);
+					nBlockSamples = nSamples;
+					return;
+				}
+			}
+			nBlocks = nMaxBlocks;
+			nBlockSamples = nMaxBlockSamples;
+		}
+	};
+
+	// Wraps a source and spends extra time on each block, as if the machine
+	// were busy: a steady share of every block, plus a stall now and then
+	class loaded_source : public olcNoiseSource
+	{
+	public:
+		atomic<double> dLoad{ 0.0 };		// Extra time per block, as a fraction of its length
+		atomic<double> dStall{ 0.0 };		// Seconds, once per dStallEvery of audio
+		atomic<double> dStallEvery{ 0.0 };
+
+		loaded_source(olcNoiseSource& source, FTYPE dSampleRate) : m_source(source), m_dSampleRate(dSampleRate) {}
+
+		void ProcessBlock(FTYPE* pBuffer, unsigned int nFrames, unsigned int nChannels) override
+		{
+			auto tStart = chrono::steady_clock::now();
+			m_source.ProcessBlock(pBuffer, nFrames, nChannels);
+
+			double dBusy = dLoad * nFrames / m_dSampleRate;
+			double dEvery = dStallEvery;
+			double dTime = m_dTime + nFrames / m_dSampleRate;
+			if (dEvery > 0.0 && floor(dTime / dEvery) != floor(m_dTime / dEvery))
+				dBusy += dStall;
+			m_dTime = dTime;
+
+			while (chrono::duration<double>(chrono::steady_clock::now() - tStart).count() < dBusy)
+				;
+		}
+
+	private:
+		olcNoiseSource& m_source;
+		FTYPE m_dSampleRate;
+		double m_dTime = 0.0;
+	};
+
+	// Plays held notes through the first device (the null device off Windows)
+	// while load comes and goes, printing the layout the controller picks.
+	// Fails if anything underruns once the machine has been quiet a while.
+	inline int RunLatencyTest()
+	{
+		struct phase
+		{
+			const char* sName;
+			double dSeconds, dLoad, dStall, dStallEvery;
+		};
+		const phase phases[] =
+		{
+			{ "idle",   3.0, 0.10, 0.000, 0.0 },
+			{ "heavy",  3.0, 0.75, 0.000, 0.0 },
+			{ "stalls", 4.0, 0.20, 0.025, 0.5 },
+			{ "idle",  10.0, 0.10, 0.000, 0.0 },
+		};
+
+		engine e(44100);
+		for (int n = 0; n < 4; n++)
+			e.NoteOn(60 + n * 4, &e.instHarm);
+
+		latency_controller control;
+		control.nMinBlocks = 2;
+		control.nMaxBlocks = 16;
+		control.nMinBlockSamples = 128;
+		control.nMaxBlockSamples = 2048;
+
+		loaded_source load(e, 44100.0);
+		olcNoiseMaker<short> sound(olcNoiseMaker<short>::Enumerate()[0], 44100, 1, 4, 256, control.nMaxBlocks, control.nMaxBlockSamples);
+		sound.SetUserSource(&load);
+		sound.SetLatencyController(&control);
+
+		cout << "    time  phase   layout      latency  load  peak    underruns" << endl;
+		auto tStart = chrono::steady_clock::now();
+		double dEnd = 0.0;
+		unsigned int nQuietUnderruns = 0;
+		for (const phase& p : phases)
+		{
+			load.dLoad = p.dLoad;
+			load.dStall = p.dStall;
+			load.dStallEvery = p.dStallEvery;
+			unsigned int nUnderruns = sound.GetUnderruns();
+			double dPhaseEnd = dEnd + p.dSeconds;
+			for (; dEnd < dPhaseEnd - 1e-9; dEnd += 0.5)
+			{
+				this_thread::sleep_until(tStart + chrono::milliseconds((int)((dEnd + 0.5) * 1000.0)));
+				cout << fixed << setprecision(1) << setw(7) << dEnd + 0.5 << "s  " << left << setw(7) << p.sName << right
+					<< setw(3) << sound.GetBlocks() << " x " << setw(4) << sound.GetBlockSamples()
+					<< setw(9) << sound.GetLatency() * 1000.0 << "ms"
+					<< setprecision(0) << setw(5) << control.Load() * 100.0 << "%"
+					<< setprecision(1) << setw(6) << control.Peak() * 1000.0 << "ms"
+					<< setw(6) << sound.GetUnderruns() << endl;
+			}
+
+			// The quiet end is only judged once the stalls have decayed away
+			if (&p == &phases[3])
+				nQuietUnderruns = sound.GetUnderruns() - nUnderruns;
+		}
+		sound.Stop();
+
+		cout << "Layout changes " << control.Changes() << ", underruns " << sound.GetUnderruns()
+			<< ", " << nQuietUnderruns << " in the last quiet " << fixed << setprecision(0) << phases[3].dSeconds << "s" << endl;
+		return nQuietUnderruns == 0 ? 0 : 1;
+	}
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+using namespace std;
+
+#include "synthRealtime.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Performance log
+	//
+	// Every note event the engine takes from its queue, stamped with the clock
+	// sample it landed on, plus the block size whenever it changes. Replaying a
+	// log into an engine set up the same way renders the session again, to the
+	// bit. The audio thread only pushes into a lock-free queue; a background
+	// thread encodes and writes.
+	//
+	// File: "SSPL", uint16 version, uint16 channels, uint32 sample rate, uint32
+	// flags, then records of one type byte, the varint sample distance from the previous
+	// record, and a payload. Notes carry an instrument byte and a zigzag varint
+	// note id, blocks a varint frame count. The end has no payload, its sample
+	// is where rendering had got to. Logs replay from the engine's first block.
+
+	const uint8_t LOG_NOTE_ON = 0;	// Same numbers as EVENT_NOTE_ON...
+	const uint8_t LOG_NOTE_OFF = 1;
+	const uint8_t LOG_TRIGGER = 2;
+	const uint8_t LOG_BLOCK = 3;	// Blocks from here on are nFrames long
+	const uint8_t LOG_END = 4;		// Recording stopped with the clock here
+
+	const uint32_t LOG_FLAG_FTZ = 1;	// The audio thread flushed denormals to zero
+
+	struct log_record
+	{
+		uint64_t nSample = 0;
+		uint8_t nType = LOG_END;
+		uint8_t nInstrument = 0;	// engine::Instrument() index
+		int32_t nNoteID = 0;
+		uint32_t nFrames = 0;
+	};
+
+	class performance_log
+	{
+	public:
+		static const uint16_t VERSION = 1;
+
+		~performance_log()
+		{
+			Stop();
+		}
+
+		// Starts a new log file and the thread writing it
+		bool Start(const string& sFile, unsigned int nSampleRate, unsigned int nChannels, string& sError)
+		{
+			Stop();
+			m_file.open(sFile, ios::binary | ios::trunc);
+			if (!m_file.is_open())
+			{
+				sError = "cannot create " + sFile;
+				return false;
+			}
+
+			unsigned char header[HEADER_BYTES];
+			memcpy(header, "SSPL", 4);
+			PutU16(header + 4, VERSION);
+			PutU16(header + 6, (uint16_t)nChannels);
+			PutU32(header + 8, nSampleRate);
+			PutU32(header + 12, 0);
+			m_file.write((const char*)header, sizeof(header));
+
+			m_nPrevious = 0;
+			m_nRecords = 0;
+			m_nDropped = 0;
+			m_nEnd = 0;
+			m_nBlockFrames = 0;
+			m_nFlags = 0;
+			m_bFlagsWritten = false;
+			m_bRunning = true;
+			m_thread = thread(&performance_log::WriteThread, this);
+			return true;
+		}
+
+		// Writes out everything still queued and closes the file
+		void Stop()
+		{
+			if (!m_thread.joinable())
+				return;
+			m_bRunning = false;
+			m_thread.join();
+
+			log_record end;
+			end.nSample = m_nEnd.load(memory_order_relaxed);
+			end.nType = LOG_END;
+			Encode(end);
+			Flush();
+			m_file.close();
+		}
+
+		bool IsRecording() const { return m_bRunning.load(memory_order_relaxed); }
+
+		// Audio thread: never waits, a full queue drops the record and counts it
+		void Record(const log_record& r)
+		{
+			if (!m_queRecords.push(r))
+				m_nDropped.fetch_add(1, memory_order_relaxed);
+		}
+
+		// Audio thread: a block of nFrames starts at nSample
+		void Block(uint64_t nSample, unsigned int nFrames)
+		{
+			// The flags are set before the writer can see a block
+			uint32_t nPrevious = m_nBlockFrames.load(memory_order_relaxed);
+			if (nPrevious == 0 && rt::FlushesDenormals())
+				m_nFlags.store(LOG_FLAG_FTZ, memory_order_relaxed);
+			m_nBlockFrames.store(nFrames, memory_order_release);
+			if (nPrevious != nFrames)
+			{
+				log_record r;
+				r.nSample = nSample;
+				r.nType = LOG_BLOCK;
+				r.nFrames = nFrames;
+				Record(r);
+			}
+			m_nEnd.store(nSample + nFrames, memory_order_relaxed);
+		}
+
+		uint64_t Records() const { return m_nRecords.load(memory_order_relaxed); }
+		uint64_t Dropped() const { return m_nDropped.load(memory_order_relaxed); }
+
+		// Reads a whole log. A log cut short, by a crash say, keeps what is complete.
+		static bool Read(const string& sFile, vector<log_record>& vecRecords, unsigned int& nSampleRate, unsigned int& nChannels, uint32_t& nFlags, string& sError)
+		{
+			ifstream f(sFile, ios::binary);
+			if (!f.is_open())
+			{
+				sError = "cannot open " + sFile;
+				return false;
+			}
+			vector<unsigned char> vecFile((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+			if (vecFile.size() < HEADER_BYTES || memcmp(vecFile.data(), "SSPL", 4) != 0)
+			{
+				sError = sFile + " is not a performance log";
+				return false;
+			}
+			if (GetU16(&vecFile[4]) != VERSION)
+			{
+				sError = sFile + ": unsupported log version " + to_string(GetU16(&vecFile[4]));
+				return false;
+			}
+			nChannels = GetU16(&vecFile[6]);
+			nSampleRate = GetU32(&vecFile[8]);
+			nFlags = GetU32(&vecFile[12]);
+
+			vecRecords.clear();
+			size_t nPos = HEADER_BYTES;
+			uint64_t nSample = 0;
+			while (nPos < vecFile.size())
+			{
+				log_record r;
+				uint64_t nDelta = 0, nValue = 0;
+				r.nType = vecFile[nPos++];
+				if (!GetVarint(vecFile, nPos, nDelta))
+					break;
+				nSample += nDelta;
+				r.nSample = nSample;
+
+				if (r.nType <= LOG_TRIGGER)
+				{
+					if (nPos >= vecFile.size())
+						break;
+					r.nInstrument = vecFile[nPos++];
+					if (!GetVarint(vecFile, nPos, nValue))
+						break;
+					r.nNoteID = (int32_t)(nValue >> 1) ^ -(int32_t)(nValue & 1);
+				}
+				else if (r.nType == LOG_BLOCK)
+				{
+					if (!GetVarint(vecFile, nPos, nValue))
+						break;
+					r.nFrames = (uint32_t)nValue;
+				}
+				else if (r.nType != LOG_END)
+				{
+					sError = sFile + ": unknown record type " + to_string(r.nType);
+					return false;
+				}
+				vecRecords.push_back(r);
+			}
+			return true;
+		}
+
+	private:
+		static const size_t HEADER_BYTES = 16;
+
+		rt::queue<log_record, 4096> m_queRecords;
+		atomic<bool> m_bRunning{ false };
+		atomic<uint64_t> m_nRecords{ 0 };
+		atomic<uint64_t> m_nDropped{ 0 };
+		atomic<uint64_t> m_nEnd{ 0 };
+		atomic<uint32_t> m_nBlockFrames{ 0 };
+		atomic<uint32_t> m_nFlags{ 0 };
+		thread m_thread;
+
+		// Writer thread only
+		ofstream m_file;
+		vector<unsigned char> m_vecBuffer;
+		uint64_t m_nPrevious = 0;
+		bool m_bFlagsWritten = false;
+
+		void WriteThread()
+		{
+			auto tFlushed = chrono::steady_clock::now();
+			while (m_bRunning)
+			{
+				Drain();
+				if (m_vecBuffer.size() >= 65536 || chrono::steady_clock::now() - tFlushed > chrono::milliseconds(250))
+				{
+					Flush();
+					tFlushed = chrono::steady_clock::now();
+				}
+				this_thread::sleep_for(chrono::milliseconds(5));
+			}
+			Drain();
+		}
+
+		void Drain()
+		{
+			log_record r;
+			while (m_queRecords.pop(r))
+			{
+				Encode(r);
+				m_nRecords.fetch_add(1, memory_order_relaxed);
+			}
+		}
+
+		void Encode(const log_record& r)
+		{
+			// The end is stamped by the last block, so it cannot be before a record
+			uint64_t nSample = max(r.nSample, m_nPrevious);
+			m_vecBuffer.push_back(r.nType);
+			PutVarint(nSample - m_nPrevious);
+			m_nPrevious = nSample;
+
+			if (r.nType <= LOG_TRIGGER)
+			{
+				m_vecBuffer.push_back(r.nInstrument);
+				PutVarint(((uint32_t)r.nNoteID << 1) ^ (uint32_t)(r.nNoteID >> 31));
+			}
+			else if (r.nType == LOG_BLOCK)
+				PutVarint(r.nFrames);
+		}
+
+		// Flags are only known once the audio thread has been seen, they go
+		// into the header then so a log cut short still replays to the bit
+		void Flush()
+		{
+			m_file.write((const char*)m_vecBuffer.data(), m_vecBuffer.size());
+			m_vecBuffer.clear();
+			if (!m_bFlagsWritten && m_nBlockFrames.load(memory_order_acquire) != 0)
+			{
+				unsigned char flags[4];
+				PutU32(flags, m_nFlags.load(memory_order_relaxed));
+				m_file.seekp(12);
+				m_file.write((const char*)flags, sizeof(flags));
+				m_file.seekp(0, ios::end);
+				m_bFlagsWritten = true;
+			}
+			m_file.flush();
+		}
+
+		void PutVarint(uint64_t n)
+		{
+			while (n >= 0x80)
+			{
+				m_vecBuffer.push_back((unsigned char)(n | 0x80));
+				n >>= 7;
+			}
+			m_vecBuffer.push_back((unsigned char)n);
+		}
+
+		static bool GetVarint(const vector<unsigned char>& vecFile, size_t& nPos, uint64_t& n)
+		{
+			n = 0;
+			for (int nShift = 0; nPos < vecFile.size() && nShift < 64; nShift += 7)
+			{
+				unsigned char c = vecFile[nPos++];
+				n |= (uint64_t)(c & 0x7F) << nShift;
+				if (!(c & 0x80))
+					return true;
+			}
+			return false;
+		}
+
+		static void PutU16(unsigned char* p, uint16_t n) { p[0] = (unsigned char)n; p[1] = (unsigned char)(n >> 8); }
+		static void PutU32(unsigned char* p, uint32_t n) { PutU16(p, (uint16_t)n); PutU16(p + 2, (uint16_t)(n >> 16)); }
+		static uint16_t GetU16(const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+		static uint32_t GetU32(const unsigned char* p) { return GetU16(p) | ((uint32_t)GetU16(p + 2) << 16); }
+	};
+}
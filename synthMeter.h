@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+#include "synthReverb.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Metering
+	//
+	// The audio thread copies each finished block into a ring and moves on. All
+	// of the measuring happens on whichever thread reads the ring, usually the UI.
+
+	// Single producer, single consumer ring of output samples. The writer never
+	// waits; a reader that falls more than the ring behind loses the oldest audio.
+	class output_tap : public olcNoiseTap
+	{
+	public:
+		// nCapacity samples, rounded up to a power of two
+		output_tap(size_t nCapacity = 65536)
+		{
+			size_t nSize = 1;
+			while (nSize < nCapacity)
+				nSize <<= 1;
+			m_vecRing.assign(nSize, 0.0);
+			m_nWritten = 0;
+			m_nWriting = 0;
+			m_nClipped = 0;
+			m_nChannels = 1;
+			m_nRead = 0;
+		}
+
+		// Audio thread: one copy, two where the ring wraps
+		virtual void Capture(const FTYPE* pBuffer, unsigned int nFrames, unsigned int nChannels, unsigned int nClipped) override
+		{
+			size_t nSize = m_vecRing.size();
+			size_t nSamples = min((size_t)nFrames * nChannels, nSize);
+			uint64_t nWritten = m_nWritten.load(memory_order_relaxed);
+			size_t nPos = (size_t)(nWritten & (nSize - 1));
+			size_t nFirst = min(nSamples, nSize - nPos);
+
+			// Announce the slots about to be overwritten before touching them
+			m_nWriting.store(nWritten + nSamples, memory_order_relaxed);
+			atomic_thread_fence(memory_order_release);
+			memcpy(&m_vecRing[nPos], pBuffer, nFirst * sizeof(FTYPE));
+			memcpy(&m_vecRing[0], pBuffer + nFirst, (nSamples - nFirst) * sizeof(FTYPE));
+
+			m_nChannels.store(nChannels, memory_order_relaxed);
+			m_nClipped.fetch_add(nClipped, memory_order_relaxed);
+			m_nWritten.store(nWritten + nSamples, memory_order_release);
+		}
+
+		// Reader: copies out the interleaved samples written since the last call,
+		// or only the newest nMax of them. Returns how many were copied.
+		size_t Read(FTYPE* pOut, size_t nMax)
+		{
+			size_t nSize = m_vecRing.size();
+			uint64_t nWritten = m_nWritten.load(memory_order_acquire);
+			uint64_t nFrom = max(m_nRead, nWritten - min(nWritten, (uint64_t)min(nMax, nSize)));
+			nFrom = AlignFrame(nFrom);
+			for (uint64_t i = nFrom; i < nWritten; i++)
+				pOut[i - nFrom] = m_vecRing[(size_t)(i & (nSize - 1))];
+
+			// Whatever the writer reached while we were copying may be torn, drop
+			// it. That includes a capture still in progress, it is counted from
+			// when it starts rather than when it is published.
+			atomic_thread_fence(memory_order_acquire);
+			uint64_t nNow = m_nWriting.load(memory_order_relaxed);
+			uint64_t nValid = nFrom;
+			if (nNow > nSize)
+				nValid = min(max(nFrom, AlignFrame(nNow - nSize)), nWritten);
+			if (nValid > nFrom)
+				memmove(pOut, pOut + (nValid - nFrom), (size_t)(nWritten - nValid) * sizeof(FTYPE));
+
+			m_nRead = nWritten;
+			return (size_t)(nWritten - nValid);
+		}
+
+		unsigned int Channels() const { return max(m_nChannels.load(memory_order_relaxed), 1u); }
+
+		// Samples clip() has limited since the tap was installed
+		uint64_t Clipped() const { return m_nClipped.load(memory_order_relaxed); }
+
+	private:
+		vector<FTYPE> m_vecRing;
+		atomic<uint64_t> m_nWritten;
+		atomic<uint64_t> m_nWriting;	// End of the capture in progress, or m_nWritten
+		atomic<uint64_t> m_nClipped;
+		atomic<unsigned int> m_nChannels;
+		uint64_t m_nRead;	// Reader only
+
+		// Rounds a sample count up to a frame boundary
+		uint64_t AlignFrame(uint64_t n) const
+		{
+			uint64_t nChannels = Channels();
+			return (n + nChannels - 1) / nChannels * nChannels;
+		}
+	};
+
+	// Peak, RMS and spectrum of the output, computed by the thread calling Update()
+	class meter
+	{
+	public:
+		static constexpr unsigned int MAX_CHANNELS = 8;
+
+		FTYPE dPeakFall = 0.9;		// Peak hold decay per Update()
+		FTYPE dRMSSmooth = 0.7;		// Weight of the previous RMS
+
+		// nFFTSize must be a power of two
+		void Create(FTYPE dSampleRate, unsigned int nFFTSize = 2048)
+		{
+			m_dSampleRate = dSampleRate;
+			m_nFFTSize = nFFTSize;
+			m_transform.Create(nFFTSize);
+			m_vecWindow.resize(nFFTSize);
+			FTYPE dWindowSum = 0.0;
+			for (unsigned int i = 0; i < nFFTSize; i++)
+			{
+				m_vecWindow[i] = 0.5 - 0.5 * cos(2.0 * PI * i / nFFTSize); // Hann
+				dWindowSum += m_vecWindow[i];
+			}
+			m_dNormalise = 2.0 / dWindowSum;
+			m_vecHistory.assign(nFFTSize, 0.0);
+			m_vecWork.assign(2 * (size_t)nFFTSize, 0.0);
+			m_vecSpectrum.assign(nFFTSize / 2, -120.0);
+			m_vecRead.assign(65536, 0.0);
+			for (unsigned int c = 0; c < MAX_CHANNELS; c++)
+				m_dPeak[c] = m_dRMS[c] = 0.0;
+		}
+
+		// Pulls whatever the tap has collected since last time
+		void Update(output_tap& tap)
+		{
+			size_t nSamples = tap.Read(m_vecRead.data(), m_vecRead.size());
+			unsigned int nChannels = min(tap.Channels(), MAX_CHANNELS);
+			m_nChannels = nChannels;
+			m_nClipped = tap.Clipped();
+			size_t nFrames = nSamples / tap.Channels();
+
+			for (unsigned int c = 0; c < nChannels; c++)
+			{
+				FTYPE dPeak = 0.0, dSquares = 0.0;
+				for (size_t n = 0; n < nFrames; n++)
+				{
+					FTYPE s = m_vecRead[n * tap.Channels() + c];
+					dPeak = max(dPeak, fabs(s));
+					dSquares += s * s;
+				}
+				m_dPeak[c] = max(dPeak, m_dPeak[c] * dPeakFall);
+				if (nFrames > 0)
+					m_dRMS[c] = m_dRMS[c] * dRMSSmooth + sqrt(dSquares / nFrames) * (1.0 - dRMSSmooth);
+			}
+
+			// Spectrum of the newest nFFTSize frames, channels summed
+			size_t nNew = min(nFrames, (size_t)m_nFFTSize);
+			move(m_vecHistory.begin() + nNew, m_vecHistory.end(), m_vecHistory.begin());
+			for (size_t n = 0; n < nNew; n++)
+			{
+				FTYPE dMono = 0.0;
+				size_t nFrame = nFrames - nNew + n;
+				for (unsigned int c = 0; c < tap.Channels(); c++)
+					dMono += m_vecRead[nFrame * tap.Channels() + c];
+				m_vecHistory[m_nFFTSize - nNew + n] = dMono / tap.Channels();
+			}
+
+			for (unsigned int i = 0; i < m_nFFTSize; i++)
+			{
+				m_vecWork[2 * i] = m_vecHistory[i] * m_vecWindow[i];
+				m_vecWork[2 * i + 1] = 0.0;
+			}
+			m_transform.Forward(m_vecWork.data());
+			for (unsigned int k = 0; k < m_nFFTSize / 2; k++)
+			{
+				FTYPE dMagnitude = hypot(m_vecWork[2 * k], m_vecWork[2 * k + 1]) * m_dNormalise;
+				m_vecSpectrum[k] = Decibels(dMagnitude);
+			}
+		}
+
+		FTYPE Peak(unsigned int nChannel = 0) const { return nChannel < m_nChannels ? m_dPeak[nChannel] : 0.0; }
+		FTYPE RMS(unsigned int nChannel = 0) const { return nChannel < m_nChannels ? m_dRMS[nChannel] : 0.0; }
+		uint64_t Clipped() const { return m_nClipped; }
+
+		// Magnitude in dB per bin, bin k centred on k * rate / nFFTSize
+		const vector<FTYPE>& Spectrum() const { return m_vecSpectrum; }
+
+		// Loudest bin between two frequencies, for drawing log spaced bands
+		FTYPE Band(FTYPE dLowHertz, FTYPE dHighHertz) const
+		{
+			FTYPE dBinHertz = m_dSampleRate / m_nFFTSize;
+			size_t nLow = min((size_t)(dLowHertz / dBinHertz), m_vecSpectrum.size() - 1);
+			size_t nHigh = min(max((size_t)(dHighHertz / dBinHertz), nLow + 1), m_vecSpectrum.size());
+			return *max_element(m_vecSpectrum.begin() + nLow, m_vecSpectrum.begin() + nHigh);
+		}
+
+		static FTYPE Decibels(FTYPE dLevel)
+		{
+			return dLevel > 1e-6 ? 20.0 * log10(dLevel) : -120.0;
+		}
+
+	private:
+		FTYPE m_dSampleRate = 44100.0;
+		unsigned int m_nFFTSize = 0;
+		unsigned int m_nChannels = 0;
+		uint64_t m_nClipped = 0;
+		FTYPE m_dPeak[MAX_CHANNELS];
+		FTYPE m_dRMS[MAX_CHANNELS];
+		FTYPE m_dNormalise = 1.0;
+
+		fft m_transform;
+		vector<FTYPE> m_vecWindow;
+		vector<FTYPE> m_vecHistory;		// Newest nFFTSize mono frames
+		vector<FTYPE> m_vecWork;
+		vector<FTYPE> m_vecSpectrum;
+		vector<FTYPE> m_vecRead;
+	};
+}
@@ -0,0 +1,514 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdarg>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+using namespace std;
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#include <WinSock2.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+#include "olcNoiseMaker.h"
+#include "synthEngine.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Open Sound Control
+	//
+	// A UDP endpoint on localhost that turns OSC messages into note events:
+	//
+	//   /synth/note_on  <instrument> <note>
+	//   /synth/note_off <instrument> <note>
+	//   /synth/trigger  <instrument> <note>
+	//
+	// The instrument is a string as accepted by engine::FindInstrument(), the note
+	// an int32 or float32. Messages inside a bundle are scheduled for the bundle's
+	// time tag, to the sample; bare messages and the "immediately" tag play in the
+	// next block. Packets are parsed in place, nothing is allocated per packet.
+
+	// NTP time tags, seconds since 1900 in 32.32 fixed point
+	const uint64_t OSC_IMMEDIATELY = 1;
+
+	inline double OscNow()
+	{
+		auto tNow = chrono::system_clock::now().time_since_epoch();
+		return chrono::duration<double>(tNow).count() + 2208988800.0; // 1900 to 1970
+	}
+
+	inline uint64_t OscTimeTag(double dSeconds)
+	{
+		double dWhole = floor(dSeconds);
+		return ((uint64_t)dWhole << 32) | (uint64_t)((dSeconds - dWhole) * 4294967296.0);
+	}
+
+	inline double OscSeconds(uint64_t nTimeTag)
+	{
+		return (double)(nTimeTag >> 32) + (double)(nTimeTag & 0xFFFFFFFF) / 4294967296.0;
+	}
+
+	// Builds OSC packets into a fixed buffer, for clients and tests. Anything
+	// that does not fit, the buffer or the limits below, leaves Size() at 0.
+	class osc_writer
+	{
+	public:
+		static constexpr int MAX_BUNDLE_DEPTH = 8;
+		static constexpr size_t MAX_TYPES = 14;	// Arguments a message, the tag string has room for 16 bytes
+
+		osc_writer(char* pBuffer, size_t nCapacity)
+		{
+			m_pBuffer = pBuffer;
+			m_nCapacity = nCapacity;
+			m_nSize = 0;
+			m_nBundleDepth = 0;
+			m_bOverflow = false;
+		}
+
+		void BeginBundle(uint64_t nTimeTag)
+		{
+			if (m_nBundleDepth == MAX_BUNDLE_DEPTH)
+			{
+				m_bOverflow = true;
+				return;
+			}
+			if (m_nBundleDepth > 0)
+				m_nElementStart[m_nBundleDepth - 1] = Reserve();
+			String("#bundle");
+			Int64(nTimeTag);
+			m_nBundleDepth++;
+		}
+
+		void EndBundle()
+		{
+			if (m_nBundleDepth > 0 && --m_nBundleDepth > 0)
+				Patch(m_nElementStart[m_nBundleDepth - 1]);
+		}
+
+		// sTypes uses 's' for const char* and 'i' for int arguments
+		void Message(const char* sAddress, const char* sTypes, ...)
+		{
+			if (strlen(sTypes) > MAX_TYPES)
+			{
+				m_bOverflow = true;
+				return;
+			}
+			size_t nStart = m_nBundleDepth > 0 ? Reserve() : 0;
+			String(sAddress);
+			char sTags[16] = ",";
+			strcat(sTags, sTypes);
+			String(sTags);
+
+			va_list args;
+			va_start(args, sTypes);
+			for (const char* t = sTypes; *t; t++)
+			{
+				if (*t == 's') String(va_arg(args, const char*));
+				else if (*t == 'i') Int32((uint32_t)va_arg(args, int));
+			}
+			va_end(args);
+
+			if (m_nBundleDepth > 0)
+				Patch(nStart);
+		}
+
+		size_t Size() const { return m_bOverflow ? 0 : m_nSize; }
+		void Clear() { m_nSize = 0; m_nBundleDepth = 0; m_bOverflow = false; }
+
+	private:
+		void Bytes(const void* p, size_t n)
+		{
+			if (m_nSize + n > m_nCapacity) { m_bOverflow = true; return; }
+			memcpy(m_pBuffer + m_nSize, p, n);
+			m_nSize += n;
+		}
+
+		// Null terminated, padded to four bytes
+		void String(const char* s)
+		{
+			size_t n = strlen(s);
+			Bytes(s, n);
+			const char zeros[4] = { 0, 0, 0, 0 };
+			Bytes(zeros, 4 - (n & 3));
+		}
+
+		void Int32(uint32_t n)
+		{
+			unsigned char b[4] = { (unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n };
+			Bytes(b, 4);
+		}
+
+		void Int64(uint64_t n)
+		{
+			Int32((uint32_t)(n >> 32));
+			Int32((uint32_t)n);
+		}
+
+		// Bundle elements are prefixed with their size, filled in once known
+		size_t Reserve()
+		{
+			size_t nAt = m_nSize;
+			Int32(0);
+			return nAt;
+		}
+
+		void Patch(size_t nAt)
+		{
+			if (m_bOverflow)
+				return;
+			uint32_t n = (uint32_t)(m_nSize - nAt - 4);
+			unsigned char b[4] = { (unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8), (unsigned char)n };
+			memcpy(m_pBuffer + nAt, b, 4);
+		}
+
+		char* m_pBuffer;
+		size_t m_nCapacity;
+		size_t m_nSize;
+		size_t m_nElementStart[MAX_BUNDLE_DEPTH];
+		int m_nBundleDepth;
+		bool m_bOverflow;
+	};
+
+	// Receives OSC over UDP on its own thread and feeds the engine's event queue
+	class osc_endpoint
+	{
+	public:
+		FTYPE dLead = 0.02;		// Added to every time tag, to absorb network and scheduling jitter
+
+		// Counters, readable from any thread
+		atomic<uint64_t> nPackets;
+		atomic<uint64_t> nMessages;
+		atomic<uint64_t> nQueued;
+		atomic<uint64_t> nDropped;		// Engine queue was full
+		atomic<uint64_t> nRejected;		// Malformed, or unknown address or instrument
+
+	public:
+		osc_endpoint(engine& e) : m_engine(e)
+		{
+			m_socket = INVALID_SOCKET;
+			m_bRunning = false;
+			m_bSynced = false;
+			m_dOffset = 0.0;
+			nPackets = nMessages = nQueued = nDropped = nRejected = 0;
+		}
+
+		~osc_endpoint()
+		{
+			Stop();
+		}
+
+		// Listens on 127.0.0.1:nPort
+		bool Start(unsigned short nPort, string& sError)
+		{
+#ifdef _WIN32
+			WSADATA wsa;
+			if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+			{
+				sError = "WSAStartup failed";
+				return false;
+			}
+#endif
+			m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+			if (m_socket == INVALID_SOCKET)
+			{
+				sError = "cannot create socket";
+				return false;
+			}
+
+			// Room for bursts, and a timeout so the thread notices Stop()
+			int nBuffer = 1 << 20;
+			setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, (const char*)&nBuffer, sizeof(nBuffer));
+#ifdef _WIN32
+			DWORD dwTimeout = 100;
+			setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&dwTimeout, sizeof(dwTimeout));
+#else
+			timeval tv = { 0, 100000 };
+			setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+#endif
+
+			sockaddr_in addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(nPort);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			if (::bind(m_socket, (sockaddr*)&addr, sizeof(addr)) != 0)
+			{
+				sError = "cannot bind port " + to_string(nPort);
+				closesocket(m_socket);
+				m_socket = INVALID_SOCKET;
+				return false;
+			}
+
+			m_bRunning = true;
+			m_thread = thread(&osc_endpoint::ReceiveThread, this);
+			return true;
+		}
+
+		void Stop()
+		{
+			m_bRunning = false;
+			if (m_thread.joinable())
+				m_thread.join();
+			if (m_socket != INVALID_SOCKET)
+			{
+				closesocket(m_socket);
+				m_socket = INVALID_SOCKET;
+#ifdef _WIN32
+				WSACleanup();
+#endif
+			}
+		}
+
+		// One datagram, received at OSC time dNow. Public so packets can be fed
+		// in without a socket.
+		void HandlePacket(const char* pData, size_t nSize, double dNow)
+		{
+			nPackets++;
+
+			// Map OSC time onto engine time. The engine clock moves in whole blocks,
+			// so the offset is smoothed rather than taken from any one packet.
+			double dOffset = (double)m_engine.GetTime() - dNow;
+			if (!m_bSynced)
+			{
+				m_dOffset = dOffset;
+				m_bSynced = true;
+			}
+			else
+				m_dOffset += (dOffset - m_dOffset) * 0.01;
+
+			if (!ParseElement(pData, nSize, OSC_IMMEDIATELY, 0))
+				nRejected++;
+		}
+
+	private:
+		static uint32_t ReadU32(const char* p)
+		{
+			const unsigned char* u = (const unsigned char*)p;
+			return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+		}
+
+		// Length of the padded string at p, or 0 if it runs off the end
+		static size_t StringSize(const char* p, size_t nSize)
+		{
+			const char* pEnd = (const char*)memchr(p, 0, nSize);
+			if (pEnd == nullptr)
+				return 0;
+			size_t n = (pEnd - p + 4) & ~(size_t)3;
+			return n <= nSize ? n : 0;
+		}
+
+		bool ParseElement(const char* p, size_t nSize, uint64_t nTimeTag, int nDepth)
+		{
+			if (nSize < 4 || (nSize & 3) != 0 || nDepth > 8)
+				return false;
+
+			if (nSize >= 16 && memcmp(p, "#bundle", 8) == 0)
+			{
+				uint64_t nTag = ((uint64_t)ReadU32(p + 8) << 32) | ReadU32(p + 12);
+				size_t nPos = 16;
+				bool bOk = true;
+				while (nPos + 4 <= nSize)
+				{
+					size_t nElement = ReadU32(p + nPos);
+					if (nElement > nSize - nPos - 4)
+						return false;
+					bOk &= ParseElement(p + nPos + 4, nElement, nTag, nDepth + 1);
+					nPos += 4 + nElement;
+				}
+				return bOk;
+			}
+
+			return ParseMessage(p, nSize, nTimeTag);
+		}
+
+		bool ParseMessage(const char* p, size_t nSize, uint64_t nTimeTag)
+		{
+			nMessages++;
+
+			size_t nAddress = StringSize(p, nSize);
+			if (nAddress == 0 || p[0] != '/')
+				return false;
+			const char* sAddress = p;
+			p += nAddress;
+			nSize -= nAddress;
+
+			size_t nTags = StringSize(p, nSize);
+			if (nTags == 0 || p[0] != ',')
+				return false;
+			const char* sTags = p + 1;
+			p += nTags;
+			nSize -= nTags;
+
+			// Arguments: an instrument name then a note number
+			const char* sInstrument = nullptr;
+			int nNote = 0;
+			int nArg = 0;
+			for (const char* t = sTags; *t; t++, nArg++)
+			{
+				if (*t == 's')
+				{
+					size_t n = StringSize(p, nSize);
+					if (n == 0)
+						return false;
+					if (nArg == 0)
+						sInstrument = p;
+					p += n;
+					nSize -= n;
+				}
+				else if (*t == 'i' || *t == 'f')
+				{
+					if (nSize < 4)
+						return false;
+					uint32_t nRaw = ReadU32(p);
+					if (nArg == 1)
+					{
+						if (*t == 'i')
+							nNote = (int)(int32_t)nRaw;
+						else
+						{
+							float f;
+							memcpy(&f, &nRaw, sizeof(f));
+							nNote = (int)lround(f);
+						}
+					}
+					p += 4;
+					nSize -= 4;
+				}
+				else
+					return false; // Nothing else is used, and its size is unknown
+			}
+
+			if (sInstrument == nullptr || nArg < 2)
+				return false;
+			instrument_base* pInstrument = m_engine.FindInstrument(sInstrument);
+			if (pInstrument == nullptr)
+				return false;
+
+			FTYPE dWhen = 0.0;
+			if (nTimeTag != OSC_IMMEDIATELY)
+				dWhen = (FTYPE)(OscSeconds(nTimeTag) + m_dOffset + dLead);
+
+			bool bQueued;
+			if (strcmp(sAddress, "/synth/note_on") == 0)
+				bQueued = m_engine.NoteOn(nNote, pInstrument, dWhen);
+			else if (strcmp(sAddress, "/synth/note_off") == 0)
+				bQueued = m_engine.NoteOff(nNote, pInstrument, dWhen);
+			else if (strcmp(sAddress, "/synth/trigger") == 0)
+				bQueued = m_engine.Trigger(nNote, pInstrument, dWhen);
+			else
+				return false;
+
+			if (bQueued)
+				nQueued++;
+			else
+				nDropped++;
+			return true;
+		}
+
+		void ReceiveThread()
+		{
+			while (m_bRunning)
+			{
+				int nReceived = (int)recv(m_socket, m_buffer, sizeof(m_buffer), 0);
+				if (nReceived > 0)
+					HandlePacket(m_buffer, (size_t)nReceived, OscNow());
+			}
+		}
+
+		engine& m_engine;
+		SOCKET m_socket;
+		thread m_thread;
+		atomic<bool> m_bRunning;
+		bool m_bSynced;
+		double m_dOffset;			// Engine time minus OSC time
+		char m_buffer[65536];
+	};
+
+	// Sends nEventsPerSecond through a loopback socket into a running engine for
+	// dSeconds, as 100 timestamped bundles a second, then reports what arrived
+	inline int RunOscLoopbackTest(unsigned short nPort = 9000, unsigned int nEventsPerSecond = 10000, double dSeconds = 5.0)
+	{
+		engine e(44100);
+		olcNoiseMaker<short> sound(olcNoiseMaker<short>::Enumerate()[0], 44100, 1, 8, 256);
+		sound.SetUserSource(&e);
+
+		osc_endpoint endpoint(e);
+		string sError;
+		if (!endpoint.Start(nPort, sError))
+		{
+			cerr << "OSC: " << sError << endl;
+			return 1;
+		}
+
+		SOCKET client = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(nPort);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		// Each packet covers the next 10ms as a bundle of bundles, one per time
+		// slot: a hihat hit and a bell note switched on and off on the same sample
+		const int nBundlesPerSecond = 100;
+		unsigned int nSlots = max(nEventsPerSecond / nBundlesPerSecond / 3, 1u);
+		static char buffer[65536];
+		uint64_t nSent = 0;
+
+		auto tStart = chrono::steady_clock::now();
+		for (int b = 0; b < (int)(dSeconds * nBundlesPerSecond); b++)
+		{
+			this_thread::sleep_until(tStart + chrono::microseconds(b * 1000000 / nBundlesPerSecond));
+
+			osc_writer w(buffer, sizeof(buffer));
+			double dNow = OscNow();
+			w.BeginBundle(OscTimeTag(dNow));
+			for (unsigned int i = 0; i < nSlots; i++)
+			{
+				w.BeginBundle(OscTimeTag(dNow + (double)i / nSlots / nBundlesPerSecond));
+				w.Message("/synth/trigger", "si", "hihat", 0);
+				w.Message("/synth/note_on", "si", "bell", 64 + i % 16);
+				w.Message("/synth/note_off", "si", "bell", 64 + i % 16);
+				w.EndBundle();
+			}
+			w.EndBundle();
+
+			if (w.Size() > 0 && sendto(client, buffer, (int)w.Size(), 0, (sockaddr*)&addr, sizeof(addr)) > 0)
+				nSent += nSlots * 3;
+		}
+		this_thread::sleep_for(chrono::milliseconds(200));
+		double dElapsed = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+
+		const engine::snapshot& state = e.GetSnapshot();
+		cout << fixed << setprecision(0)
+			<< "OSC loopback on port " << nPort << ", " << dElapsed << "s" << endl
+			<< "  sent      " << nSent << " events (" << nSent / dSeconds << "/s)" << endl
+			<< "  packets   " << endpoint.nPackets << endl
+			<< "  messages  " << endpoint.nMessages << endl
+			<< "  queued    " << endpoint.nQueued << endl
+			<< "  dropped   " << endpoint.nDropped << " (engine queue full)" << endl
+			<< "  rejected  " << endpoint.nRejected << endl
+			<< "  late      " << state.nLateEvents << " (arrived after their sample was rendered)" << endl;
+
+		closesocket(client);
+		endpoint.Stop();
+		sound.Stop();
+		return endpoint.nQueued == nSent && state.nLateEvents == 0 ? 0 : 1;
+	}
+}
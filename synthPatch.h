@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Instrument patches
+	//
+	// An instrument described in text rather than code: oscillators at an offset
+	// from the note, each with a weight and optionally an LFO, under one ADSR
+	// envelope. One statement per line, '#' starts a comment:
+	//
+	//     name <text>
+	//     volume <level>
+	//     envelope <attack> <decay> <sustain> <release> [<start level>]
+	//     lifetime <seconds>		Notes end this long after they start
+	//     osc <wave> <semitones> <weight> [lfo <hertz> <depth>]
+	//
+	// Waves are sine, square, triangle, saw (band limited) and noise, which has
+	// no pitch. The LFO wobbles the phase the same way osc()'s does. A patch is
+	// compiled into a flat array of ops, grouped by wave, that instrument_patch
+	// runs a block at a time.
+
+	const uint8_t PATCH_SINE = 0;
+	const uint8_t PATCH_SQUARE = 1;
+	const uint8_t PATCH_TRIANGLE = 2;
+	const uint8_t PATCH_SAW = 3;
+	const uint8_t PATCH_NOISE = 4;
+
+	// One oscillator, everything the interpreter needs for it in 20 bytes
+	struct patch_op
+	{
+		uint8_t nWave = PATCH_SINE;
+		float fRatio = 1.0f;		// Frequency over the note's
+		float fWeight = 1.0f;
+		float fLFOHertz = 0.0f;
+		float fLFODepth = 0.0f;		// Phase swing in radians per hertz of the oscillator
+	};
+
+	struct patch_program
+	{
+		static const int MAX_OPS = 16;
+
+		string sName;
+		FTYPE dVolume = 1.0;
+		FTYPE dAttack = 0.1, dDecay = 0.1, dSustain = 1.0, dRelease = 0.2, dStart = 1.0;
+		FTYPE dLifeTime = -1.0;		// Negative for notes that last as long as they are held
+		vector<patch_op> vecOps;
+	};
+
+	inline bool PatchWave(const string& sWave, uint8_t& nWave)
+	{
+		static const char* sWaves[] = { "sine", "square", "triangle", "saw", "noise" };
+		for (uint8_t n = 0; n < 5; n++)
+			if (sWave == sWaves[n])
+			{
+				nWave = n;
+				return true;
+			}
+		return false;
+	}
+
+	// sSource names the text in error messages
+	inline bool CompilePatch(const string& sText, const string& sSource, patch_program& program, string& sError)
+	{
+		program = patch_program();
+		istringstream text(sText);
+		string sLine;
+		int nLine = 0;
+		while (getline(text, sLine))
+		{
+			nLine++;
+			sLine = sLine.substr(0, sLine.find('#'));
+			istringstream line(sLine);
+			string sWord;
+			if (!(line >> sWord))
+				continue;
+
+			string sWhere = sSource + ":" + to_string(nLine) + ": ";
+			bool bOk = true;
+			if (sWord == "name")
+			{
+				getline(line >> ws, program.sName);
+				program.sName.erase(program.sName.find_last_not_of(" \t\r") + 1);
+				bOk = !program.sName.empty();
+			}
+			else if (sWord == "volume")
+				bOk = (bool)(line >> program.dVolume);
+			else if (sWord == "lifetime")
+				bOk = (bool)(line >> program.dLifeTime);
+			else if (sWord == "envelope")
+			{
+				bOk = (bool)(line >> program.dAttack >> program.dDecay >> program.dSustain >> program.dRelease);
+				if (bOk && !(line >> program.dStart))
+					program.dStart = 1.0;
+				bOk = bOk && program.dAttack >= 0.0 && program.dDecay >= 0.0 && program.dRelease >= 0.0;
+			}
+			else if (sWord == "osc")
+			{
+				if (program.vecOps.size() >= patch_program::MAX_OPS)
+				{
+					sError = sWhere + "more than " + to_string(patch_program::MAX_OPS) + " oscillators";
+					return false;
+				}
+				patch_op op;
+				string sWave, sLFO;
+				FTYPE dSemitones = 0.0, dWeight = 0.0, dLFOHertz = 0.0, dLFODepth = 0.0;
+				bOk = (bool)(line >> sWave >> dSemitones >> dWeight) && PatchWave(sWave, op.nWave);
+				if (bOk && line >> sLFO)
+					bOk = sLFO == "lfo" && (bool)(line >> dLFOHertz >> dLFODepth);
+				op.fRatio = (float)pow(1.0594630943592952645618252949463, dSemitones);	// As scale() steps
+				op.fWeight = (float)dWeight;
+				op.fLFOHertz = (float)dLFOHertz;
+				op.fLFODepth = (float)dLFODepth;
+				program.vecOps.push_back(op);
+			}
+			else
+			{
+				sError = sWhere + "unknown statement '" + sWord + "'";
+				return false;
+			}
+
+			if (!bOk)
+			{
+				sError = sWhere + "cannot read '" + sLine + "'";
+				return false;
+			}
+		}
+
+		// Like next to like, the interpreter switches once per op and block
+		stable_sort(program.vecOps.begin(), program.vecOps.end(), [](const patch_op& a, const patch_op& b) { return a.nWave < b.nWave; });
+		return true;
+	}
+
+	inline bool ReadText(const string& sFile, string& sText, string& sError)
+	{
+		ifstream f(sFile, ios::binary);
+		if (!f.is_open())
+		{
+			sError = "cannot open " + sFile;
+			return false;
+		}
+		sText.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+		return true;
+	}
+
+	// The hard coded instruments as patches
+	const char* const PATCH_BELL =
+		"name bell\n"
+		"envelope 0.01 1.0 0.0 1.0\n"
+		"osc sine 12 1.00 lfo 5.0 0.001\n"
+		"osc sine 24 0.50\n"
+		"osc sine 36 0.25\n";
+
+	const char* const PATCH_BELL8 =
+		"name bell8\n"
+		"envelope 0.01 0.5 0.8 1.0\n"
+		"osc square 0 1.00 lfo 5.0 0.001\n"
+		"osc sine 12 0.50\n"
+		"osc sine 24 0.25\n";
+
+	const char* const PATCH_HARMONICA =
+		"name harmonica\n"
+		"volume 0.3\n"
+		"envelope 0.0 1.0 0.95 0.1\n"
+		"osc saw -12 1.00 lfo 5.0 0.001\n"
+		"osc square 0 1.00 lfo 5.0 0.001\n"
+		"osc square 12 0.50\n"
+		"osc noise 24 0.05\n";
+
+	const char* const PATCH_KICK =
+		"name kick\n"
+		"envelope 0.01 0.15 0.0 0.0\n"
+		"lifetime 1.5\n"
+		"osc sine -36 0.99 lfo 1.0 1.0\n"
+		"osc noise 0 0.01\n";
+
+	const char* const PATCH_SNARE =
+		"name snare\n"
+		"envelope 0.0 0.2 0.0 0.0\n"
+		"lifetime 1.0\n"
+		"osc sine -24 0.5 lfo 0.5 1.0\n"
+		"osc noise 0 0.5\n";
+
+	const char* const PATCH_HIHAT =
+		"name hihat\n"
+		"volume 0.5\n"
+		"envelope 0.01 0.05 0.0 0.0\n"
+		"lifetime 1.0\n"
+		"osc square -12 0.1 lfo 1.5 1.0\n"
+		"osc noise 0 0.9\n";
+}
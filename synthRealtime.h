@@ -0,0 +1,314 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <mutex>
+using namespace std;
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+
+// Debug builds watch the render path for anything that can block: heap
+// allocation and mutex locking. Define SYNTH_RT_CHECKS to get it in other builds.
+//
+// What is seen depends on the platform. With glibc every malloc, calloc,
+// realloc, free and pthread mutex lock, including those inside the C++
+// library. With the MSVC debug CRT every heap call. Everywhere else only
+// operator new and delete. Locks are always seen on rt::checked_mutex, which
+// is what synth code locks with.
+#if defined(_DEBUG) && !defined(SYNTH_RT_CHECKS)
+#define SYNTH_RT_CHECKS
+#endif
+
+#if defined(SYNTH_RT_CHECKS) && defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+
+#if defined(SYNTH_RT_CHECKS) && defined(__GLIBC__)
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Real-time support
+
+	namespace rt
+	{
+		// Set while the current thread is inside the render path
+		inline bool& InRealtime()
+		{
+			static thread_local bool bInRealtime = false;
+			return bInRealtime;
+		}
+
+		inline atomic<unsigned int>& Violations()
+		{
+			static atomic<unsigned int> nViolations(0);
+			return nViolations;
+		}
+
+		inline atomic<const char*>& LastViolation()
+		{
+			static atomic<const char*> sLastViolation(nullptr);
+			return sLastViolation;
+		}
+
+		// Records a forbidden call made from the render path. Only atomics are
+		// touched, as this may run inside the allocator itself.
+		inline void Check(const char* sWhat)
+		{
+			if (InRealtime())
+			{
+				Violations()++;
+				LastViolation() = sWhat;
+			}
+		}
+
+		// Marks the render path for the lifetime of the object
+		struct scope
+		{
+			scope() { m_bOuter = InRealtime(); InRealtime() = true; }
+			~scope() { InRealtime() = m_bOuter; }
+			bool m_bOuter;
+		};
+
+		// A std::mutex whose locks count as violations on the render path, on
+		// every platform. glibc builds already see the pthread call underneath.
+		class checked_mutex
+		{
+		public:
+			void lock()
+			{
+#ifndef __GLIBC__
+				Check("mutex lock");
+#endif
+				m_mutex.lock();
+			}
+
+			bool try_lock()
+			{
+#ifndef __GLIBC__
+				Check("mutex lock");
+#endif
+				return m_mutex.try_lock();
+			}
+
+			void unlock() { m_mutex.unlock(); }
+
+		private:
+			std::mutex m_mutex;
+		};
+
+		// Bounded lock-free queue for many producers and one consumer. Producers
+		// never wait, a push into a full queue fails instead.
+		template<class T, size_t N>
+		class queue
+		{
+			static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+		public:
+			queue()
+			{
+				for (size_t i = 0; i < N; i++)
+					m_slots[i].nSequence = i;
+				m_nHead = 0;
+				m_nTail = 0;
+			}
+
+			bool push(const T& item)
+			{
+				size_t nPos = m_nTail.load(memory_order_relaxed);
+				for (;;)
+				{
+					slot& s = m_slots[nPos & (N - 1)];
+					size_t nSeq = s.nSequence.load(memory_order_acquire);
+					intptr_t nDiff = (intptr_t)nSeq - (intptr_t)nPos;
+					if (nDiff == 0)
+					{
+						if (m_nTail.compare_exchange_weak(nPos, nPos + 1, memory_order_relaxed))
+						{
+							s.item = item;
+							s.nSequence.store(nPos + 1, memory_order_release);
+							return true;
+						}
+					}
+					else if (nDiff < 0)
+						return false; // Full
+					else
+						nPos = m_nTail.load(memory_order_relaxed);
+				}
+			}
+
+			bool pop(T& item)
+			{
+				size_t nPos = m_nHead.load(memory_order_relaxed);
+				slot& s = m_slots[nPos & (N - 1)];
+				if ((intptr_t)s.nSequence.load(memory_order_acquire) - (intptr_t)(nPos + 1) < 0)
+					return false; // Empty
+				item = s.item;
+				s.nSequence.store(nPos + N, memory_order_release);
+				m_nHead.store(nPos + 1, memory_order_relaxed);
+				return true;
+			}
+
+		private:
+			struct slot
+			{
+				atomic<size_t> nSequence;
+				T item;
+			};
+
+			slot m_slots[N];
+			alignas(64) atomic<size_t> m_nHead;
+			alignas(64) atomic<size_t> m_nTail;
+		};
+
+		// Latest-value hand over from one writer thread to one reader thread. The
+		// writer fills Back() and publishes it, the reader always gets the newest
+		// complete copy. Neither side ever waits for the other.
+		template<class T>
+		class triple_buffer
+		{
+		public:
+			triple_buffer()
+			{
+				m_nMiddle = 0;
+				m_nBack = 1;
+				m_nFront = 2;
+			}
+
+			T& Back()
+			{
+				return m_buffers[m_nBack];
+			}
+
+			void Publish()
+			{
+				m_nBack = m_nMiddle.exchange(m_nBack | FRESH, memory_order_acq_rel) & INDEX;
+			}
+
+			// Newest published value, or the previous one again if nothing new
+			const T& Read()
+			{
+				if (m_nMiddle.load(memory_order_relaxed) & FRESH)
+					m_nFront = m_nMiddle.exchange(m_nFront, memory_order_acq_rel) & INDEX;
+				return m_buffers[m_nFront];
+			}
+
+		private:
+			enum { INDEX = 3, FRESH = 4 };
+			T m_buffers[3];
+			atomic<int> m_nMiddle;
+			int m_nBack;	// Writer only
+			int m_nFront;	// Reader only
+		};
+
+		// Whether this thread flushes denormals to zero. The realtime audio thread
+		// does, and a render only matches it to the bit when it does too.
+		inline bool FlushesDenormals()
+		{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+			return (_mm_getcsr() & 0x8040) == 0x8040;
+#elif defined(__aarch64__)
+			uint64_t fpcr;
+			__asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+			return (fpcr & (1 << 24)) != 0;
+#else
+			return false;
+#endif
+		}
+
+		inline void FlushDenormals(bool bFlush)
+		{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+			_mm_setcsr(bFlush ? _mm_getcsr() | 0x8040 : _mm_getcsr() & ~0x8040u);
+#elif defined(__aarch64__)
+			uint64_t fpcr;
+			__asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+			fpcr = bFlush ? fpcr | (1 << 24) : fpcr & ~(uint64_t)(1 << 24);
+			__asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr));
+#else
+			(void)bFlush;
+#endif
+		}
+
+#if defined(SYNTH_RT_CHECKS) && defined(_MSC_VER) && defined(_DEBUG)
+		// The debug CRT reports every malloc/realloc/free here
+		inline int __cdecl AllocHook(int, void*, size_t, int, long, const unsigned char*, int)
+		{
+			Check("heap allocation");
+			return TRUE;
+		}
+
+		struct install_alloc_hook
+		{
+			install_alloc_hook() { _CrtSetAllocHook(AllocHook); }
+		};
+		static install_alloc_hook installAllocHook;
+#endif
+	}
+}
+
+#if defined(SYNTH_RT_CHECKS) && defined(__GLIBC__)
+// glibc lets the executable interpose the allocator and pthreads, which catches
+// every malloc and every std::mutex lock, including those inside the library.
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void __libc_free(void*);
+
+extern "C" void* malloc(size_t nSize)
+{
+	synth::rt::Check("malloc");
+	return __libc_malloc(nSize);
+}
+
+extern "C" void* calloc(size_t nCount, size_t nSize)
+{
+	synth::rt::Check("calloc");
+	return __libc_calloc(nCount, nSize);
+}
+
+extern "C" void* realloc(void* p, size_t nSize)
+{
+	synth::rt::Check("realloc");
+	return __libc_realloc(p, nSize);
+}
+
+extern "C" void free(void* p)
+{
+	synth::rt::Check("free");
+	__libc_free(p);
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* pMutex)
+{
+	typedef int(*lock_fn)(pthread_mutex_t*);
+	static lock_fn pRealLock = nullptr; // No static init guard, that would lock
+	synth::rt::Check("pthread_mutex_lock");
+	if (pRealLock == nullptr)
+		pRealLock = (lock_fn)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+	return pRealLock(pMutex);
+}
+#elif defined(SYNTH_RT_CHECKS) && !(defined(_MSC_VER) && defined(_DEBUG))
+// Elsewhere, MSVC release builds included, only C++ allocations can be seen
+void* operator new(size_t nSize)
+{
+	synth::rt::Check("operator new");
+	void* p = malloc(nSize);
+	if (p == nullptr)
+		throw bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	synth::rt::Check("operator delete");
+	free(p);
+}
+#endif
@@ -0,0 +1,583 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+#include "synthWave.h"
+#include "synthRealtime.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Convolution reverb
+	//
+	// Uniformly partitioned overlap-save convolution. The impulse response is cut
+	// into block sized partitions which are transformed once, on load. Every block
+	// of input is transformed once too, after which each partition costs a single
+	// spectrum multiply-add against the history of input spectra.
+	//
+	// Long responses can optionally move everything past the first few partitions
+	// into a tail level with partitions TAIL_RATIO blocks long. The tail has a
+	// whole tail partition of time to produce each result, so its transforms and
+	// multiply-adds are sliced up and done a little in every block rather than all
+	// at once in one of them.
+
+	// In place radix-2 complex FFT on interleaved re/im pairs
+	class fft
+	{
+	public:
+		void Create(size_t nSize)
+		{
+			m_nSize = nSize;
+			unsigned int nBits = 0;
+			while (((size_t)1 << nBits) < nSize)
+				nBits++;
+
+			m_vecTwiddle.resize(nSize);
+			for (size_t k = 0; k < nSize / 2; k++)
+			{
+				m_vecTwiddle[2 * k] = cos(2.0 * PI * k / nSize);
+				m_vecTwiddle[2 * k + 1] = -sin(2.0 * PI * k / nSize);
+			}
+
+			m_vecReverse.resize(nSize);
+			for (size_t i = 0; i < nSize; i++)
+			{
+				size_t r = 0;
+				for (unsigned int b = 0; b < nBits; b++)
+					if (i & ((size_t)1 << b))
+						r |= (size_t)1 << (nBits - 1 - b);
+				m_vecReverse[i] = r;
+			}
+		}
+
+		size_t Size() const { return m_nSize; }
+
+		void Forward(FTYPE* p) { Transform(p, 1.0); }
+
+		// Unscaled, so Inverse(Forward(x)) is Size() * x
+		void Inverse(FTYPE* p) { Transform(p, -1.0); }
+
+	private:
+		void Transform(FTYPE* p, FTYPE dSign)
+		{
+			for (size_t i = 0; i < m_nSize; i++)
+			{
+				size_t r = m_vecReverse[i];
+				if (r > i)
+				{
+					swap(p[2 * i], p[2 * r]);
+					swap(p[2 * i + 1], p[2 * r + 1]);
+				}
+			}
+
+			for (size_t nHalf = 1; nHalf < m_nSize; nHalf <<= 1)
+			{
+				size_t nStride = m_nSize / (2 * nHalf);
+				for (size_t k = 0; k < nHalf; k++)
+				{
+					FTYPE wr = m_vecTwiddle[2 * k * nStride], wi = dSign * m_vecTwiddle[2 * k * nStride + 1];
+					for (size_t nStart = k; nStart < m_nSize; nStart += 2 * nHalf)
+					{
+						FTYPE* a = p + 2 * nStart;
+						FTYPE* b = a + 2 * nHalf;
+						FTYPE tr = b[0] * wr - b[1] * wi, ti = b[0] * wi + b[1] * wr;
+						b[0] = a[0] - tr; b[1] = a[1] - ti;
+						a[0] += tr; a[1] += ti;
+					}
+				}
+			}
+		}
+
+		size_t m_nSize = 0;
+		vector<FTYPE> m_vecTwiddle;
+		vector<size_t> m_vecReverse;
+	};
+
+	// A transformed impulse response. Partitions of nSize samples are zero padded
+	// to 2 * nSize and only the nSize + 1 non-redundant bins of each are kept.
+	struct ir_spectra
+	{
+		static const unsigned int TAIL_RATIO = 8;
+
+		unsigned int nHeadSize = 0;		// Head partition size, the block size
+		unsigned int nTailSize = 0;		// Tail partition size, 0 when uniform
+		size_t nHeadParts = 0;
+		size_t nTailParts = 0;
+		size_t nLength = 0;				// Impulse response samples
+		vector<FTYPE> vecHead;
+		vector<FTYPE> vecTail;
+
+		// The tail only pays off once there are several tail partitions to
+		// replace; it starts after 2 * nTailSize samples of head.
+		static shared_ptr<const ir_spectra> Create(const vector<FTYPE>& vecIR, unsigned int nBlock, bool bNonUniform)
+		{
+			auto ir = make_shared<ir_spectra>();
+			ir->nLength = vecIR.size();
+			ir->nHeadSize = nBlock;
+
+			size_t nHeadLength = vecIR.size();
+			unsigned int nTail = nBlock * TAIL_RATIO;
+			if (bNonUniform && vecIR.size() > 4 * (size_t)nTail)
+			{
+				ir->nTailSize = nTail;
+				nHeadLength = 2 * (size_t)nTail;
+			}
+
+			ir->nHeadParts = Transform(vecIR, 0, nHeadLength, nBlock, ir->vecHead);
+			if (ir->nTailSize > 0)
+				ir->nTailParts = Transform(vecIR, nHeadLength, vecIR.size(), ir->nTailSize, ir->vecTail);
+			return ir;
+		}
+
+	private:
+		// The inverse transform's 1 / (2 * nSize) is folded in here
+		static size_t Transform(const vector<FTYPE>& vecIR, size_t nFrom, size_t nTo, unsigned int nSize, vector<FTYPE>& vecOut)
+		{
+			size_t nParts = max((nTo - nFrom + nSize - 1) / nSize, (size_t)1);
+			size_t nBins = nSize + 1;
+			vecOut.assign(nParts * nBins * 2, 0.0);
+
+			fft transform;
+			transform.Create(2 * nSize);
+			vector<FTYPE> vecWork(4 * nSize);
+			FTYPE dScale = 1.0 / (2.0 * nSize);
+
+			for (size_t p = 0; p < nParts; p++)
+			{
+				fill(vecWork.begin(), vecWork.end(), 0.0);
+				for (size_t i = 0; i < nSize && nFrom + p * nSize + i < nTo; i++)
+					vecWork[2 * i] = vecIR[nFrom + p * nSize + i] * dScale;
+				transform.Forward(vecWork.data());
+				copy(vecWork.begin(), vecWork.begin() + nBins * 2, vecOut.begin() + p * nBins * 2);
+			}
+			return nParts;
+		}
+	};
+
+	// Convolves a mono stream with an ir_spectra, exactly one block late
+	class convolver
+	{
+	public:
+		void Create(shared_ptr<const ir_spectra> ir)
+		{
+			m_ir = ir;
+			m_nBlock = ir->nHeadSize;
+			m_head.Create(ir->nHeadSize, ir->nHeadParts, ir->vecHead.data());
+			m_vecHeadIn.assign(2 * m_nBlock, 0.0);
+			m_vecOut.assign(m_nBlock, 0.0);
+
+			m_bTail = ir->nTailParts > 0;
+			if (m_bTail)
+			{
+				m_tail.Create(ir->nTailSize, ir->nTailParts, ir->vecTail.data());
+				m_vecTailIn.assign(2 * (size_t)ir->nTailSize, 0.0);
+				m_vecTailWindow.assign(2 * (size_t)ir->nTailSize, 0.0);
+				for (int i = 0; i < 2; i++)
+					m_vecTailOut[i].assign(ir->nTailSize, 0.0);
+			}
+			Reset();
+		}
+
+		void Reset()
+		{
+			fill(m_vecHeadIn.begin(), m_vecHeadIn.end(), 0.0);
+			fill(m_vecOut.begin(), m_vecOut.end(), 0.0);
+			m_head.Reset();
+			if (m_bTail)
+			{
+				m_tail.Reset();
+				fill(m_vecTailIn.begin(), m_vecTailIn.end(), 0.0);
+				for (int i = 0; i < 2; i++)
+					fill(m_vecTailOut[i].begin(), m_vecTailOut[i].end(), 0.0);
+			}
+			m_nFill = 0;
+			m_nStep = 0;
+			m_nTailWrite = 0;
+			m_nSlice = -1;
+		}
+
+		bool IsCreated() const { return m_ir != nullptr; }
+
+		unsigned int Latency() const { return m_nBlock; }
+
+		size_t Length() const { return m_ir != nullptr ? m_ir->nLength : 0; }
+
+		// Adds the convolved signal into pOut. Any number of frames may be passed
+		// in, the partitions are filled and emptied through a one block FIFO.
+		void Process(const FTYPE* pIn, FTYPE* pOut, unsigned int nFrames)
+		{
+			while (nFrames > 0)
+			{
+				unsigned int nChunk = min(nFrames, m_nBlock - m_nFill);
+				copy(pIn, pIn + nChunk, m_vecHeadIn.begin() + m_nBlock + m_nFill);
+				for (unsigned int n = 0; n < nChunk; n++)
+					pOut[n] += m_vecOut[m_nFill + n];
+
+				m_nFill += nChunk;
+				pIn += nChunk;
+				pOut += nChunk;
+				nFrames -= nChunk;
+
+				if (m_nFill == m_nBlock)
+				{
+					Step();
+					m_nFill = 0;
+				}
+			}
+		}
+
+	private:
+		// One partition size: its input spectrum history and the sum being built
+		struct level
+		{
+			fft transform;
+			unsigned int nSize = 0;
+			size_t nParts = 0;
+			size_t nBins = 0;
+			const FTYPE* pSpectra = nullptr;
+			vector<FTYPE> vecHistory;	// nParts input spectra, a ring
+			vector<FTYPE> vecWork;		// 2 * nSize complex
+			vector<FTYPE> vecSum;		// nBins complex
+			size_t nNewest = 0;
+
+			void Create(unsigned int nPartSize, size_t nPartCount, const FTYPE* pPartSpectra)
+			{
+				nSize = nPartSize;
+				nParts = nPartCount;
+				nBins = nSize + 1;
+				pSpectra = pPartSpectra;
+				transform.Create(2 * nSize);
+				vecHistory.assign(nParts * nBins * 2, 0.0);
+				vecWork.assign(4 * (size_t)nSize, 0.0);
+				vecSum.assign(nBins * 2, 0.0);
+			}
+
+			void Reset()
+			{
+				fill(vecHistory.begin(), vecHistory.end(), 0.0);
+				nNewest = 0;
+			}
+
+			// Transforms the 2 * nSize real samples in pWindow into the history
+			void Push(const FTYPE* pWindow)
+			{
+				for (size_t i = 0; i < 2 * (size_t)nSize; i++)
+				{
+					vecWork[2 * i] = pWindow[i];
+					vecWork[2 * i + 1] = 0.0;
+				}
+				transform.Forward(vecWork.data());
+				nNewest = nNewest + 1 == nParts ? 0 : nNewest + 1;
+				copy(vecWork.begin(), vecWork.begin() + nBins * 2, vecHistory.begin() + nNewest * nBins * 2);
+				fill(vecSum.begin(), vecSum.end(), 0.0);
+			}
+
+			// Partition p meets the input from p partitions ago
+			void Accumulate(size_t nFirst, size_t nLast)
+			{
+				FTYPE* pSum = vecSum.data();
+				for (size_t p = nFirst; p < nLast; p++)
+				{
+					size_t nSlot = nNewest >= p ? nNewest - p : nNewest + nParts - p;
+					const FTYPE* x = vecHistory.data() + nSlot * nBins * 2;
+					const FTYPE* h = pSpectra + p * nBins * 2;
+					for (size_t k = 0; k < nBins * 2; k += 2)
+					{
+						pSum[k] += x[k] * h[k] - x[k + 1] * h[k + 1];
+						pSum[k + 1] += x[k] * h[k + 1] + x[k + 1] * h[k];
+					}
+				}
+			}
+
+			// Back to the time domain, the last nSize samples are the valid ones
+			void Finish(FTYPE* pOut)
+			{
+				size_t nFull = 2 * (size_t)nSize;
+				copy(vecSum.begin(), vecSum.end(), vecWork.begin());
+				for (size_t k = nBins; k < nFull; k++)
+				{
+					vecWork[2 * k] = vecSum[2 * (nFull - k)];
+					vecWork[2 * k + 1] = -vecSum[2 * (nFull - k) + 1];
+				}
+				transform.Inverse(vecWork.data());
+				for (size_t i = 0; i < nSize; i++)
+					pOut[i] = vecWork[2 * (nSize + i)];
+			}
+		};
+
+		// A block of input is complete: work out the block that plays next
+		void Step()
+		{
+			m_head.Push(m_vecHeadIn.data());
+			m_head.Accumulate(0, m_head.nParts);
+			m_head.Finish(m_vecOut.data());
+			copy(m_vecHeadIn.begin() + m_nBlock, m_vecHeadIn.end(), m_vecHeadIn.begin());
+
+			if (m_bTail)
+				StepTail();
+
+			m_nStep++;
+		}
+
+		// Tail segment m (TAIL_RATIO blocks) is complete at the end of block
+		// (m + 1) * TAIL_RATIO - 1, its result is first needed in block
+		// (m + 2) * TAIL_RATIO. The blocks in between each do one slice of it.
+		void StepTail()
+		{
+			const uint64_t nRatio = ir_spectra::TAIL_RATIO;
+
+			// Mix in the tail's share of this block
+			if (m_nStep >= 2 * nRatio)
+			{
+				uint64_t nSegment = m_nStep / nRatio - 2;
+				const FTYPE* pTail = m_vecTailOut[nSegment & 1].data() + (m_nStep % nRatio) * m_nBlock;
+				for (unsigned int n = 0; n < m_nBlock; n++)
+					m_vecOut[n] += pTail[n];
+			}
+
+			// One slice of the segment in progress
+			if (m_nSlice >= 0)
+			{
+				size_t nParts = m_tail.nParts;
+				if (m_nSlice == 0)
+					m_tail.Push(m_vecTailWindow.data());
+				m_tail.Accumulate(nParts * m_nSlice / nRatio, nParts * (m_nSlice + 1) / nRatio);
+				if (++m_nSlice == (int)nRatio)
+				{
+					m_tail.Finish(m_vecTailOut[m_nSegment & 1].data());
+					m_nSlice = -1;
+				}
+			}
+
+			// Collect the input, starting the next segment when it is complete
+			size_t nRing = m_vecTailIn.size();
+			const FTYPE* pBlock = m_vecHeadIn.data(); // Already shifted down
+			for (unsigned int n = 0; n < m_nBlock; n++)
+			{
+				m_vecTailIn[m_nTailWrite] = pBlock[n];
+				if (++m_nTailWrite == nRing) m_nTailWrite = 0;
+			}
+
+			if ((m_nStep + 1) % nRatio == 0)
+			{
+				// The ring holds the last two segments, oldest first from the write position
+				for (size_t i = 0; i < nRing; i++)
+					m_vecTailWindow[i] = m_vecTailIn[(m_nTailWrite + i) % nRing];
+				m_nSegment = (m_nStep + 1) / nRatio - 1;
+				m_nSlice = 0;
+			}
+		}
+
+		shared_ptr<const ir_spectra> m_ir;
+		unsigned int m_nBlock = 0;
+		unsigned int m_nFill = 0;
+		uint64_t m_nStep = 0;
+
+		level m_head;
+		vector<FTYPE> m_vecHeadIn;		// Previous block then the one being filled
+		vector<FTYPE> m_vecOut;			// Block being played out
+
+		bool m_bTail = false;
+		level m_tail;
+		vector<FTYPE> m_vecTailIn;		// Ring of the last two tail segments
+		vector<FTYPE> m_vecTailWindow;	// The same, in order, for the segment in progress
+		vector<FTYPE> m_vecTailOut[2];	// Finished segments, alternating
+		size_t m_nTailWrite = 0;
+		uint64_t m_nSegment = 0;
+		int m_nSlice = -1;				// Next slice of m_nSegment, -1 when idle
+	};
+
+	// Transformed impulse responses by file, block size and options, so every
+	// engine loading the same room shares one copy
+	inline shared_ptr<const ir_spectra> LoadImpulseResponse(const string& sFile, unsigned int nBlock, FTYPE dSampleRate, bool bNonUniform, string& sError)
+	{
+		static rt::checked_mutex muxCache;
+		static map<string, shared_ptr<const ir_spectra>> mapCache;
+
+		string sKey = sFile + "|" + to_string(nBlock) + "|" + to_string((int)dSampleRate) + (bNonUniform ? "|nu" : "|u");
+		{
+			unique_lock<rt::checked_mutex> lm(muxCache);
+			auto it = mapCache.find(sKey);
+			if (it != mapCache.end())
+				return it->second;
+		}
+
+		vector<double> vecSamples;
+		unsigned int nFileRate = 0, nChannels = 0;
+		if (!wave::Read(sFile, vecSamples, nFileRate, nChannels, sError))
+			return nullptr;
+
+		// Mix down to mono, then resample linearly if the rates differ
+		size_t nFrames = vecSamples.size() / nChannels;
+		vector<FTYPE> vecMono(nFrames, 0.0);
+		for (size_t i = 0; i < nFrames; i++)
+		{
+			for (unsigned int c = 0; c < nChannels; c++)
+				vecMono[i] += (FTYPE)vecSamples[i * nChannels + c];
+			vecMono[i] /= (FTYPE)nChannels;
+		}
+
+		if (nFrames > 1 && (FTYPE)nFileRate != dSampleRate)
+		{
+			FTYPE dRatio = (FTYPE)nFileRate / dSampleRate;
+			vector<FTYPE> vecResampled((size_t)((nFrames - 1) / dRatio) + 1);
+			for (size_t i = 0; i < vecResampled.size(); i++)
+			{
+				FTYPE dPos = i * dRatio;
+				size_t i0 = min((size_t)dPos, nFrames - 2);
+				FTYPE dFrac = dPos - (FTYPE)i0;
+				vecResampled[i] = vecMono[i0] + (vecMono[i0 + 1] - vecMono[i0]) * dFrac;
+			}
+			vecMono.swap(vecResampled);
+		}
+
+		if (vecMono.empty())
+		{
+			sError = sFile + " is empty";
+			return nullptr;
+		}
+
+		// Unit energy, so dLevel means the same for every room
+		FTYPE dEnergy = 0.0;
+		for (FTYPE s : vecMono)
+			dEnergy += s * s;
+		if (dEnergy > 0.0)
+			for (FTYPE& s : vecMono)
+				s /= sqrt(dEnergy);
+
+		auto ir = ir_spectra::Create(vecMono, nBlock, bNonUniform);
+		unique_lock<rt::checked_mutex> lm(muxCache);
+		mapCache[sKey] = ir;
+		return ir;
+	}
+
+	// Room reverb on the mono mix, silent until an impulse response is loaded
+	struct effect_reverb
+	{
+		FTYPE dLevel = 0.3;
+
+		void Create(FTYPE dSampleRate, unsigned int nMaxFrames)
+		{
+			m_dSampleRate = dSampleRate;
+			m_vecWet.assign(nMaxFrames, 0.0);
+		}
+
+		// Not real-time safe, load before rendering starts. nBlock is the
+		// partition size and so the added latency, normally the device block.
+		bool Load(const string& sFile, unsigned int nBlock, bool bNonUniform, string& sError)
+		{
+			if (nBlock == 0 || (nBlock & (nBlock - 1)) != 0)
+			{
+				sError = "reverb block size must be a power of two";
+				return false;
+			}
+
+			auto ir = LoadImpulseResponse(sFile, nBlock, m_dSampleRate, bNonUniform, sError);
+			if (ir == nullptr)
+				return false;
+			m_convolver.Create(ir);
+			return true;
+		}
+
+		bool IsLoaded() const { return m_convolver.IsCreated(); }
+
+		// The response plus the block of latency
+		size_t TailFrames() const
+		{
+			return IsLoaded() ? m_convolver.Length() + m_convolver.Latency() : 0;
+		}
+
+		// Adds the reverberated signal into pOut (mono), pIn may be pOut
+		void Process(const FTYPE* pIn, FTYPE* pOut, unsigned int nFrames)
+		{
+			if (!IsLoaded())
+				return;
+			FTYPE* pWet = m_vecWet.data();
+			fill(pWet, pWet + nFrames, 0.0);
+			m_convolver.Process(pIn, pWet, nFrames);
+			for (unsigned int n = 0; n < nFrames; n++)
+				pOut[n] += pWet[n] * dLevel;
+		}
+
+	private:
+		convolver m_convolver;
+		vector<FTYPE> m_vecWet;
+		FTYPE m_dSampleRate = 44100.0;
+	};
+
+	// Times the convolver on decaying noise responses of 1 and 5 seconds, with
+	// and without the tail level, reported as a share of real time
+	inline int BenchmarkReverb(unsigned int nBlock = 256, FTYPE dSampleRate = 44100.0)
+	{
+		uint32_t nState = 2463534242u;
+		auto random = [&nState]()
+		{
+			nState ^= nState << 13;
+			nState ^= nState >> 17;
+			nState ^= nState << 5;
+			return 2.0 * ((FTYPE)nState / (FTYPE)UINT32_MAX) - 1.0;
+		};
+
+		const FTYPE dRenderSeconds = 20.0;
+		vector<FTYPE> vecIn((size_t)(dRenderSeconds * dSampleRate));
+		for (auto& s : vecIn)
+			s = random() * 0.1;
+		vector<FTYPE> vecOut(nBlock);
+
+		cout << "Convolution reverb, block " << nBlock << " at " << (int)dSampleRate << "Hz" << endl;
+		for (FTYPE dSeconds : { 1.0, 5.0 })
+		{
+			vector<FTYPE> vecIR((size_t)(dSeconds * dSampleRate));
+			for (size_t i = 0; i < vecIR.size(); i++)
+				vecIR[i] = random() * exp(-6.9 * (FTYPE)i / vecIR.size()); // -60dB at the end
+
+			for (bool bNonUniform : { false, true })
+			{
+				auto tLoad = chrono::steady_clock::now();
+				auto ir = ir_spectra::Create(vecIR, nBlock, bNonUniform);
+				double dLoad = chrono::duration<double>(chrono::steady_clock::now() - tLoad).count();
+
+				convolver conv;
+				conv.Create(ir);
+
+				// The slowest blocks as well as the average, the audio thread has to
+				// survive the peaks. The 99th percentile keeps scheduler noise out.
+				vector<double> vecBlock;
+				vecBlock.reserve(vecIn.size() / nBlock);
+				auto tStart = chrono::steady_clock::now();
+				for (size_t nPos = 0; nPos + nBlock <= vecIn.size(); nPos += nBlock)
+				{
+					auto tBlock = chrono::steady_clock::now();
+					conv.Process(&vecIn[nPos], vecOut.data(), nBlock);
+					vecBlock.push_back(chrono::duration<double>(chrono::steady_clock::now() - tBlock).count());
+				}
+				double dTotal = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+				sort(vecBlock.begin(), vecBlock.end());
+				double dPeak = vecBlock[vecBlock.size() * 99 / 100];
+				double dBlockPeriod = nBlock / dSampleRate;
+
+				cout << fixed << setprecision(2)
+					<< "  IR " << dSeconds << "s " << (bNonUniform ? "non-uniform" : "uniform    ")
+					<< " partitions " << ir->nHeadParts << "x" << ir->nHeadSize;
+				if (ir->nTailParts > 0)
+					cout << " + " << ir->nTailParts << "x" << ir->nTailSize;
+				cout << "  load " << dLoad * 1000.0 << "ms"
+					<< "  average " << dTotal / dRenderSeconds * 100.0 << "% of real time"
+					<< "  p99 block " << dPeak / dBlockPeriod * 100.0 << "%" << endl;
+			}
+		}
+		return 0;
+	}
+}
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+#include "synthWave.h"
+
+#ifdef _WIN32
+#include <Psapi.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Sample streaming
+	//
+	// Sample files are memory mapped, never read into RAM as a whole. Only the
+	// head of each one is decoded up front, enough to start a note at once. A
+	// prefetch thread decodes the rest into a ring per playing voice, ahead of
+	// the audio thread, which only ever reads memory that is already resident.
+	// Pages the prefetcher is done with are handed back, so resident memory
+	// follows what is playing rather than the size of the library.
+
+	// Read only view of a whole file
+	class mapped_file
+	{
+	public:
+		mapped_file() {}
+		~mapped_file() { Close(); }
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		bool Open(const string& sFile, string& sError)
+		{
+			Close();
+#ifdef _WIN32
+			HANDLE hFile = CreateFileA(sFile.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (hFile == INVALID_HANDLE_VALUE)
+			{
+				sError = "cannot open " + sFile;
+				return false;
+			}
+			LARGE_INTEGER nSize;
+			if (GetFileSizeEx(hFile, &nSize))
+				m_nSize = (size_t)nSize.QuadPart;
+			HANDLE hMapping = m_nSize > 0 ? CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+			CloseHandle(hFile);
+			if (hMapping != nullptr)
+			{
+				m_pData = (const unsigned char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(hMapping); // The view keeps the mapping alive
+			}
+#else
+			int nFile = open(sFile.c_str(), O_RDONLY);
+			if (nFile < 0)
+			{
+				sError = "cannot open " + sFile;
+				return false;
+			}
+			struct stat info;
+			if (fstat(nFile, &info) == 0)
+				m_nSize = (size_t)info.st_size;
+			void* pMap = m_nSize > 0 ? mmap(nullptr, m_nSize, PROT_READ, MAP_SHARED, nFile, 0) : MAP_FAILED;
+			close(nFile); // The mapping keeps the file open
+			if (pMap != MAP_FAILED)
+				m_pData = (const unsigned char*)pMap;
+#endif
+			if (m_pData == nullptr)
+			{
+				m_nSize = 0;
+				sError = "cannot map " + sFile;
+				return false;
+			}
+			return true;
+		}
+
+		void Close()
+		{
+			if (m_pData != nullptr)
+			{
+#ifdef _WIN32
+				UnmapViewOfFile(m_pData);
+#else
+				munmap((void*)m_pData, m_nSize);
+#endif
+			}
+			m_pData = nullptr;
+			m_nSize = 0;
+		}
+
+		const unsigned char* Data() const { return m_pData; }
+		size_t Size() const { return m_nSize; }
+
+		// Starts reading a range in before it is touched
+		void WillNeed(size_t nOffset, size_t nBytes) const
+		{
+#ifndef _WIN32
+			size_t nStart, nEnd;
+			if (Pages(nOffset, nBytes, nStart, nEnd))
+				madvise((void*)(m_pData + nStart), nEnd - nStart, MADV_WILLNEED);
+#endif
+		}
+
+		// Drops a range from this process's resident memory, as it is read front
+		// to back: the page it ends part way into stays. The pages remain in the
+		// OS file cache and fault back in if touched again.
+		void Release(size_t nOffset, size_t nBytes) const
+		{
+			size_t nStart, nEnd;
+			if (!Pages(nOffset, nBytes, nStart, nEnd))
+				return;
+			if (nOffset + nBytes < m_nSize)
+				nEnd -= (nOffset + nBytes) % PageSize() != 0 ? PageSize() : 0;
+			if (nEnd <= nStart)
+				return;
+#ifdef _WIN32
+			VirtualUnlock((void*)(m_pData + nStart), nEnd - nStart); // Unlocking pages that are not locked trims them
+#else
+			madvise((void*)(m_pData + nStart), nEnd - nStart, MADV_DONTNEED);
+#endif
+		}
+
+		static size_t PageSize()
+		{
+#ifdef _WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			static const size_t nPage = info.dwPageSize;
+#else
+			static const size_t nPage = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+			return nPage;
+		}
+
+	private:
+		const unsigned char* m_pData = nullptr;
+		size_t m_nSize = 0;
+
+		// The pages covering a range
+		bool Pages(size_t nOffset, size_t nBytes, size_t& nStart, size_t& nEnd) const
+		{
+			size_t nPage = PageSize();
+			nOffset = min(nOffset, m_nSize);
+			nBytes = min(nBytes, m_nSize - nOffset);
+			nStart = nOffset / nPage * nPage;
+			nEnd = (nOffset + nBytes + nPage - 1) / nPage * nPage;
+			return nEnd > nStart;
+		}
+	};
+
+	// One sample file, mapped, with its head decoded to mono
+	struct sample
+	{
+		string sFile;
+		int nRoot = 60;		// Note id the file plays at its own pitch
+		int nLow = 0;		// Note ids it is used for
+		int nHigh = 127;
+		mapped_file file;
+		wave::format fmt;
+		vector<float> vecHead;
+
+		bool Load(const string& sPath, size_t nHeadFrames, string& sError)
+		{
+			sFile = sPath;
+			if (!file.Open(sPath, sError) || !wave::Parse(file.Data(), file.Size(), sPath, fmt, sError))
+				return false;
+
+			vecHead.resize(min(nHeadFrames, fmt.nFrames));
+			for (size_t n = 0; n < vecHead.size(); n++)
+				vecHead[n] = (float)fmt.Mono(n);
+
+			// Nothing of the file needs to stay resident now
+			file.Release(0, file.Size());
+			return true;
+		}
+
+		// Where frame n starts in the file
+		size_t Offset(size_t n) const
+		{
+			return (size_t)(fmt.pData - file.Data()) + n * fmt.FrameBytes();
+		}
+	};
+
+	// The streamed part of one voice. The audio thread starts it on a sample and
+	// reports how far it has played; the prefetcher keeps the ring filled ahead
+	// of that. The fill count carries a generation, so anything decoded for a
+	// sample the voice has since left is thrown away rather than published.
+	class sample_stream
+	{
+	public:
+		static const size_t RING_FRAMES = 32768;	// Power of two, 0.75s at 44.1kHz
+
+		void Create()
+		{
+			m_vecRing.assign(RING_FRAMES, 0.0f);
+		}
+
+		// Audio thread: plays pSample from the start, or nothing if nullptr
+		void Start(const sample* pSample)
+		{
+			m_nGeneration = (m_nGeneration + 1) & GENERATION_MASK;
+			m_pSample.store(pSample, memory_order_relaxed);
+			m_nNeed.store(0, memory_order_relaxed);
+			m_nFilled.store(((uint64_t)m_nGeneration << FRAME_BITS) | (pSample ? pSample->vecHead.size() : 0), memory_order_release);
+		}
+
+		// Audio thread: frame n of the sample, false if it has not been decoded yet
+		bool Frame(const sample& s, size_t n, float& fFrame) const
+		{
+			if (n < s.vecHead.size())
+			{
+				fFrame = s.vecHead[n];
+				return true;
+			}
+			uint64_t nFilled = m_nFilled.load(memory_order_acquire);
+			if ((nFilled >> FRAME_BITS) != m_nGeneration || n >= (nFilled & FRAME_MASK))
+				return false;
+			fFrame = m_vecRing[n & (RING_FRAMES - 1)];
+			return true;
+		}
+
+		// Audio thread: frames before n will not be asked for again
+		void Played(size_t n)
+		{
+			m_nNeed.store(n, memory_order_release);
+		}
+
+		// Prefetch thread: decodes up to nMaxFrames more, returns how many
+		size_t Fill(size_t nMaxFrames)
+		{
+			uint64_t nFilled = m_nFilled.load(memory_order_acquire);
+			const sample* pSample = m_pSample.load(memory_order_acquire);
+			if (pSample == nullptr)
+				return 0;
+
+			size_t nFrom = (size_t)(nFilled & FRAME_MASK);
+			size_t nTo = min(min(pSample->fmt.nFrames, m_nNeed.load(memory_order_acquire) + RING_FRAMES), nFrom + nMaxFrames);
+			if (nTo <= nFrom)
+				return 0;
+
+			for (size_t n = nFrom; n < nTo; n++)
+				m_vecRing[n & (RING_FRAMES - 1)] = (float)pSample->fmt.Mono(n);
+
+			// Read the next stretch in while this one plays, and let go of this one
+			pSample->file.WillNeed(pSample->Offset(nTo), nMaxFrames * pSample->fmt.FrameBytes());
+			pSample->file.Release(pSample->Offset(nFrom), (nTo - nFrom) * pSample->fmt.FrameBytes());
+
+			// Restarted meanwhile, the frames are not for this note
+			if (!m_nFilled.compare_exchange_strong(nFilled, (nFilled & ~FRAME_MASK) | nTo, memory_order_release))
+				return 0;
+			return nTo - nFrom;
+		}
+
+	private:
+		static const int FRAME_BITS = 40;
+		static const uint64_t FRAME_MASK = (1ull << FRAME_BITS) - 1;
+		static const uint32_t GENERATION_MASK = (1u << (64 - FRAME_BITS)) - 1;
+
+		vector<float> m_vecRing;
+		atomic<const sample*> m_pSample{ nullptr };
+		atomic<uint64_t> m_nFilled{ 0 };	// Generation << FRAME_BITS | frames decoded
+		atomic<uint64_t> m_nNeed{ 0 };
+		uint32_t m_nGeneration = 0;		// Audio thread only
+	};
+
+	// Thread keeping a set of streams filled, a chunk each per pass
+	class sample_prefetcher
+	{
+	public:
+		static const size_t CHUNK_FRAMES = 4096;
+
+		~sample_prefetcher()
+		{
+			Stop();
+		}
+
+		void Start(sample_stream* pStreams, size_t nStreams)
+		{
+			Stop();
+			m_bRunning = true;
+			m_thread = thread([=]()
+			{
+				while (m_bRunning)
+				{
+					size_t nDecoded = 0;
+					for (size_t i = 0; i < nStreams; i++)
+						nDecoded += pStreams[i].Fill(CHUNK_FRAMES);
+					if (nDecoded == 0)
+						this_thread::sleep_for(chrono::milliseconds(1));
+				}
+			});
+		}
+
+		void Stop()
+		{
+			m_bRunning = false;
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+
+		bool IsRunning() const { return m_thread.joinable(); }
+
+	private:
+		atomic<bool> m_bRunning{ false };
+		thread m_thread;
+	};
+
+	// This process's resident memory in bytes
+	inline size_t ResidentBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS info;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
+			return info.WorkingSetSize;
+		return 0;
+#else
+		size_t nPages = 0, nResident = 0;
+		FILE* f = fopen("/proc/self/statm", "r");
+		if (f != nullptr)
+		{
+			if (fscanf(f, "%zu %zu", &nPages, &nResident) != 2)
+				nResident = 0;
+			fclose(f);
+		}
+		return nResident * mapped_file::PageSize();
+#endif
+	}
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+#include "olcNoiseMaker.h"
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Songs
+	//
+	// A song is a set of step patterns and a chain saying which pattern plays
+	// when, how often and at what tempo. In text, one statement per line, '#'
+	// starts a comment:
+	//
+	//     pattern <name> <steps> [swing <fraction>]
+	//     <instrument> <steps...>
+	//     tempo <bpm> [<steps per beat>]
+	//     play <pattern> [<times>]
+	//
+	// Rows after a pattern line belong to it, one per instrument (any name
+	// engine::FindInstrument() knows). A row is either one string of '.', 'x'
+	// and 'X', a step each as the sequencer's beats, or a step per word:
+	//
+	//     .							Rest
+	//     X or x						Hit on note 64, x softer
+	//     <note>[:<velocity>[:<length>]]	Note id, velocity 0 to 1, length in steps
+	//
+	// Hits are triggers that play out on their own, notes without a length hold
+	// for one step. Notes are cut at the end of their pattern. Swing delays every
+	// second step by a fraction of a step. Tempo applies to the plays after it.
+
+	struct song_step
+	{
+		int nNote = -1;		// Rest when negative
+		float fVelocity = 1.0f;
+		float fLength = 0.0f;	// Steps, 0 for a trigger
+	};
+
+	struct song_row
+	{
+		string sInstrument;
+		vector<song_step> vecSteps;
+	};
+
+	struct song_pattern
+	{
+		string sName;
+		int nSteps = 16;
+		FTYPE dSwing = 0.0;
+		vector<song_row> vecRows;
+	};
+
+	struct song_play
+	{
+		int nPattern = 0;
+		int nTimes = 1;
+		FTYPE dTempo = 120.0;
+		int nSubBeats = 4;
+	};
+
+	struct song_score
+	{
+		vector<song_pattern> vecPatterns;
+		vector<song_play> vecChain;
+	};
+
+	// One step of a row in the word form
+	inline bool ParseSongStep(const string& sWord, song_step& step)
+	{
+		step = song_step();
+		if (sWord == ".")
+			return true;
+		if (sWord == "X" || sWord == "x")
+		{
+			step.nNote = 64;
+			step.fVelocity = sWord == "X" ? 1.0f : 0.5f;
+			return true;
+		}
+
+		char* pEnd = nullptr;
+		step.nNote = (int)strtol(sWord.c_str(), &pEnd, 10);
+		step.fLength = 1.0f;
+		if (pEnd == sWord.c_str() || step.nNote < 0 || step.nNote > 127)
+			return false;
+		if (*pEnd == ':')
+			step.fVelocity = strtof(pEnd + 1, &pEnd);
+		if (*pEnd == ':')
+			step.fLength = strtof(pEnd + 1, &pEnd);
+		return *pEnd == '\0' && step.fVelocity >= 0.0f && step.fVelocity <= 1.0f && step.fLength > 0.0f;
+	}
+
+	// sSource names the text in error messages
+	inline bool ParseSong(istream& text, const string& sSource, song_score& score, string& sError)
+	{
+		score = song_score();
+		FTYPE dTempo = 120.0;
+		int nSubBeats = 4;
+		string sLine;
+		int nLine = 0;
+		while (getline(text, sLine))
+		{
+			nLine++;
+			sLine = sLine.substr(0, sLine.find('#'));
+			istringstream line(sLine);
+			string sWord;
+			if (!(line >> sWord))
+				continue;
+
+			string sWhere = sSource + ":" + to_string(nLine) + ": ";
+			bool bOk = true;
+			if (sWord == "pattern")
+			{
+				song_pattern p;
+				string sSwing;
+				bOk = (bool)(line >> p.sName >> p.nSteps) && p.nSteps > 0;
+				if (bOk && line >> sSwing)
+					bOk = sSwing == "swing" && (bool)(line >> p.dSwing) && p.dSwing >= 0.0 && p.dSwing < 1.0;
+				score.vecPatterns.push_back(p);
+			}
+			else if (sWord == "tempo")
+			{
+				bOk = (bool)(line >> dTempo) && dTempo > 0.0;
+				if (bOk && !(line >> nSubBeats))
+					nSubBeats = 4;
+				bOk = bOk && nSubBeats > 0;
+			}
+			else if (sWord == "play")
+			{
+				song_play play;
+				string sPattern;
+				bOk = (bool)(line >> sPattern);
+				play.nPattern = -1;
+				for (size_t i = 0; i < score.vecPatterns.size(); i++)
+					if (score.vecPatterns[i].sName == sPattern)
+						play.nPattern = (int)i;
+				if (play.nPattern < 0)
+				{
+					sError = sWhere + "no pattern '" + sPattern + "' before this";
+					return false;
+				}
+				if (!(line >> play.nTimes))
+					play.nTimes = 1;
+				bOk = bOk && play.nTimes > 0;
+				play.dTempo = dTempo;
+				play.nSubBeats = nSubBeats;
+				score.vecChain.push_back(play);
+			}
+			else
+			{
+				// A row of the pattern being defined
+				if (score.vecPatterns.empty())
+				{
+					sError = sWhere + "'" + sWord + "' is not a statement, and no pattern is open for a row";
+					return false;
+				}
+				song_pattern& p = score.vecPatterns.back();
+				song_row row;
+				row.sInstrument = sWord;
+
+				vector<string> vecWords;
+				while (line >> sWord)
+					vecWords.push_back(sWord);
+				if (vecWords.size() == 1 && vecWords[0].size() == (size_t)p.nSteps && vecWords[0].find_first_not_of(".xX") == string::npos)
+				{
+					string sCompact = vecWords[0];
+					vecWords.clear();
+					for (char c : sCompact)
+						vecWords.push_back(string(1, c));
+				}
+				if (vecWords.size() != (size_t)p.nSteps)
+				{
+					sError = sWhere + "pattern '" + p.sName + "' has " + to_string(p.nSteps) + " steps, the row has " + to_string(vecWords.size());
+					return false;
+				}
+
+				row.vecSteps.resize(p.nSteps);
+				for (int s = 0; s < p.nSteps && bOk; s++)
+					if (!ParseSongStep(vecWords[s], row.vecSteps[s]))
+					{
+						sError = sWhere + "bad step '" + vecWords[s] + "'";
+						return false;
+					}
+				p.vecRows.push_back(row);
+			}
+
+			if (!bOk)
+			{
+				sError = sWhere + "cannot read '" + sLine + "'";
+				return false;
+			}
+		}
+
+		if (score.vecChain.empty())
+		{
+			sError = sSource + ": nothing to play";
+			return false;
+		}
+		return true;
+	}
+
+	inline bool LoadSong(const string& sFile, song_score& score, string& sError)
+	{
+		ifstream f(sFile);
+		if (!f.is_open())
+		{
+			sError = "cannot open " + sFile;
+			return false;
+		}
+		return ParseSong(f, sFile, score, sError);
+	}
+}
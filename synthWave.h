@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <vector>
+#include <string>
+using namespace std;
+
+namespace synth
+{
+	//////////////////////////////////////////////////////////////////////////////
+	// Wave files
+
+	namespace wave
+	{
+		inline void WriteU32(ofstream& f, uint32_t n)
+		{
+			char b[4] = { (char)(n & 0xFF), (char)((n >> 8) & 0xFF), (char)((n >> 16) & 0xFF), (char)((n >> 24) & 0xFF) };
+			f.write(b, 4);
+		}
+
+		inline void WriteU16(ofstream& f, uint16_t n)
+		{
+			char b[2] = { (char)(n & 0xFF), (char)((n >> 8) & 0xFF) };
+			f.write(b, 2);
+		}
+
+		// Writes interleaved 16-bit PCM samples as a canonical RIFF/WAVE file
+		inline bool Write(const string& sFile, const vector<short>& vecSamples, unsigned int nSampleRate, unsigned int nChannels)
+		{
+			ofstream f(sFile, ios::binary);
+			if (!f.is_open())
+				return false;
+
+			uint32_t nDataBytes = (uint32_t)(vecSamples.size() * sizeof(short));
+			f.write("RIFF", 4);
+			WriteU32(f, 36 + nDataBytes);
+			f.write("WAVE", 4);
+
+			f.write("fmt ", 4);
+			WriteU32(f, 16);
+			WriteU16(f, 1); // PCM
+			WriteU16(f, (uint16_t)nChannels);
+			WriteU32(f, nSampleRate);
+			WriteU32(f, nSampleRate * nChannels * sizeof(short));
+			WriteU16(f, (uint16_t)(nChannels * sizeof(short)));
+			WriteU16(f, 16);
+
+			f.write("data", 4);
+			WriteU32(f, nDataBytes);
+			for (short s : vecSamples)
+				WriteU16(f, (uint16_t)s);
+
+			return f.good();
+		}
+
+		inline uint32_t ReadU32(const unsigned char* p)
+		{
+			return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+
+		inline uint16_t ReadU16(const unsigned char* p)
+		{
+			return (uint16_t)(p[0] | (p[1] << 8));
+		}
+
+		// Where the audio of a wave file sits in memory and how it is stored
+		struct format
+		{
+			unsigned int nSampleRate = 0;
+			unsigned int nChannels = 0;
+			unsigned int nBits = 0;
+			bool bFloat = false;
+			const unsigned char* pData = nullptr;
+			size_t nFrames = 0;
+
+			size_t FrameBytes() const { return (size_t)nBits / 8 * nChannels; }
+
+			// Channel c of frame n in -1..1
+			double Sample(size_t n, unsigned int c) const
+			{
+				const unsigned char* p = pData + n * FrameBytes() + (size_t)c * (nBits / 8);
+				switch (nBits)
+				{
+				case 8: return ((int)p[0] - 128) / 128.0;
+				case 16: return (int16_t)ReadU16(p) / 32768.0;
+				case 24: return (int32_t)((p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24)) / 2147483648.0;
+				case 32:
+					if (bFloat)
+					{
+						uint32_t n = ReadU32(p);
+						float fValue;
+						memcpy(&fValue, &n, sizeof(fValue));
+						return fValue;
+					}
+					return (int32_t)ReadU32(p) / 2147483648.0;
+				}
+				return 0.0;
+			}
+
+			// Frame n with its channels averaged
+			double Mono(size_t n) const
+			{
+				double dSum = 0.0;
+				for (unsigned int c = 0; c < nChannels; c++)
+					dSum += Sample(n, c);
+				return dSum / nChannels;
+			}
+		};
+
+		// Finds the audio in a whole wave file held in memory. Handles 8, 16, 24
+		// and 32-bit PCM and 32-bit float, plain or WAVE_FORMAT_EXTENSIBLE.
+		inline bool Parse(const unsigned char* pFile, size_t nFileBytes, const string& sFile, format& fmt, string& sError)
+		{
+			if (nFileBytes < 12 || memcmp(pFile, "RIFF", 4) != 0 || memcmp(pFile + 8, "WAVE", 4) != 0)
+			{
+				sError = sFile + " is not a wave file";
+				return false;
+			}
+
+			uint16_t nFormat = 0;
+			fmt = format();
+			size_t nDataBytes = 0;
+
+			// Walk the chunks, they are word aligned
+			size_t nPos = 12;
+			while (nPos + 8 <= nFileBytes)
+			{
+				const unsigned char* pChunk = pFile + nPos;
+				size_t nSize = ReadU32(pChunk + 4);
+				size_t nAvailable = min(nSize, nFileBytes - nPos - 8);
+
+				if (memcmp(pChunk, "fmt ", 4) == 0 && nAvailable >= 16)
+				{
+					nFormat = ReadU16(pChunk + 8);
+					fmt.nChannels = ReadU16(pChunk + 10);
+					fmt.nSampleRate = ReadU32(pChunk + 12);
+					fmt.nBits = ReadU16(pChunk + 22);
+					if (nFormat == 0xFFFE && nAvailable >= 26)
+						nFormat = ReadU16(pChunk + 32); // Sub format GUID starts with the format tag
+				}
+				else if (memcmp(pChunk, "data", 4) == 0)
+				{
+					fmt.pData = pChunk + 8;
+					nDataBytes = nAvailable;
+				}
+
+				nPos += 8 + nSize + (nSize & 1);
+			}
+
+			if (fmt.pData == nullptr || fmt.nChannels == 0 || fmt.nSampleRate == 0)
+			{
+				sError = sFile + " has no audio";
+				return false;
+			}
+
+			fmt.bFloat = nFormat == 3 && fmt.nBits == 32;
+			if (!fmt.bFloat && !(nFormat == 1 && (fmt.nBits == 8 || fmt.nBits == 16 || fmt.nBits == 24 || fmt.nBits == 32)))
+			{
+				sError = sFile + ": unsupported sample format " + to_string(nFormat) + "/" + to_string(fmt.nBits) + " bit";
+				return false;
+			}
+
+			fmt.nFrames = nDataBytes / fmt.FrameBytes();
+			return true;
+		}
+
+		// Reads a RIFF/WAVE file as interleaved samples in -1..1
+		inline bool Read(const string& sFile, vector<double>& vecSamples, unsigned int& nSampleRate, unsigned int& nChannels, string& sError)
+		{
+			ifstream f(sFile, ios::binary);
+			if (!f.is_open())
+			{
+				sError = "cannot open " + sFile;
+				return false;
+			}
+
+			vector<unsigned char> vecFile((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+			format fmt;
+			if (!Parse(vecFile.data(), vecFile.size(), sFile, fmt, sError))
+				return false;
+
+			nSampleRate = fmt.nSampleRate;
+			nChannels = fmt.nChannels;
+			vecSamples.resize(fmt.nFrames * fmt.nChannels);
+			for (size_t n = 0; n < fmt.nFrames; n++)
+				for (unsigned int c = 0; c < fmt.nChannels; c++)
+					vecSamples[n * fmt.nChannels + c] = fmt.Sample(n, c);
+			return true;
+		}
+	}
+}